@@ -1,7 +1,14 @@
 #include <iree/hal/driver.h>
 #include <iree/hal/driver_registry.h>
+#include <nx_iree/profiling.h>
+#include <nx_iree/quota.h>
+#include <nx_iree/release.h>
 #include <nx_iree/runtime.h>
+#include <nx_iree/tensor_bundle.h>
+#include <nx_iree/tracing.h>
 
+#include <algorithm>
+#include <cstring>
 #include <functional>
 #include <iostream>
 #include <map>
@@ -82,6 +89,43 @@ ERL_NIF_TERM get(ErlNifEnv* env, ERL_NIF_TERM term, T*& var) {
                            reinterpret_cast<void**>(&var));
 }
 
+// Releases the IREE reference held by a bytecode module resource.
+void vm_module_dtor(ErlNifEnv* env, void* obj) {
+  iree_vm_module_t** module = reinterpret_cast<iree_vm_module_t**>(obj);
+  if (*module != nullptr) {
+    iree_vm_module_release(*module);
+    *module = nullptr;
+  }
+}
+
+// Deletes the tensor held by a tensor resource. Garbage collection runs this
+// on whichever scheduler dropped the last reference, so the contents are
+// released on the release thread instead.
+void iree_tensor_dtor(ErlNifEnv* env, void* obj) {
+  auto tensor = reinterpret_cast<iree::runtime::IREETensor**>(obj);
+  if (*tensor == nullptr) return;
+  nx_iree::release::enqueue((*tensor)->detach());
+  delete *tensor;
+  *tensor = nullptr;
+}
+
+// A message sent to a process once the resource holding it is garbage
+// collected. Used to release memory which lives outside of this node.
+struct ReleaseNotice {
+  ErlNifPid pid;
+  ErlNifEnv* env;
+  ERL_NIF_TERM message;
+};
+
+void release_notice_dtor(ErlNifEnv* env, void* obj) {
+  auto notice = reinterpret_cast<ReleaseNotice**>(obj);
+  if (*notice == nullptr) return;
+  enif_send(env, &(*notice)->pid, (*notice)->env, (*notice)->message);
+  enif_free_env((*notice)->env);
+  delete *notice;
+  *notice = nullptr;
+}
+
 static int open_resources(ErlNifEnv* env) {
   const char* mod = "NxIREE";
 
@@ -95,7 +139,13 @@ static int open_resources(ErlNifEnv* env) {
   if (!open_resource<iree_hal_driver_registry_t*>(env, mod, "iree_hal_driver_registry_t")) {
     return -1;
   }
-  if (!open_resource<iree::runtime::IREETensor*>(env, mod, "iree::runtime::IREETensor")) {
+  if (!open_resource<iree::runtime::IREETensor*>(env, mod, "iree::runtime::IREETensor", iree_tensor_dtor)) {
+    return -1;
+  }
+  if (!open_resource<iree_vm_module_t*>(env, mod, "iree_vm_module_t", vm_module_dtor)) {
+    return -1;
+  }
+  if (!open_resource<ReleaseNotice*>(env, mod, "ReleaseNotice", release_notice_dtor)) {
     return -1;
   }
 
@@ -184,15 +234,27 @@ DECLARE_NIF(create_instance) {
   return ok(env, make<iree_vm_instance_t*>(env, vm_instance));
 }
 
+// Creates the HAL device for a URI returned by list_devices. Devices are only
+// created once they are first used, as creating them allocates driver resources.
 DECLARE_NIF(create_device) {
-  // create the ref for a device URI
-
   iree_hal_driver_registry_t** registry;
+  std::string device_uri;
+
   if (!get<iree_hal_driver_registry_t*>(env, argv[0], registry)) {
     return error(env, "invalid driver registry");
   }
+  if (!get_string(env, argv[1], device_uri)) {
+    return error(env, "invalid device URI");
+  }
 
-  return enif_make_atom(env, "ok");
+  iree_hal_device_t* device;
+  auto status = create_device(*registry, device_uri, &device);
+
+  if (!is_ok(status)) {
+    return error(env, get_status_message(status).c_str());
+  }
+
+  return ok(env, make<iree_hal_device_t*>(env, device));
 }
 
 DECLARE_NIF(get_driver_registry) {
@@ -209,9 +271,20 @@ DECLARE_NIF(list_devices) {
       return error(env, "invalid driver registry");
     }
 
-    iree_status_t status = list_devices(*registry, devices);
+    auto [status, drivers] = list_drivers(*registry);
+
+    for (size_t i = 0; is_ok(status) && i < drivers.size(); i++) {
+      status = query_devices(*registry, drivers[i]->name, devices);
+    }
+
+    for (auto driver : drivers) {
+      delete driver;
+    }
 
     if (!is_ok(status)) {
+      for (auto device : devices) {
+        delete device;
+      }
       return error(env, get_status_message(status).c_str());
     }
   } else {
@@ -225,21 +298,22 @@ DECLARE_NIF(list_devices) {
       return error(env, "invalid driver name");
     }
 
-    iree_status_t status = list_devices(*registry, driver_name, devices);
+    iree_status_t status = query_devices(*registry, driver_name, devices);
     if (!is_ok(status)) {
       return error(env, get_status_message(status).c_str());
     }
   }
 
+  // Only metadata is listed, devices are created through create_device
   std::vector<ERL_NIF_TERM> device_terms;
 
   for (auto device : devices) {
-    auto ref_term = make<iree_hal_device_t*>(env, device->ref);
     auto driver_name_term = enif_make_string(env, device->driver_name.c_str(), ERL_NIF_LATIN1);
     auto uri_term = enif_make_string(env, device->uri.c_str(), ERL_NIF_LATIN1);
     auto id_term = enif_make_uint64(env, device->id);
-    auto tuple = enif_make_tuple4(env, ref_term, driver_name_term, uri_term, id_term);
+    auto tuple = enif_make_tuple3(env, driver_name_term, uri_term, id_term);
     device_terms.push_back(tuple);
+    delete device;
   }
 
   return ok(env, enif_make_list_from_array(env, device_terms.data(), device_terms.size()));
@@ -309,7 +383,113 @@ std::string iree_type_to_nx_type(iree_hal_element_type_t type) {
   return "invalid_type";
 }
 
+// Returns a list of {tensor, dims, type} tuples, taking ownership of the tensors.
+ERL_NIF_TERM make_tensor_list(ErlNifEnv* env, std::vector<iree::runtime::IREETensor*>& tensors) {
+  std::vector<ERL_NIF_TERM> terms;
+  for (auto tensor : tensors) {
+    auto tensor_term = make<iree::runtime::IREETensor*>(env, tensor);
+    std::vector<ERL_NIF_TERM> dims;
+    for (auto dim : tensor->dims) {
+      dims.push_back(enif_make_int64(env, dim));
+    }
+    auto dims_term = enif_make_list_from_array(env, dims.data(), dims.size());
+    auto type_term = enif_make_string(env, iree_type_to_nx_type(tensor->type).c_str(), ERL_NIF_LATIN1);
+    terms.push_back(enif_make_tuple3(env, tensor_term, dims_term, type_term));
+  }
+
+  return enif_make_list_from_array(env, terms.data(), terms.size());
+}
+
+ERL_NIF_TERM make_call_stats(ErlNifEnv* env, iree::runtime::CallStats& stats) {
+  ERL_NIF_TERM keys[] = {
+      enif_make_atom(env, "module_create"),
+      enif_make_atom(env, "context_create"),
+      enif_make_atom(env, "input_upload"),
+      enif_make_atom(env, "invoke"),
+      enif_make_atom(env, "outputs"),
+      enif_make_atom(env, "bytes_uploaded"),
+      enif_make_atom(env, "bytes_output"),
+  };
+  ERL_NIF_TERM values[] = {
+      enif_make_uint64(env, stats.module_create_ns),
+      enif_make_uint64(env, stats.context_create_ns),
+      enif_make_uint64(env, stats.input_upload_ns),
+      enif_make_uint64(env, stats.invoke_ns),
+      enif_make_uint64(env, stats.outputs_ns),
+      enif_make_uint64(env, stats.bytes_uploaded),
+      enif_make_uint64(env, stats.bytes_output),
+  };
+
+  ERL_NIF_TERM map;
+  enif_make_map_from_arrays(env, keys, values, 7, &map);
+  return map;
+}
+
+ERL_NIF_TERM quota_error(ErlNifEnv* env, const nx_iree::quota::Denial& denial) {
+  auto reason = enif_make_tuple5(
+      env,
+      enif_make_atom(env, "quota_exceeded"),
+      enif_make_string(env, denial.pool.c_str(), ERL_NIF_LATIN1),
+      enif_make_uint64(env, denial.requested),
+      enif_make_uint64(env, denial.limit),
+      enif_make_uint64(env, denial.in_use));
+
+  return enif_make_tuple2(env, enif_make_atom(env, "error"), reason);
+}
+
+// Reads a {tenant, expected_output_bytes} tuple. The atom nil means no
+// quota applies and leaves `has_quota` unset.
+int get_quota_request(ErlNifEnv* env, ERL_NIF_TERM term, nx_iree::quota::Request& request, bool& has_quota) {
+  int arity;
+  const ERL_NIF_TERM* elements;
+  ErlNifUInt64 expected_output_bytes;
+
+  if (enif_is_identical(term, enif_make_atom(env, "nil"))) {
+    has_quota = false;
+    return 1;
+  }
+
+  if (!enif_get_tuple(env, term, &arity, &elements) || arity != 2 ||
+      !get_string(env, elements[0], request.tenant) ||
+      !enif_get_uint64(env, elements[1], &expected_output_bytes)) {
+    return 0;
+  }
+
+  request.expected_output_bytes = expected_output_bytes;
+  has_quota = true;
+  return 1;
+}
+
+ERL_NIF_TERM make_quota_usage(ErlNifEnv* env, const nx_iree::quota::Usage& usage) {
+  ERL_NIF_TERM keys[] = {
+      enif_make_atom(env, "limit"),
+      enif_make_atom(env, "in_use"),
+      enif_make_atom(env, "peak"),
+  };
+  ERL_NIF_TERM values[] = {
+      enif_make_uint64(env, usage.limit),
+      enif_make_uint64(env, usage.in_use),
+      enif_make_uint64(env, usage.peak),
+  };
+
+  ERL_NIF_TERM map;
+  enif_make_map_from_arrays(env, keys, values, 3, &map);
+  return map;
+}
+
+DECLARE_NIF(host_cpu_features_nif) {
+  std::vector<ERL_NIF_TERM> feature_terms;
+
+  for (auto feature : host_cpu_features()) {
+    feature_terms.push_back(enif_make_string(env, feature.c_str(), ERL_NIF_LATIN1));
+  }
+
+  return ok(env, enif_make_list_from_array(env, feature_terms.data(), feature_terms.size()));
+}
+
 DECLARE_NIF(read_buffer_nif) {
+  nx_iree::tracing::Span span("nif.read_buffer");
+
   iree_hal_device_t** device;
   iree::runtime::IREETensor** input;
   ErlNifSInt64 num_bytes;
@@ -347,7 +527,9 @@ DECLARE_NIF(read_buffer_nif) {
 }
 
 DECLARE_NIF(allocate_buffer) {
-  if (argc != 4) {
+  nx_iree::tracing::Span span("nif.allocate_buffer");
+
+  if (argc != 5) {
     return error(env, "invalid number of arguments");
   }
 
@@ -372,13 +554,31 @@ DECLARE_NIF(allocate_buffer) {
     return error(env, "unable to read type");
   }
 
+  nx_iree::quota::Request request;
+  bool has_quota;
+
+  if (!get_quota_request(env, argv[4], request, has_quota)) {
+    return error(env, "invalid quota request");
+  }
+
   iree_hal_element_type_t type = nx_type_to_iree_type(type_string);
 
   if (type == iree_hal_element_types_t::IREE_HAL_ELEMENT_TYPE_NONE) {
     return error(env, "invalid type");
   }
 
+  std::shared_ptr<nx_iree::quota::Charge> charge;
+  if (has_quota) {
+    auto status = nx_iree::quota::reserve(*device, request.tenant, binary.size, &charge, &request.denial);
+
+    if (!is_ok(status)) {
+      iree_status_free(status);
+      return quota_error(env, request.denial);
+    }
+  }
+
   auto input = new iree::runtime::IREETensor(binary.data, binary.size, dims, type);
+  input->charge = charge;
 
   return ok(env, make<iree::runtime::IREETensor*>(env, input));
 }
@@ -394,12 +594,12 @@ DECLARE_NIF(deallocate_buffer) {
     return error(env, "invalid input");
   }
 
-  (*input)->deallocate();
+  nx_iree::release::enqueue((*input)->detach());
 
   return ok(env);
 }
 
-DECLARE_NIF(serialize_tensor) {
+DECLARE_NIF(to_pointer) {
   if (argc != 1) {
     return error(env, "invalid number of arguments");
   }
@@ -410,15 +610,127 @@ DECLARE_NIF(serialize_tensor) {
     return error(env, "invalid input");
   }
 
-  std::vector<char>* serialized = (*input)->serialize();
+  void* ptr;
+  auto status = (*input)->host_pointer(&ptr);
+
+  if (!is_ok(status)) {
+    return error(env, get_status_message(status).c_str());
+  }
+
+  ERL_NIF_TERM address = enif_make_uint64(env, reinterpret_cast<uintptr_t>(ptr));
+  ERL_NIF_TERM size = enif_make_uint64(env, (*input)->size);
+
+  return ok(env, enif_make_tuple2(env, address, size));
+}
+
+// Copies a binary to host memory given by address. Only meant for tests
+// which check that pointers share memory with tensors.
+DECLARE_NIF(write_pointer) {
+  if (argc != 2) {
+    return error(env, "invalid number of arguments");
+  }
+
+  ErlNifUInt64 address;
+  ErlNifBinary binary;
+
+  if (!enif_get_uint64(env, argv[0], &address)) {
+    return error(env, "invalid address");
+  }
+  if (!enif_inspect_binary(env, argv[1], &binary)) {
+    return error(env, "invalid data");
+  }
+
+  std::memcpy(reinterpret_cast<void*>(address), binary.data, binary.size);
+
+  return ok(env);
+}
+
+// Frees the environment holding the owner term of an imported buffer,
+// letting the owner be garbage collected.
+static void release_pointer_owner(void* user_data, iree_hal_buffer_t* buffer) {
+  enif_free_env(reinterpret_cast<ErlNifEnv*>(user_data));
+}
+
+DECLARE_NIF(from_pointer) {
+  if (argc != 5) {
+    return error(env, "invalid number of arguments");
+  }
+
+  iree_hal_device_t** device;
+  ErlNifUInt64 address;
+  std::vector<int64_t> dims;
+  std::string type_string;
+
+  if (!get<iree_hal_device_t*>(env, argv[0], device)) {
+    return error(env, "invalid device");
+  }
+  if (!enif_get_uint64(env, argv[1], &address)) {
+    return error(env, "invalid address");
+  }
+  if (!get_list(env, argv[2], dims)) {
+    return error(env, "unable to read dimensions");
+  }
+  if (!get_string(env, argv[3], type_string)) {
+    return error(env, "unable to read type");
+  }
+
+  iree_hal_element_type_t type = nx_type_to_iree_type(type_string);
+
+  if (type == iree_hal_element_types_t::IREE_HAL_ELEMENT_TYPE_NONE) {
+    return error(env, "invalid type");
+  }
+
+  // The owner term (usually the resource or binary holding the memory)
+  // is copied into its own environment, which keeps it alive for as long
+  // as the imported buffer exists.
+  ErlNifEnv* owner_env = enif_alloc_env();
+  enif_make_copy(owner_env, argv[4]);
+
+  iree_hal_buffer_release_callback_t release = {release_pointer_owner, owner_env};
+  iree::runtime::IREETensor* tensor;
+
+  auto status = import_host_buffer(*device, reinterpret_cast<void*>(address), dims, type, release, &tensor);
+
+  if (!is_ok(status)) {
+    // The release callback is only invoked for buffers which were imported
+    enif_free_env(owner_env);
+    return error(env, get_status_message(status).c_str());
+  }
+
+  return ok(env, make<iree::runtime::IREETensor*>(env, tensor));
+}
+
+DECLARE_NIF(serialize_tensor) {
+  if (argc != 1 && argc != 2) {
+    return error(env, "invalid number of arguments");
+  }
+
+  iree::runtime::IREETensor** input;
+  std::string compression = "none";
+
+  if (!get<iree::runtime::IREETensor*>(env, argv[0], input)) {
+    return error(env, "invalid input");
+  }
+
+  if (argc == 2 && !get_string(env, argv[1], compression)) {
+    return error(env, "invalid compression");
+  }
+
+  std::vector<char>* serialized = (*input)->serialize(compression == "lz4");
+
+  if (serialized == nullptr) {
+    return error(env, "unable to read tensor");
+  }
 
   ErlNifBinary binary;
 
   if (!enif_alloc_binary(serialized->size(), &binary)) {
+    delete serialized;
     return error(env, "unable to allocate binary");
   }
 
   std::memcpy(binary.data, serialized->data(), serialized->size());
+  delete serialized;
 
   return ok(env, enif_make_binary(env, &binary));
 }
@@ -434,15 +746,186 @@ DECLARE_NIF(deserialize_tensor) {
     return error(env, "invalid input");
   }
 
-  auto tensor = new iree::runtime::IREETensor(reinterpret_cast<char*>(input.data));
+  iree_status_t status;
+  auto tensor = new iree::runtime::IREETensor(
+      reinterpret_cast<const char*>(input.data), input.size, &status);
+
+  if (!is_ok(status)) {
+    delete tensor;
+    return error(env, get_status_message(status).c_str());
+  }
 
   return ok(env, make<iree::runtime::IREETensor*>(env, tensor));
 }
 
+DECLARE_NIF(serialize_tensors) {
+  nx_iree::tracing::Span span("nif.serialize_tensors");
+
+  if (argc != 2) {
+    return error(env, "invalid number of arguments");
+  }
+
+  std::vector<iree::runtime::IREETensor*> tensors;
+  std::string compression;
+
+  if (!get_list(env, argv[0], tensors)) {
+    return error(env, "invalid tensors");
+  }
+
+  if (!get_string(env, argv[1], compression)) {
+    return error(env, "invalid compression");
+  }
+
+  nx_iree::tensor_bundle::EncodedPayloads encoded;
+  nx_iree::tensor_bundle::EncodedPayloads* encoded_ptr = nullptr;
+
+  if (compression == "lz4") {
+    auto status = nx_iree::tensor_bundle::compress(tensors, encoded);
+    if (!is_ok(status)) {
+      return error(env, get_status_message(status).c_str());
+    }
+    encoded_ptr = &encoded;
+  } else if (compression != "none") {
+    return error(env, "unknown compression");
+  }
+
+  size_t size = nx_iree::tensor_bundle::serialized_size(tensors, encoded_ptr);
+  ErlNifBinary binary;
+
+  if (!enif_alloc_binary(size, &binary)) {
+    return error(env, "unable to allocate binary");
+  }
+
+  // Raw tensors are written straight into the binary, without intermediate copies
+  auto status = nx_iree::tensor_bundle::serialize(tensors, binary.data, size, encoded_ptr);
+
+  if (!is_ok(status)) {
+    enif_release_binary(&binary);
+    return error(env, get_status_message(status).c_str());
+  }
+
+  return ok(env, enif_make_binary(env, &binary));
+}
+
+DECLARE_NIF(deserialize_tensors) {
+  nx_iree::tracing::Span span("nif.deserialize_tensors");
+
+  if (argc != 2) {
+    return error(env, "invalid number of arguments");
+  }
+
+  iree_hal_device_t** device;
+
+  if (!get<iree_hal_device_t*>(env, argv[0], device)) {
+    return error(env, "invalid device");
+  }
+
+  ErlNifBinary binary;
+
+  if (!enif_inspect_binary(env, argv[1], &binary)) {
+    return error(env, "invalid bundle");
+  }
+
+  // Binaries are rarely 64-byte aligned, so their payloads are copied
+  // rather than wrapped, which also lets the bundle be garbage collected
+  std::vector<iree::runtime::IREETensor*> tensors;
+  auto status = nx_iree::tensor_bundle::deserialize(*device, binary.data, binary.size, nullptr, tensors);
+
+  if (!is_ok(status)) {
+    return error(env, get_status_message(status).c_str());
+  }
+
+  return ok(env, make_tensor_list(env, tensors));
+}
+
+DECLARE_NIF(deserialize_tensors_file) {
+  nx_iree::tracing::Span span("nif.deserialize_tensors_file");
+
+  if (argc != 2) {
+    return error(env, "invalid number of arguments");
+  }
+
+  iree_hal_device_t** device;
+  std::string path;
+
+  if (!get<iree_hal_device_t*>(env, argv[0], device)) {
+    return error(env, "invalid device");
+  }
+  if (!get_string(env, argv[1], path)) {
+    return error(env, "invalid path");
+  }
+
+  std::vector<iree::runtime::IREETensor*> tensors;
+  auto status = nx_iree::tensor_bundle::deserialize_file(*device, path, tensors);
+
+  if (!is_ok(status)) {
+    return error(env, get_status_message(status).c_str());
+  }
+
+  return ok(env, make_tensor_list(env, tensors));
+}
+
+DECLARE_NIF(load_module) {
+  nx_iree::tracing::Span span("nif.load_module");
+
+  iree_vm_instance_t** instance;
+  std::string path;
+
+  if (!get<iree_vm_instance_t*>(env, argv[0], instance)) {
+    return error(env, "invalid instance");
+  }
+  ErlNifUInt64 offset;
+  ErlNifSInt64 length;
+
+  if (!get_string(env, argv[1], path)) {
+    return error(env, "invalid path");
+  }
+  if (!enif_get_uint64(env, argv[2], &offset)) {
+    return error(env, "invalid offset");
+  }
+  if (!enif_get_int64(env, argv[3], &length)) {
+    return error(env, "invalid length");
+  }
+
+  iree_vm_module_t* module = nullptr;
+  iree_status_t status = load_bytecode_module(*instance, path, offset, length, &module);
+
+  if (!is_ok(status)) {
+    return error(env, get_status_message(status).c_str());
+  }
+
+  return ok(env, make<iree_vm_module_t*>(env, module));
+}
+
+DECLARE_NIF(load_module_from_binary) {
+  nx_iree::tracing::Span span("nif.load_module_from_binary");
+
+  iree_vm_instance_t** instance;
+  ErlNifBinary bytecode;
+
+  if (!get<iree_vm_instance_t*>(env, argv[0], instance)) {
+    return error(env, "invalid instance");
+  }
+  if (!enif_inspect_binary(env, argv[1], &bytecode)) {
+    return error(env, "invalid bytecode");
+  }
+
+  iree_vm_module_t* module = nullptr;
+  iree_status_t status = create_bytecode_module(*instance, bytecode.data, bytecode.size, &module);
+
+  if (!is_ok(status)) {
+    return error(env, get_status_message(status).c_str());
+  }
+
+  return ok(env, make<iree_vm_module_t*>(env, module));
+}
+
 DECLARE_NIF(call_nif) {
+  nx_iree::tracing::Span span("nif.call");
   iree_vm_instance_t** instance;
   iree_hal_device_t** device;
   ErlNifBinary bytecode;
+  iree_vm_module_t** module = nullptr;
   std::vector<iree::runtime::IREETensor*> inputs;
   std::string driver_name;
 
@@ -455,33 +938,304 @@ DECLARE_NIF(call_nif) {
   if (!get_string(env, argv[2], driver_name)) {
     return error(env, "invalid device");
   }
-  if (!enif_inspect_binary(env, argv[3], &bytecode)) {
+  // The module is either given as raw bytecode or as a previously loaded module
+  if (!enif_inspect_binary(env, argv[3], &bytecode) && !get<iree_vm_module_t*>(env, argv[3], module)) {
     return error(env, "invalid bytecode");
   }
   if (!get_list(env, argv[4], inputs)) {
     return error(env, "invalid inputs");
   }
 
-  auto [status, result_tensors] = call(*instance, *device, driver_name, bytecode.data, bytecode.size, inputs);
+  // The caller passes its monotonic time, so the time spent waiting for a
+  // dirty scheduler shows up in traces
+  ErlNifSInt64 enqueued_at;
+  if (!enif_get_int64(env, argv[5], &enqueued_at)) {
+    return error(env, "invalid enqueue time");
+  }
+
+  if (nx_iree::tracing::enabled()) {
+    ErlNifSInt64 queued_ns = enif_monotonic_time(ERL_NIF_NSEC) - enqueued_at;
+    uint64_t now = nx_iree::tracing::now_ns();
+    nx_iree::tracing::record("queue", now - std::max<ErlNifSInt64>(queued_ns, 0), now);
+  }
+
+  nx_iree::quota::Request request;
+  bool has_quota;
+
+  if (!get_quota_request(env, argv[6], request, has_quota)) {
+    return error(env, "invalid quota request");
+  }
+
+  // Profiles tell modules apart by this key, as compiled modules all share
+  // the same runtime name. Loaded modules without one use their address.
+  ErlNifBinary profile_key;
+  if (!enif_inspect_binary(env, argv[7], &profile_key)) {
+    return error(env, "invalid profile key");
+  }
+
+  std::string module_key(reinterpret_cast<char*>(profile_key.data), profile_key.size);
+  if (module_key.empty() && module) {
+    iree_vm_module_t* address = *module;
+    module_key.assign(reinterpret_cast<char*>(&address), sizeof(address));
+  }
+
+  nx_iree::quota::Request* quota = has_quota ? &request : nullptr;
+  iree::runtime::CallStats stats;
+  auto [status, result_tensors] =
+      module ? call(*instance, *device, driver_name, *module, inputs, &stats, quota)
+             : call(*instance, *device, driver_name, bytecode.data, bytecode.size, inputs, &stats, quota);
+
+  if (request.denial.denied) {
+    iree_status_free(status);
+    return quota_error(env, request.denial);
+  }
 
   if (!is_ok(status)) {
     return error(env, get_status_message(status).c_str());
   }
 
-  std::vector<ERL_NIF_TERM> output_terms;
-  for (auto tensor : result_tensors.value()) {
-    auto tensor_term = make<iree::runtime::IREETensor*>(env, tensor);
-    std::vector<ERL_NIF_TERM> dims;
-    for (auto dim : tensor->dims) {
-      dims.push_back(enif_make_int64(env, dim));
-    }
-    auto dims_term = enif_make_list_from_array(env, dims.data(), dims.size());
-    auto type_term = enif_make_string(env, iree_type_to_nx_type(tensor->type).c_str(), ERL_NIF_LATIN1);
-    auto term = enif_make_tuple3(env, tensor_term, dims_term, type_term);
-    output_terms.push_back(term);
+  nx_iree::profiling::record_invoke(*device, module_key, stats.function, stats.invoke_ns);
+
+  return enif_make_tuple3(env, ok(env), make_tensor_list(env, result_tensors.value()), make_call_stats(env, stats));
+}
+
+DECLARE_NIF(start_tracing) {
+  ErlNifUInt64 capacity;
+
+  if (!enif_get_uint64(env, argv[0], &capacity) || capacity == 0) {
+    return error(env, "invalid capacity");
+  }
+
+  nx_iree::tracing::enable(capacity);
+  return ok(env);
+}
+
+DECLARE_NIF(stop_tracing) {
+  nx_iree::tracing::disable();
+  return ok(env);
+}
+
+DECLARE_NIF(export_trace) {
+  std::string trace = nx_iree::tracing::export_chrome_trace();
+  ErlNifBinary binary;
+
+  if (!enif_alloc_binary(trace.size(), &binary)) {
+    return error(env, "unable to allocate binary");
+  }
+
+  std::memcpy(binary.data, trace.data(), trace.size());
+  return ok(env, enif_make_binary(env, &binary));
+}
+
+DECLARE_NIF(profiling_begin) {
+  iree_hal_device_t** device;
+  unsigned int mode;
+  std::string file_path;
+
+  if (!get<iree_hal_device_t*>(env, argv[0], device)) {
+    return error(env, "invalid device");
+  }
+  if (!enif_get_uint(env, argv[1], &mode)) {
+    return error(env, "invalid profiling mode");
+  }
+  if (!get_string(env, argv[2], file_path)) {
+    return error(env, "invalid file path");
+  }
+
+  auto status = nx_iree::profiling::begin(*device, mode, file_path);
+
+  if (!is_ok(status)) {
+    return error(env, get_status_message(status).c_str());
+  }
+
+  return ok(env);
+}
+
+DECLARE_NIF(profiling_flush) {
+  iree_hal_device_t** device;
+
+  if (!get<iree_hal_device_t*>(env, argv[0], device)) {
+    return error(env, "invalid device");
   }
 
-  return ok(env, enif_make_list_from_array(env, output_terms.data(), output_terms.size()));
+  auto status = nx_iree::profiling::flush(*device);
+
+  if (!is_ok(status)) {
+    return error(env, get_status_message(status).c_str());
+  }
+
+  return ok(env);
+}
+
+DECLARE_NIF(profiling_end) {
+  iree_hal_device_t** device;
+
+  if (!get<iree_hal_device_t*>(env, argv[0], device)) {
+    return error(env, "invalid device");
+  }
+
+  nx_iree::profiling::Report report;
+  auto status = nx_iree::profiling::end(*device, &report);
+
+  if (!is_ok(status)) {
+    return error(env, get_status_message(status).c_str());
+  }
+
+  std::vector<ERL_NIF_TERM> functions;
+  for (auto& stats : report.functions) {
+    ERL_NIF_TERM module;
+    auto module_data = enif_make_new_binary(env, stats.module.size(), &module);
+    std::memcpy(module_data, stats.module.data(), stats.module.size());
+
+    ERL_NIF_TERM fields[] = {
+        module,
+        enif_make_string(env, stats.function.c_str(), ERL_NIF_LATIN1),
+        enif_make_uint64(env, stats.calls),
+        enif_make_uint64(env, stats.total_ns),
+        enif_make_uint64(env, stats.min_ns),
+        enif_make_uint64(env, stats.max_ns),
+    };
+    functions.push_back(enif_make_tuple_from_array(env, fields, 6));
+  }
+
+  auto functions_term = enif_make_list_from_array(env, functions.data(), functions.size());
+  return ok(env, enif_make_tuple2(env, enif_make_uint64(env, report.duration_ns), functions_term));
+}
+
+DECLARE_NIF(allocator_statistics) {
+  iree_hal_device_t** device;
+
+  if (!get<iree_hal_device_t*>(env, argv[0], device)) {
+    return error(env, "invalid device");
+  }
+
+#if IREE_STATISTICS_ENABLE
+  iree_hal_allocator_statistics_t stats;
+  iree_hal_allocator_query_statistics(iree_hal_device_allocator(*device), &stats);
+
+  ERL_NIF_TERM keys[] = {
+      enif_make_atom(env, "host_bytes_allocated"),
+      enif_make_atom(env, "host_bytes_freed"),
+      enif_make_atom(env, "host_bytes_peak"),
+      enif_make_atom(env, "device_bytes_allocated"),
+      enif_make_atom(env, "device_bytes_freed"),
+      enif_make_atom(env, "device_bytes_peak"),
+  };
+  ERL_NIF_TERM values[] = {
+      enif_make_uint64(env, stats.host_bytes_allocated),
+      enif_make_uint64(env, stats.host_bytes_freed),
+      enif_make_uint64(env, stats.host_bytes_peak),
+      enif_make_uint64(env, stats.device_bytes_allocated),
+      enif_make_uint64(env, stats.device_bytes_freed),
+      enif_make_uint64(env, stats.device_bytes_peak),
+  };
+
+  ERL_NIF_TERM map;
+  enif_make_map_from_arrays(env, keys, values, 6, &map);
+  return ok(env, map);
+#else
+  return error(env, "allocator statistics are disabled in this IREE build");
+#endif
+}
+
+DECLARE_NIF(set_device_quota) {
+  iree_hal_device_t** device;
+  ErlNifUInt64 limit;
+
+  if (!get<iree_hal_device_t*>(env, argv[0], device)) {
+    return error(env, "invalid device");
+  }
+  if (!enif_get_uint64(env, argv[1], &limit)) {
+    return error(env, "invalid limit");
+  }
+
+  nx_iree::quota::set_device_limit(*device, limit);
+  return ok(env);
+}
+
+DECLARE_NIF(set_tenant_quota) {
+  std::string tenant;
+  ErlNifUInt64 limit;
+
+  if (!get_string(env, argv[0], tenant) || tenant.empty()) {
+    return error(env, "invalid tenant");
+  }
+  if (!enif_get_uint64(env, argv[1], &limit)) {
+    return error(env, "invalid limit");
+  }
+
+  nx_iree::quota::set_tenant_limit(tenant, limit);
+  return ok(env);
+}
+
+DECLARE_NIF(device_quota_usage) {
+  iree_hal_device_t** device;
+  nx_iree::quota::Usage usage;
+
+  if (!get<iree_hal_device_t*>(env, argv[0], device)) {
+    return error(env, "invalid device");
+  }
+  if (!nx_iree::quota::device_usage(*device, &usage)) {
+    return error(env, "no quota was set for the device");
+  }
+
+  return ok(env, make_quota_usage(env, usage));
+}
+
+DECLARE_NIF(tenant_quota_usage) {
+  std::string tenant;
+  nx_iree::quota::Usage usage;
+
+  if (!get_string(env, argv[0], tenant)) {
+    return error(env, "invalid tenant");
+  }
+  if (!nx_iree::quota::tenant_usage(tenant, &usage)) {
+    return error(env, "no quota was set for the tenant");
+  }
+
+  return ok(env, make_quota_usage(env, usage));
+}
+
+// Waits for the release thread, so it runs on a dirty scheduler
+DECLARE_NIF(flush_releases) {
+  nx_iree::release::drain();
+  return ok(env);
+}
+
+DECLARE_NIF(release_notice) {
+  auto notice = new ReleaseNotice();
+  if (!enif_get_local_pid(env, argv[0], &notice->pid)) {
+    delete notice;
+    return error(env, "invalid pid");
+  }
+  notice->env = enif_alloc_env();
+  notice->message = enif_make_copy(notice->env, argv[1]);
+  return ok(env, make<ReleaseNotice*>(env, notice));
+}
+
+DECLARE_NIF(live_tensor_stats_nif) {
+  auto stats = live_tensor_stats();
+
+  ERL_NIF_TERM keys[] = {
+      enif_make_atom(env, "host_count"),
+      enif_make_atom(env, "host_bytes"),
+      enif_make_atom(env, "host_peak_bytes"),
+      enif_make_atom(env, "device_count"),
+      enif_make_atom(env, "device_bytes"),
+      enif_make_atom(env, "device_peak_bytes"),
+  };
+  ERL_NIF_TERM values[] = {
+      enif_make_uint64(env, stats.host_count),
+      enif_make_uint64(env, stats.host_bytes),
+      enif_make_uint64(env, stats.host_peak_bytes),
+      enif_make_uint64(env, stats.device_count),
+      enif_make_uint64(env, stats.device_bytes),
+      enif_make_uint64(env, stats.device_peak_bytes),
+  };
+
+  ERL_NIF_TERM map;
+  enif_make_map_from_arrays(env, keys, values, 6, &map);
+  return ok(env, map);
 }
 
 static ErlNifFunc funcs[] = {
@@ -491,12 +1245,36 @@ static ErlNifFunc funcs[] = {
     {"list_devices", 1, list_devices},
     {"list_devices", 2, list_devices},
     {"list_drivers", 1, list_drivers},
+    {"host_cpu_features", 0, host_cpu_features_nif},
     {"deallocate_buffer", 1, deallocate_buffer},
-    {"allocate_buffer", 4, allocate_buffer},
+    {"allocate_buffer", 5, allocate_buffer},
+    {"to_pointer", 1, to_pointer},
+    {"write_pointer", 2, write_pointer},
+    {"from_pointer", 5, from_pointer},
     {"serialize_tensor", 1, serialize_tensor},
+    {"serialize_tensor", 2, serialize_tensor, ERL_NIF_DIRTY_JOB_CPU_BOUND},
     {"deserialize_tensor", 1, deserialize_tensor},
+    {"serialize_tensors", 2, serialize_tensors, ERL_NIF_DIRTY_JOB_CPU_BOUND},
+    {"deserialize_tensors", 2, deserialize_tensors, ERL_NIF_DIRTY_JOB_CPU_BOUND},
+    {"deserialize_tensors_file", 2, deserialize_tensors_file, ERL_NIF_DIRTY_JOB_IO_BOUND},
     {"read_buffer", 3, read_buffer_nif},
-    {"call_io", 5, call_nif, ERL_NIF_DIRTY_JOB_IO_BOUND},
-    {"call_cpu", 5, call_nif, ERL_NIF_DIRTY_JOB_CPU_BOUND}};
+    {"load_module", 4, load_module, ERL_NIF_DIRTY_JOB_IO_BOUND},
+    {"load_module_from_binary", 2, load_module_from_binary, ERL_NIF_DIRTY_JOB_CPU_BOUND},
+    {"call_io", 8, call_nif, ERL_NIF_DIRTY_JOB_IO_BOUND},
+    {"call_cpu", 8, call_nif, ERL_NIF_DIRTY_JOB_CPU_BOUND},
+    {"profiling_begin", 3, profiling_begin, ERL_NIF_DIRTY_JOB_IO_BOUND},
+    {"profiling_flush", 1, profiling_flush, ERL_NIF_DIRTY_JOB_IO_BOUND},
+    {"profiling_end", 1, profiling_end, ERL_NIF_DIRTY_JOB_IO_BOUND},
+    {"allocator_statistics", 1, allocator_statistics},
+    {"live_tensor_stats", 0, live_tensor_stats_nif},
+    {"flush_releases", 0, flush_releases, ERL_NIF_DIRTY_JOB_IO_BOUND},
+    {"release_notice", 2, release_notice},
+    {"set_device_quota", 2, set_device_quota},
+    {"set_tenant_quota", 2, set_tenant_quota},
+    {"device_quota_usage", 1, device_quota_usage},
+    {"tenant_quota_usage", 1, tenant_quota_usage},
+    {"start_tracing", 1, start_tracing},
+    {"stop_tracing", 0, stop_tracing},
+    {"export_trace", 0, export_trace, ERL_NIF_DIRTY_JOB_CPU_BOUND}};
 
 ERL_NIF_INIT(Elixir.NxIREE.Native, funcs, &load, NULL, &upgrade, NULL);
@@ -0,0 +1,509 @@
+// Benchmarks the runtime hot paths on the CPU drivers: call(), read_buffer(),
+// the IREETensor constructors and IREETensor::serialize().
+//
+// Modules are generated as StableHLO for a matrix of input counts, tensor
+// sizes and op counts, and compiled with iree-compile before the benchmarks
+// run. Latency percentiles and throughput are written as JSON, so runs can be
+// compared across commits.
+//
+// Usage:
+//
+//   nx_iree_runtime_benchmark [--iree-compile PATH] [--drivers local-sync,local-task]
+//                             [--iterations N] [--warmup N] [--quick] [--output FILE]
+
+#include "runtime.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <unistd.h>
+
+namespace {
+
+using iree::runtime::IREETensor;
+
+struct Options {
+  std::string iree_compile = "iree-compile";
+  std::vector<std::string> drivers = {"local-sync", "local-task"};
+  int iterations = 200;
+  int warmup = 20;
+  bool quick = false;
+  std::string output;
+};
+
+struct Result {
+  std::string name;
+  std::string driver;
+  std::vector<std::pair<std::string, int64_t>> params;
+  std::vector<uint64_t> samples_ns;
+  // Bytes moved or produced by a single iteration
+  uint64_t bytes_per_iteration = 0;
+};
+
+struct CompiledModule {
+  int inputs;
+  int64_t elements;
+  int ops;
+  std::string path;
+  size_t bytecode_size;
+};
+
+uint64_t now_ns() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+[[noreturn]] void fail(const std::string& what, iree_status_t status) {
+  std::cerr << what << ": " << get_status_message(status) << std::endl;
+  std::exit(1);
+}
+
+void check(iree_status_t status, const std::string& what) {
+  if (!iree_status_is_ok(status)) fail(what, status);
+}
+
+// Runs `body` for the warmup and measured iterations, recording the latency of
+// each measured one. `setup` runs untimed before every iteration.
+std::vector<uint64_t> measure(const Options& options,
+                              const std::function<void()>& body,
+                              const std::function<void()>& setup = nullptr) {
+  std::vector<uint64_t> samples;
+  samples.reserve(options.iterations);
+
+  for (int i = 0; i < options.warmup + options.iterations; i++) {
+    if (setup) setup();
+    uint64_t start = now_ns();
+    body();
+    uint64_t end = now_ns();
+    if (i >= options.warmup) samples.push_back(end - start);
+  }
+
+  return samples;
+}
+
+// Generates a module which sums its `inputs` arguments and then applies `ops`
+// elementwise ops. Every fourth op subtracts the sum of the tensor, which
+// needs a reduction and so starts a new dispatch, making the module grow with
+// `ops` instead of fusing into a single kernel.
+std::string generate_module(int inputs, int64_t elements, int ops) {
+  std::string tensor = "tensor<" + std::to_string(elements) + "xf32>";
+  std::ostringstream mlir;
+  int next = 0;
+  auto value = [&]() { return "%v" + std::to_string(next++); };
+
+  mlir << "module {\n  func.func public @main(";
+  for (int i = 0; i < inputs; i++) {
+    mlir << (i ? ", " : "") << "%arg" << i << ": " << tensor;
+  }
+  mlir << ") -> " << tensor << " {\n";
+
+  auto binary = [&](const std::string& op, const std::string& lhs,
+                    const std::string& rhs) {
+    std::string result = value();
+    mlir << "    " << result << " = \"stablehlo." << op << "\"(" << lhs << ", "
+         << rhs << ") : (" << tensor << ", " << tensor << ") -> " << tensor
+         << "\n";
+    return result;
+  };
+
+  std::string current = "%arg0";
+  for (int i = 1; i < inputs; i++) {
+    current = binary("add", current, "%arg" + std::to_string(i));
+  }
+
+  if (ops > 0) {
+    mlir << "    %zero = stablehlo.constant dense<0.0> : tensor<f32>\n";
+  }
+
+  for (int i = 0; i < ops; i++) {
+    std::string operand = "%arg" + std::to_string(i % inputs);
+
+    if (i % 4 != 3) {
+      current = binary(i % 2 ? "add" : "multiply", current, operand);
+      continue;
+    }
+
+    // Values inside the reduction body are numbered too, so no name is reused
+    std::string sum = value();
+    std::string id = std::to_string(i);
+    mlir << "    " << sum << " = \"stablehlo.reduce\"(" << current
+         << ", %zero) ({\n"
+         << "    ^bb0(%a" << id << ": tensor<f32>, %b" << id
+         << ": tensor<f32>):\n"
+         << "      %s" << id << " = \"stablehlo.add\"(%a" << id << ", %b" << id
+         << ") : (tensor<f32>, tensor<f32>) -> tensor<f32>\n"
+         << "      \"stablehlo.return\"(%s" << id
+         << ") : (tensor<f32>) -> ()\n"
+         << "    }) {dimensions = array<i64: 0>} : (" << tensor
+         << ", tensor<f32>) -> tensor<f32>\n";
+
+    std::string broadcast = value();
+    mlir << "    " << broadcast << " = \"stablehlo.broadcast_in_dim\"(" << sum
+         << ") {broadcast_dimensions = array<i64>} : (tensor<f32>) -> "
+         << tensor << "\n";
+
+    current = binary("subtract", current, broadcast);
+  }
+
+  if (current.rfind("%arg", 0) == 0) {
+    // Returning an argument directly would make the call a no-op
+    current = binary("add", current, current);
+  }
+
+  mlir << "    return " << current << " : " << tensor << "\n  }\n}\n";
+  return mlir.str();
+}
+
+CompiledModule compile_module(const Options& options, const std::string& dir,
+                              int inputs, int64_t elements, int ops) {
+  std::string name = dir + "/module_" + std::to_string(inputs) + "_" +
+                     std::to_string(elements) + "_" + std::to_string(ops);
+
+  {
+    std::ofstream source(name + ".mlir");
+    source << generate_module(inputs, elements, ops);
+  }
+
+  std::string command = "'" + options.iree_compile + "' '" + name +
+                        ".mlir' --iree-hal-target-backends=llvm-cpu "
+                        "--iree-input-type=stablehlo_xla "
+                        "--iree-llvmcpu-target-cpu=host -o '" +
+                        name + ".vmfb'";
+
+  if (std::system(command.c_str()) != 0) {
+    std::cerr << "failed to compile " << name << ".mlir with: " << command
+              << std::endl;
+    std::exit(1);
+  }
+
+  std::ifstream vmfb(name + ".vmfb", std::ios::binary | std::ios::ate);
+  return {inputs, elements, ops, name + ".vmfb",
+          static_cast<size_t>(vmfb.tellg())};
+}
+
+std::vector<float> host_data(int64_t elements) {
+  std::vector<float> data(elements);
+  for (int64_t i = 0; i < elements; i++) {
+    data[i] = static_cast<float>(i % 1024) / 1024.0f;
+  }
+  return data;
+}
+
+IREETensor* device_tensor(iree_hal_device_t* device,
+                          const std::vector<float>& data) {
+  iree_hal_dim_t dims[] = {static_cast<iree_hal_dim_t>(data.size())};
+  iree_hal_buffer_view_t* buffer_view = nullptr;
+
+  check(iree_hal_buffer_view_allocate_buffer_copy(
+            device, iree_hal_device_allocator(device), 1, dims,
+            IREE_HAL_ELEMENT_TYPE_FLOAT_32,
+            IREE_HAL_ENCODING_TYPE_DENSE_ROW_MAJOR,
+            (iree_hal_buffer_params_t){
+                .usage = IREE_HAL_BUFFER_USAGE_DEFAULT,
+                .type = IREE_HAL_MEMORY_TYPE_DEVICE_LOCAL,
+            },
+            iree_make_const_byte_span(data.data(), data.size() * sizeof(float)),
+            &buffer_view),
+        "allocating device tensor");
+
+  return new IREETensor(buffer_view, IREE_HAL_ELEMENT_TYPE_FLOAT_32, device);
+}
+
+IREETensor* host_tensor(const std::vector<float>& data) {
+  return new IREETensor(const_cast<float*>(data.data()),
+                        data.size() * sizeof(float),
+                        {static_cast<int64_t>(data.size())},
+                        IREE_HAL_ELEMENT_TYPE_FLOAT_32);
+}
+
+void call_and_release(iree_vm_instance_t* instance, iree_hal_device_t* device,
+                      const std::string& driver, iree_vm_module_t* module,
+                      const std::vector<IREETensor*>& inputs) {
+  auto [status, outputs] = call(instance, device, driver, module, inputs);
+  check(status, "call");
+  for (auto output : *outputs) delete output;
+}
+
+void bench_calls(const Options& options, iree_vm_instance_t* instance,
+                 iree_hal_device_t* device, const std::string& driver,
+                 const std::vector<CompiledModule>& modules,
+                 std::vector<Result>& results) {
+  for (auto& compiled : modules) {
+    iree_vm_module_t* module = nullptr;
+    check(load_bytecode_module(instance, compiled.path, 0, -1, &module),
+          "loading " + compiled.path);
+
+    auto data = host_data(compiled.elements);
+    uint64_t input_bytes = compiled.inputs * data.size() * sizeof(float);
+    std::vector<std::pair<std::string, int64_t>> params = {
+        {"inputs", compiled.inputs},
+        {"elements", compiled.elements},
+        {"ops", compiled.ops},
+        {"module_bytes", static_cast<int64_t>(compiled.bytecode_size)}};
+
+    // Inputs already on the device, as when chaining calls
+    std::vector<IREETensor*> inputs;
+    for (int i = 0; i < compiled.inputs; i++) {
+      inputs.push_back(device_tensor(device, data));
+    }
+    auto samples = measure(options, [&]() {
+      call_and_release(instance, device, driver, module, inputs);
+    });
+    results.push_back({"call.device_inputs", driver, params, samples,
+                       input_bytes});
+    for (auto input : inputs) delete input;
+
+    // Host inputs, which the call uploads first
+    inputs.clear();
+    for (int i = 0; i < compiled.inputs; i++) {
+      inputs.push_back(host_tensor(data));
+    }
+    samples = measure(options, [&]() {
+      call_and_release(instance, device, driver, module, inputs);
+    });
+    results.push_back({"call.host_inputs", driver, params, samples,
+                       input_bytes});
+    for (auto input : inputs) delete input;
+
+    iree_vm_module_release(module);
+  }
+}
+
+void bench_tensors(const Options& options, iree_hal_device_t* device,
+                   const std::string& driver,
+                   const std::vector<int64_t>& sizes,
+                   std::vector<Result>& results) {
+  for (int64_t elements : sizes) {
+    auto data = host_data(elements);
+    uint64_t bytes = data.size() * sizeof(float);
+    std::vector<std::pair<std::string, int64_t>> params = {
+        {"elements", elements}};
+    std::vector<uint64_t> samples;
+
+    auto device_input = device_tensor(device, data);
+    std::vector<float> out(elements);
+    samples = measure(options, [&]() {
+      check(read_buffer(device, device_input->buffer_view, out.data(), bytes),
+            "read_buffer");
+    });
+    results.push_back({"read_buffer", driver, params, samples, bytes});
+
+    samples = measure(options, [&]() { delete device_tensor(device, data); });
+    results.push_back(
+        {"tensor.from_buffer_view", driver, params, samples, bytes});
+
+    // IREETensor::serialize() keeps the contents it read from the device, so
+    // each iteration serializes a fresh tensor to include the download
+    IREETensor* fresh = nullptr;
+    samples = measure(
+        options,
+        [&]() { delete fresh->serialize(); },
+        [&]() {
+          delete fresh;
+          iree_hal_buffer_view_retain(device_input->buffer_view);
+          fresh = new IREETensor(device_input->buffer_view,
+                                 device_input->type, device);
+        });
+    delete fresh;
+    results.push_back({"tensor.serialize_device", driver, params, samples,
+                       bytes});
+
+    delete device_input;
+  }
+}
+
+// Host tensors don't touch the device, so these only run once
+void bench_host_tensors(const Options& options,
+                        const std::vector<int64_t>& sizes,
+                        std::vector<Result>& results) {
+  for (int64_t elements : sizes) {
+    auto data = host_data(elements);
+    uint64_t bytes = data.size() * sizeof(float);
+    std::vector<std::pair<std::string, int64_t>> params = {
+        {"elements", elements}};
+    std::vector<uint64_t> samples;
+
+    samples = measure(options, [&]() { delete host_tensor(data); });
+    results.push_back({"tensor.from_host", "host", params, samples, bytes});
+
+    auto tensor = host_tensor(data);
+    std::vector<char>* serialized = nullptr;
+    samples = measure(options, [&]() {
+      delete serialized;
+      serialized = tensor->serialize();
+    });
+    results.push_back({"tensor.serialize_host", "host", params, samples,
+                       bytes});
+
+    samples = measure(options,
+                      [&]() { delete new IREETensor(serialized->data()); });
+    results.push_back({"tensor.deserialize", "host", params, samples, bytes});
+
+    delete serialized;
+    delete tensor;
+  }
+}
+
+void write_json(std::ostream& out, const std::vector<Result>& results) {
+  out << "{\n  \"benchmarks\": [";
+
+  for (size_t i = 0; i < results.size(); i++) {
+    auto& result = results[i];
+    auto samples = result.samples_ns;
+    std::sort(samples.begin(), samples.end());
+
+    uint64_t total = 0;
+    for (auto sample : samples) total += sample;
+    double mean = static_cast<double>(total) / samples.size();
+    auto percentile = [&](double q) {
+      size_t index = static_cast<size_t>(q * (samples.size() - 1) + 0.5);
+      return samples[std::min(index, samples.size() - 1)];
+    };
+
+    out << (i ? "," : "") << "\n    {\"name\": \"" << result.name
+        << "\", \"driver\": \"" << result.driver << "\", \"params\": {";
+    for (size_t j = 0; j < result.params.size(); j++) {
+      out << (j ? ", " : "") << "\"" << result.params[j].first
+          << "\": " << result.params[j].second;
+    }
+    out << "}, \"iterations\": " << samples.size()
+        << ", \"latency_ns\": {\"min\": " << samples.front()
+        << ", \"p50\": " << percentile(0.5)
+        << ", \"p90\": " << percentile(0.9)
+        << ", \"p99\": " << percentile(0.99)
+        << ", \"max\": " << samples.back()
+        << ", \"mean\": " << static_cast<uint64_t>(mean)
+        << "}, \"throughput\": {\"iterations_per_second\": "
+        << static_cast<uint64_t>(1e9 / mean) << ", \"bytes_per_second\": "
+        << static_cast<uint64_t>(result.bytes_per_iteration * 1e9 / mean)
+        << "}}";
+  }
+
+  out << "\n  ]\n}\n";
+}
+
+std::vector<std::string> split(const std::string& value) {
+  std::vector<std::string> parts;
+  std::stringstream stream(value);
+  std::string part;
+  while (std::getline(stream, part, ',')) {
+    if (!part.empty()) parts.push_back(part);
+  }
+  return parts;
+}
+
+Options parse_options(int argc, char** argv) {
+  Options options;
+
+  for (int i = 1; i < argc; i++) {
+    std::string arg = argv[i];
+    auto next = [&]() -> std::string {
+      if (i + 1 >= argc) {
+        std::cerr << arg << " expects a value" << std::endl;
+        std::exit(2);
+      }
+      return argv[++i];
+    };
+
+    if (arg == "--iree-compile") {
+      options.iree_compile = next();
+    } else if (arg == "--drivers") {
+      options.drivers = split(next());
+    } else if (arg == "--iterations") {
+      options.iterations = std::max(1, std::atoi(next().c_str()));
+    } else if (arg == "--warmup") {
+      options.warmup = std::max(0, std::atoi(next().c_str()));
+    } else if (arg == "--quick") {
+      options.quick = true;
+    } else if (arg == "--output") {
+      options.output = next();
+    } else {
+      std::cerr << "unknown option " << arg << std::endl;
+      std::exit(2);
+    }
+  }
+
+  return options;
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  Options options = parse_options(argc, argv);
+
+  std::vector<int> input_counts = {1, 4, 16};
+  std::vector<int64_t> sizes = {16, 16 * 1024, 1024 * 1024};
+  std::vector<int> op_counts = {1, 16, 64};
+
+  if (options.quick) {
+    input_counts = {1, 4};
+    sizes = {16, 64 * 1024};
+    op_counts = {1, 16};
+  }
+
+  char dir_template[] = "/tmp/nx_iree_benchmark_XXXXXX";
+  if (mkdtemp(dir_template) == nullptr) {
+    std::perror("mkdtemp");
+    return 1;
+  }
+  std::string dir = dir_template;
+
+  std::cerr << "compiling modules into " << dir << std::endl;
+  std::vector<CompiledModule> modules;
+  for (int inputs : input_counts) {
+    for (int64_t elements : sizes) {
+      for (int ops : op_counts) {
+        modules.push_back(
+            compile_module(options, dir, inputs, elements, ops));
+      }
+    }
+  }
+
+  iree_vm_instance_t* instance = create_instance();
+  iree_hal_driver_registry_t* registry = get_driver_registry();
+  check(register_all_drivers(registry), "registering drivers");
+
+  std::vector<Result> results;
+  bench_host_tensors(options, sizes, results);
+
+  for (auto& driver : options.drivers) {
+    iree_hal_device_t* device = create_device(registry, driver + "://");
+    if (device == nullptr) {
+      std::cerr << "failed to create a " << driver << " device" << std::endl;
+      return 1;
+    }
+
+    std::cerr << "running benchmarks on " << driver << std::endl;
+    bench_tensors(options, device, driver, sizes, results);
+    bench_calls(options, instance, device, driver, modules, results);
+    iree_hal_device_release(device);
+  }
+
+  iree_vm_instance_release(instance);
+
+  for (auto& compiled : modules) {
+    std::remove(compiled.path.c_str());
+    std::remove((compiled.path.substr(0, compiled.path.size() - 5) + ".mlir")
+                    .c_str());
+  }
+  rmdir(dir.c_str());
+
+  if (options.output.empty()) {
+    write_json(std::cout, results);
+  } else {
+    std::ofstream out(options.output);
+    write_json(out, results);
+  }
+
+  return 0;
+}
@@ -0,0 +1,204 @@
+#include "codec.h"
+
+#include <cstring>
+#include <vector>
+
+namespace nx_iree {
+namespace codec {
+
+namespace {
+
+constexpr size_t kMinMatch = 4;
+// The last 5 bytes are always literals and the last match starts at least
+// 12 bytes before the end of the block, as required by the block format.
+constexpr size_t kLastLiterals = 5;
+constexpr size_t kMatchFindLimit = 12;
+constexpr size_t kMaxOffset = 65535;
+constexpr int kHashLog = 14;
+
+uint32_t read32(const uint8_t* p) {
+  uint32_t value;
+  std::memcpy(&value, p, sizeof(value));
+  return value;
+}
+
+uint32_t hash(uint32_t sequence) {
+  return (sequence * 2654435761u) >> (32 - kHashLog);
+}
+
+// Writes the 255-terminated continuation bytes of a length
+bool write_length(uint8_t*& op, uint8_t* oend, size_t length) {
+  while (length >= 255) {
+    if (op >= oend) return false;
+    *op++ = 255;
+    length -= 255;
+  }
+  if (op >= oend) return false;
+  *op++ = static_cast<uint8_t>(length);
+  return true;
+}
+
+bool read_length(const uint8_t*& ip, const uint8_t* iend, size_t& length) {
+  uint8_t byte;
+  do {
+    if (ip >= iend) return false;
+    byte = *ip++;
+    length += byte;
+  } while (byte == 255);
+  return true;
+}
+
+bool write_sequence(uint8_t*& op, uint8_t* oend, const uint8_t* literals,
+                    size_t literal_length, size_t offset,
+                    size_t match_length) {
+  if (op >= oend) return false;
+  uint8_t* token = op++;
+  *token = static_cast<uint8_t>((literal_length < 15 ? literal_length : 15)
+                                << 4);
+
+  if (literal_length >= 15 && !write_length(op, oend, literal_length - 15)) {
+    return false;
+  }
+  if (static_cast<size_t>(oend - op) < literal_length) return false;
+  // Empty payloads may come with null pointers, which memcpy doesn't take
+  if (literal_length > 0) std::memcpy(op, literals, literal_length);
+  op += literal_length;
+
+  // The last sequence only holds literals
+  if (match_length == 0) return true;
+
+  if (oend - op < 2) return false;
+  *op++ = static_cast<uint8_t>(offset);
+  *op++ = static_cast<uint8_t>(offset >> 8);
+
+  size_t extra = match_length - kMinMatch;
+  *token |= static_cast<uint8_t>(extra < 15 ? extra : 15);
+  if (extra >= 15 && !write_length(op, oend, extra - 15)) return false;
+
+  return true;
+}
+
+}  // namespace
+
+size_t lz4_compress_bound(size_t size) { return size + size / 255 + 16; }
+
+size_t lz4_compress(const uint8_t* src, size_t size, uint8_t* dst,
+                    size_t capacity) {
+  uint8_t* op = dst;
+  uint8_t* oend = dst + capacity;
+  size_t anchor = 0;
+
+  if (size >= kMatchFindLimit + 1) {
+    std::vector<uint32_t> table(1 << kHashLog, 0);
+    size_t match_limit = size - kMatchFindLimit;
+    size_t ip = 1;
+
+    while (ip <= match_limit) {
+      uint32_t sequence = read32(src + ip);
+      uint32_t h = hash(sequence);
+      size_t candidate = table[h];
+      table[h] = static_cast<uint32_t>(ip);
+
+      if (candidate >= ip || ip - candidate > kMaxOffset ||
+          read32(src + candidate) != sequence) {
+        ip++;
+        continue;
+      }
+
+      size_t length = kMinMatch;
+      while (ip + length < size - kLastLiterals &&
+             src[candidate + length] == src[ip + length]) {
+        length++;
+      }
+
+      if (!write_sequence(op, oend, src + anchor, ip - anchor, ip - candidate,
+                          length)) {
+        return 0;
+      }
+
+      ip += length;
+      anchor = ip;
+    }
+  }
+
+  if (!write_sequence(op, oend, src + anchor, size - anchor, 0, 0)) {
+    return 0;
+  }
+
+  return op - dst;
+}
+
+bool lz4_decompress(const uint8_t* src, size_t size, uint8_t* dst,
+                    size_t dst_size) {
+  const uint8_t* ip = src;
+  const uint8_t* iend = src + size;
+  uint8_t* op = dst;
+  uint8_t* oend = dst + dst_size;
+
+  while (ip < iend) {
+    uint8_t token = *ip++;
+
+    size_t literal_length = token >> 4;
+    if (literal_length == 15 && !read_length(ip, iend, literal_length)) {
+      return false;
+    }
+    if (static_cast<size_t>(iend - ip) < literal_length ||
+        static_cast<size_t>(oend - op) < literal_length) {
+      return false;
+    }
+    if (literal_length > 0) std::memcpy(op, ip, literal_length);
+    ip += literal_length;
+    op += literal_length;
+
+    // The last sequence ends after its literals
+    if (ip == iend) break;
+
+    if (iend - ip < 2) return false;
+    size_t offset = ip[0] | (ip[1] << 8);
+    ip += 2;
+    if (offset == 0 || offset > static_cast<size_t>(op - dst)) return false;
+
+    size_t match_length = token & 15;
+    if (match_length == 15 && !read_length(ip, iend, match_length)) {
+      return false;
+    }
+    match_length += kMinMatch;
+    if (static_cast<size_t>(oend - op) < match_length) return false;
+
+    // Matches may overlap the bytes they produce, so copy byte by byte
+    const uint8_t* match = op - offset;
+    for (size_t i = 0; i < match_length; i++) {
+      op[i] = match[i];
+    }
+    op += match_length;
+  }
+
+  return op == oend;
+}
+
+void shuffle(const uint8_t* src, size_t size, size_t element_size,
+             uint8_t* dst) {
+  size_t count = size / element_size;
+  for (size_t i = 0; i < count; i++) {
+    for (size_t byte = 0; byte < element_size; byte++) {
+      dst[byte * count + i] = src[i * element_size + byte];
+    }
+  }
+  std::memcpy(dst + count * element_size, src + count * element_size,
+              size - count * element_size);
+}
+
+void unshuffle(const uint8_t* src, size_t size, size_t element_size,
+               uint8_t* dst) {
+  size_t count = size / element_size;
+  for (size_t i = 0; i < count; i++) {
+    for (size_t byte = 0; byte < element_size; byte++) {
+      dst[i * element_size + byte] = src[byte * count + i];
+    }
+  }
+  std::memcpy(dst + count * element_size, src + count * element_size,
+              size - count * element_size);
+}
+
+}  // namespace codec
+}  // namespace nx_iree
@@ -0,0 +1,34 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+
+// Payload codecs for serialized tensors.
+//
+// The LZ4 functions implement the LZ4 block format, so payloads can be
+// decoded by any LZ4 implementation. Decompression checks every read and
+// write against the buffer bounds, so corrupted input fails instead of
+// reading or writing out of bounds.
+namespace nx_iree {
+namespace codec {
+
+// The largest size the compressed form of `size` bytes can take.
+size_t lz4_compress_bound(size_t size);
+
+// Compresses `src` into `dst`. Returns the compressed size, or 0 when it
+// doesn't fit in `capacity`.
+size_t lz4_compress(const uint8_t* src, size_t size, uint8_t* dst, size_t capacity);
+
+// Decompresses `src` into `dst`, which must receive exactly `dst_size` bytes.
+// Returns false if the input is malformed or doesn't decode to `dst_size` bytes.
+bool lz4_decompress(const uint8_t* src, size_t size, uint8_t* dst, size_t dst_size);
+
+// Groups the i-th byte of every element together, which makes the slowly
+// changing exponent and high mantissa bytes of floats compress well.
+// Trailing bytes which don't form a whole element are copied as is.
+void shuffle(const uint8_t* src, size_t size, size_t element_size, uint8_t* dst);
+
+// Reverts shuffle().
+void unshuffle(const uint8_t* src, size_t size, size_t element_size, uint8_t* dst);
+
+}  // namespace codec
+}  // namespace nx_iree
@@ -78,6 +78,7 @@ iree::runtime::IREETensor::IREETensor(emscripten::val input_data, emscripten::va
 
   this->device = device->ref;
   this->buffer_view = nullptr;
+  set_backing(Backing::kHost);
 }
 
 std::string serialize_iree_tensor(iree::runtime::IREETensor& tensor) {
@@ -0,0 +1,110 @@
+#include "profiling.h"
+
+#include <algorithm>
+#include <atomic>
+#include <map>
+#include <mutex>
+#include <utility>
+
+#include "tracing.h"
+
+namespace nx_iree {
+namespace profiling {
+
+namespace {
+
+struct Session {
+  uint64_t started_at_ns;
+  std::map<std::pair<std::string, std::string>, FunctionStats> functions;
+};
+
+std::mutex sessions_mutex;
+std::map<iree_hal_device_t*, Session> sessions;
+
+// Lets calls skip the lock while no device is being profiled
+std::atomic<int> active_sessions{0};
+
+}  // namespace
+
+iree_status_t begin(iree_hal_device_t* device,
+                    iree_hal_device_profiling_mode_t mode,
+                    const std::string& file_path) {
+  std::lock_guard<std::mutex> lock(sessions_mutex);
+
+  if (sessions.count(device)) {
+    return iree_make_status(IREE_STATUS_FAILED_PRECONDITION,
+                            "device is already being profiled");
+  }
+
+  iree_hal_device_profiling_options_t options = {};
+  options.mode = mode;
+  options.file_path = file_path.empty() ? nullptr : file_path.c_str();
+
+  IREE_RETURN_IF_ERROR(iree_hal_device_profiling_begin(device, &options));
+
+  sessions[device] = Session{tracing::now_ns(), {}};
+  active_sessions.fetch_add(1, std::memory_order_relaxed);
+  return iree_ok_status();
+}
+
+iree_status_t flush(iree_hal_device_t* device) {
+  {
+    std::lock_guard<std::mutex> lock(sessions_mutex);
+    if (!sessions.count(device)) {
+      return iree_make_status(IREE_STATUS_FAILED_PRECONDITION,
+                              "device is not being profiled");
+    }
+  }
+
+  return iree_hal_device_profiling_flush(device);
+}
+
+iree_status_t end(iree_hal_device_t* device, Report* out_report) {
+  Session session;
+
+  {
+    std::lock_guard<std::mutex> lock(sessions_mutex);
+    auto it = sessions.find(device);
+    if (it == sessions.end()) {
+      return iree_make_status(IREE_STATUS_FAILED_PRECONDITION,
+                              "device is not being profiled");
+    }
+
+    session = std::move(it->second);
+    sessions.erase(it);
+    active_sessions.fetch_sub(1, std::memory_order_relaxed);
+  }
+
+  out_report->duration_ns = tracing::now_ns() - session.started_at_ns;
+  out_report->functions.clear();
+  for (auto& [key, stats] : session.functions) {
+    out_report->functions.push_back(std::move(stats));
+  }
+
+  return iree_hal_device_profiling_end(device);
+}
+
+void record_invoke(iree_hal_device_t* device, const std::string& module,
+                   const std::string& function, uint64_t duration_ns) {
+  if (active_sessions.load(std::memory_order_relaxed) == 0) return;
+
+  std::lock_guard<std::mutex> lock(sessions_mutex);
+  auto it = sessions.find(device);
+  if (it == sessions.end()) return;
+
+  std::pair<std::string, std::string> key = {module, function};
+
+  FunctionStats& stats = it->second.functions[key];
+  if (stats.calls == 0) {
+    stats.module = key.first;
+    stats.function = key.second;
+  }
+
+  stats.calls++;
+  stats.total_ns += duration_ns;
+  stats.min_ns = std::min(stats.min_ns, duration_ns);
+  stats.max_ns = std::max(stats.max_ns, duration_ns);
+}
+
+}  // namespace profiling
+}  // namespace nx_iree
@@ -0,0 +1,49 @@
+#pragma once
+#include <iree/hal/api.h>
+#include <iree/vm/api.h>
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Device profiling sessions.
+//
+// A session brackets iree_hal_device_profiling_begin/end, so drivers and
+// external tools (Tracy, RenderDoc, Instruments) capture their own data,
+// and also aggregates the invocations made on the device while it runs,
+// keyed by module identity. Invocations are timed as a whole; dispatches
+// are only seen by the driver and external tools.
+namespace nx_iree {
+namespace profiling {
+
+struct FunctionStats {
+  // Identifies the module, such as the hash of its bytecode
+  std::string module;
+  std::string function;
+  uint64_t calls = 0;
+  uint64_t total_ns = 0;
+  uint64_t min_ns = UINT64_MAX;
+  uint64_t max_ns = 0;
+};
+
+struct Report {
+  uint64_t duration_ns = 0;
+  std::vector<FunctionStats> functions;
+};
+
+// Starts profiling the device. Fails if it is already being profiled.
+// `file_path` may be empty.
+iree_status_t begin(iree_hal_device_t* device, iree_hal_device_profiling_mode_t mode, const std::string& file_path);
+
+// Flushes data captured by the driver so far.
+iree_status_t flush(iree_hal_device_t* device);
+
+// Stops profiling the device and returns what was aggregated.
+iree_status_t end(iree_hal_device_t* device, Report* out_report);
+
+// Records a function invocation if the device is being profiled. `module` is an
+// opaque key, as runtime module names are shared by every compiled module.
+void record_invoke(iree_hal_device_t* device, const std::string& module, const std::string& function, uint64_t duration_ns);
+
+}  // namespace profiling
+}  // namespace nx_iree
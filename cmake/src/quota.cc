@@ -0,0 +1,156 @@
+#include "quota.h"
+
+#include <atomic>
+#include <map>
+#include <mutex>
+#include <vector>
+
+namespace nx_iree {
+namespace quota {
+
+namespace {
+
+struct Pool {
+  std::string name;
+  Usage usage;
+};
+
+std::mutex pools_mutex;
+
+// Pools are never freed, so charges can keep pointers to them even after
+// their limit is lifted
+std::map<iree_hal_device_t*, Pool*> device_pools;
+std::map<std::string, Pool*> tenant_pools;
+
+// Lets allocations skip the lock while no limit was ever set
+std::atomic<bool> active{false};
+
+Pool* find_or_create(Pool*& pool, const std::string& name) {
+  if (pool == nullptr) pool = new Pool{name, {}};
+  return pool;
+}
+
+// Collects the pools an allocation is charged to. Must hold pools_mutex.
+std::vector<Pool*> pools_for(iree_hal_device_t* device,
+                             const std::string& tenant) {
+  std::vector<Pool*> pools;
+
+  auto device_pool = device_pools.find(device);
+  if (device_pool != device_pools.end()) pools.push_back(device_pool->second);
+
+  if (!tenant.empty()) {
+    auto tenant_pool = tenant_pools.find(tenant);
+    if (tenant_pool != tenant_pools.end()) pools.push_back(tenant_pool->second);
+  }
+
+  return pools;
+}
+
+bool fits(const Pool* pool, uint64_t bytes) {
+  return pool->usage.limit == 0 ||
+         pool->usage.in_use + bytes <= pool->usage.limit;
+}
+
+// Returns the first pool the bytes don't fit in, if any
+Pool* first_full(const std::vector<Pool*>& pools, uint64_t bytes) {
+  for (auto pool : pools) {
+    if (!fits(pool, bytes)) return pool;
+  }
+  return nullptr;
+}
+
+iree_status_t deny(const Pool* pool, uint64_t bytes, Denial* out_denial) {
+  *out_denial = Denial{true, pool->name, bytes, pool->usage.limit,
+                       pool->usage.in_use};
+
+  return iree_make_status(
+      IREE_STATUS_RESOURCE_EXHAUSTED,
+      "%s quota exceeded: requested %llu bytes with %llu of %llu in use",
+      pool->name.c_str(), (unsigned long long)bytes,
+      (unsigned long long)pool->usage.in_use,
+      (unsigned long long)pool->usage.limit);
+}
+
+}  // namespace
+
+class Charge {
+ public:
+  Charge(std::vector<Pool*> pools, uint64_t bytes)
+      : pools_(std::move(pools)), bytes_(bytes) {
+    for (auto pool : pools_) {
+      pool->usage.in_use += bytes_;
+      if (pool->usage.in_use > pool->usage.peak) {
+        pool->usage.peak = pool->usage.in_use;
+      }
+    }
+  }
+
+  ~Charge() {
+    std::lock_guard<std::mutex> lock(pools_mutex);
+    for (auto pool : pools_) pool->usage.in_use -= bytes_;
+  }
+
+ private:
+  std::vector<Pool*> pools_;
+  uint64_t bytes_;
+};
+
+void set_device_limit(iree_hal_device_t* device, uint64_t limit) {
+  std::lock_guard<std::mutex> lock(pools_mutex);
+  find_or_create(device_pools[device], "device")->usage.limit = limit;
+  active.store(true, std::memory_order_release);
+}
+
+void set_tenant_limit(const std::string& tenant, uint64_t limit) {
+  std::lock_guard<std::mutex> lock(pools_mutex);
+  find_or_create(tenant_pools[tenant], tenant)->usage.limit = limit;
+  active.store(true, std::memory_order_release);
+}
+
+bool device_usage(iree_hal_device_t* device, Usage* out_usage) {
+  std::lock_guard<std::mutex> lock(pools_mutex);
+  auto pool = device_pools.find(device);
+  if (pool == device_pools.end()) return false;
+  *out_usage = pool->second->usage;
+  return true;
+}
+
+bool tenant_usage(const std::string& tenant, Usage* out_usage) {
+  std::lock_guard<std::mutex> lock(pools_mutex);
+  auto pool = tenant_pools.find(tenant);
+  if (pool == tenant_pools.end()) return false;
+  *out_usage = pool->second->usage;
+  return true;
+}
+
+iree_status_t reserve(iree_hal_device_t* device, const std::string& tenant,
+                      uint64_t bytes, std::shared_ptr<Charge>* out_charge,
+                      Denial* out_denial) {
+  out_charge->reset();
+  if (!active.load(std::memory_order_acquire)) return iree_ok_status();
+
+  std::lock_guard<std::mutex> lock(pools_mutex);
+  auto pools = pools_for(device, tenant);
+  if (pools.empty()) return iree_ok_status();
+
+  if (Pool* full = first_full(pools, bytes)) {
+    return deny(full, bytes, out_denial);
+  }
+
+  *out_charge = std::make_shared<Charge>(std::move(pools), bytes);
+  return iree_ok_status();
+}
+
+std::shared_ptr<Charge> charge(iree_hal_device_t* device,
+                               const std::string& tenant, uint64_t bytes) {
+  if (!active.load(std::memory_order_acquire)) return nullptr;
+
+  std::lock_guard<std::mutex> lock(pools_mutex);
+  auto pools = pools_for(device, tenant);
+  if (pools.empty()) return nullptr;
+
+  return std::make_shared<Charge>(std::move(pools), bytes);
+}
+
+}  // namespace quota
+}  // namespace nx_iree
@@ -0,0 +1,63 @@
+#pragma once
+#include <iree/hal/api.h>
+
+#include <cstdint>
+#include <memory>
+#include <string>
+
+// Memory quotas for tensors.
+//
+// A quota limits the bytes held by tensors on a device or by a named tenant.
+// Tensors hold a charge against the quotas they were allocated under and give
+// it back when deallocated. Allocations beyond a limit fail right away with a
+// denial, as they run on schedulers which must not block. Callers wait for
+// memory to be released and retry on their own. Usage is tracked from the
+// moment a limit is first set.
+namespace nx_iree {
+namespace quota {
+
+struct Usage {
+  uint64_t limit = 0;
+  uint64_t in_use = 0;
+  uint64_t peak = 0;
+};
+
+// Why a reservation was refused
+struct Denial {
+  bool denied = false;
+  // "device" or the name of the tenant
+  std::string pool;
+  uint64_t requested = 0;
+  uint64_t limit = 0;
+  uint64_t in_use = 0;
+};
+
+// What a call reserves for its uploads and outputs. The tenant may be empty.
+struct Request {
+  std::string tenant;
+  uint64_t expected_output_bytes = 0;
+  Denial denial;
+};
+
+// Bytes held against one or more quotas, given back when destroyed.
+class Charge;
+
+// Sets the limit of the device or tenant quota. A limit of 0 lifts it.
+void set_device_limit(iree_hal_device_t* device, uint64_t limit);
+void set_tenant_limit(const std::string& tenant, uint64_t limit);
+
+// Returns false if no limit was ever set.
+bool device_usage(iree_hal_device_t* device, Usage* out_usage);
+bool tenant_usage(const std::string& tenant, Usage* out_usage);
+
+// Reserves `bytes` against the quotas of the device and of the tenant, without
+// waiting. `out_charge` is left empty when neither has a quota. Fails with
+// RESOURCE_EXHAUSTED and fills in `out_denial` if the bytes don't fit.
+iree_status_t reserve(iree_hal_device_t* device, const std::string& tenant, uint64_t bytes, std::shared_ptr<Charge>* out_charge, Denial* out_denial);
+
+// Charges memory which is already allocated, without waiting and even beyond
+// the limits. Returns nullptr when neither the device nor the tenant has a quota.
+std::shared_ptr<Charge> charge(iree_hal_device_t* device, const std::string& tenant, uint64_t bytes);
+
+}  // namespace quota
+}  // namespace nx_iree
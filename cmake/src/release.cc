@@ -0,0 +1,121 @@
+#include "release.h"
+
+#include "tracing.h"
+
+#include <atomic>
+#include <cstdint>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+namespace nx_iree {
+namespace release {
+
+namespace {
+
+struct Node {
+  iree::runtime::IREETensor::Contents contents;
+  Node* next;
+};
+
+// Producers push onto a Treiber stack and the release thread takes the
+// whole stack at once, so neither side ever waits on the other.
+std::atomic<Node*> pending{nullptr};
+
+// Only used to put the release thread to sleep and to wake it up
+std::mutex idle_mutex;
+std::condition_variable idle;
+std::atomic<bool> sleeping{false};
+
+// Lets drain() wait for what was queued before it. Only `released` is
+// guarded by idle_mutex, so pushing stays lock-free.
+std::condition_variable progress;
+std::atomic<uint64_t> enqueued{0};
+uint64_t released = 0;
+
+std::once_flag started;
+
+// Takes everything queued so far, oldest first
+Node* take_all() {
+  Node* head = pending.exchange(nullptr, std::memory_order_acquire);
+  Node* reversed = nullptr;
+
+  while (head != nullptr) {
+    Node* next = head->next;
+    head->next = reversed;
+    reversed = head;
+    head = next;
+  }
+
+  return reversed;
+}
+
+void run() {
+  for (;;) {
+    Node* node = take_all();
+
+    if (node == nullptr) {
+      std::unique_lock<std::mutex> lock(idle_mutex);
+      sleeping.store(true);
+      // Checked after announcing we sleep, so a push either sees the flag
+      // or is seen here
+      idle.wait(lock, [] { return pending.load() != nullptr; });
+      sleeping.store(false);
+      continue;
+    }
+
+    nx_iree::tracing::Span span("tensor_release");
+    uint64_t count = 0;
+
+    while (node != nullptr) {
+      Node* next = node->next;
+      node->contents.release();
+      delete node;
+      node = next;
+      count++;
+    }
+
+    {
+      std::lock_guard<std::mutex> lock(idle_mutex);
+      released += count;
+    }
+    progress.notify_all();
+  }
+}
+
+// The thread runs until the VM exits, as the NIF library is never unloaded
+// while tensors may still reference it
+void start() {
+  std::thread(run).detach();
+}
+
+}  // namespace
+
+void enqueue(iree::runtime::IREETensor::Contents contents) {
+  // Contents without memory only need their counters updated
+  if (contents.data == nullptr && contents.buffer_view == nullptr) {
+    contents.release();
+    return;
+  }
+
+  std::call_once(started, start);
+
+  enqueued.fetch_add(1);
+  Node* node = new Node{std::move(contents), pending.load(std::memory_order_relaxed)};
+  while (!pending.compare_exchange_weak(node->next, node)) {
+  }
+
+  if (sleeping.load()) {
+    std::lock_guard<std::mutex> lock(idle_mutex);
+    idle.notify_one();
+  }
+}
+
+void drain() {
+  uint64_t target = enqueued.load();
+  std::unique_lock<std::mutex> lock(idle_mutex);
+  progress.wait(lock, [target] { return released >= target; });
+}
+
+}  // namespace release
+}  // namespace nx_iree
@@ -0,0 +1,21 @@
+#pragma once
+#include "runtime.h"
+
+// Releases tensor memory on a background thread.
+//
+// Releasing a buffer view may wait on device work or free a large host
+// allocation, which is too slow for the thread that happens to drop the
+// last reference. Contents are pushed onto a lock-free queue instead and
+// released in order by a single thread, started on first use. Pushing
+// never blocks and only takes a lock to wake the thread up when it is idle.
+namespace nx_iree {
+namespace release {
+
+// Queues the contents to be released on the release thread.
+void enqueue(iree::runtime::IREETensor::Contents contents);
+
+// Blocks until everything queued before the call has been released.
+void drain();
+
+}  // namespace release
+}  // namespace nx_iree
@@ -1,14 +1,25 @@
 #include "runtime.h"
 
+#include "quota.h"
+#include "tensor_bundle.h"
+#include "tracing.h"
+
+#include <iree/base/internal/cpu.h>
+#include <iree/base/internal/file_io.h>
 #include <iree/hal/api.h>
 #include <iree/hal/drivers/init.h>
+#include <iree/schemas/cpu_data.h>
 #include <iree/tooling/device_util.h>
 
 #ifdef DEBUG
 #include <iree/base/tracing/tracy.h>
 #endif
 
+#include <algorithm>
+#include <atomic>
+#include <cstring>
 #include <iostream>
+#include <mutex>
 #include <sstream>
 #include <vector>
 
@@ -24,6 +35,138 @@
     return {status, std::nullopt};                                             \
   }
 
+namespace {
+
+// Adds the time elapsed since the previous lap to a CallStats field,
+// recording it as a trace span when tracing is enabled
+class PhaseTimer {
+ public:
+  PhaseTimer() : last_(nx_iree::tracing::now_ns()) {}
+
+  void lap(uint64_t &field, const char *name) {
+    uint64_t now = nx_iree::tracing::now_ns();
+    field += now - last_;
+    if (nx_iree::tracing::enabled()) {
+      nx_iree::tracing::record(name, last_, now);
+    }
+    last_ = now;
+  }
+
+ private:
+  uint64_t last_;
+};
+
+// Counters for one backing of live tensors. They are only read for reporting,
+// so relaxed ordering is enough.
+struct LiveTensorCounter {
+  std::atomic<uint64_t> count{0};
+  std::atomic<uint64_t> bytes{0};
+  std::atomic<uint64_t> peak_bytes{0};
+
+  void add(uint64_t size) {
+    count.fetch_add(1, std::memory_order_relaxed);
+    uint64_t total = bytes.fetch_add(size, std::memory_order_relaxed) + size;
+    uint64_t peak = peak_bytes.load(std::memory_order_relaxed);
+    while (total > peak && !peak_bytes.compare_exchange_weak(
+                               peak, total, std::memory_order_relaxed)) {
+    }
+  }
+
+  void remove(uint64_t size) {
+    count.fetch_sub(1, std::memory_order_relaxed);
+    bytes.fetch_sub(size, std::memory_order_relaxed);
+  }
+};
+
+LiveTensorCounter host_tensors;
+LiveTensorCounter device_tensors;
+
+LiveTensorCounter *counter_for(iree::runtime::IREETensor::Backing backing) {
+  switch (backing) {
+    case iree::runtime::IREETensor::Backing::kHost:
+      return &host_tensors;
+    case iree::runtime::IREETensor::Backing::kDevice:
+      return &device_tensors;
+    default:
+      return nullptr;
+  }
+}
+
+// Reads a tensor written by IREETensor::serialize() into `tensor`, checking
+// every field against the `length` bytes of `buffer`. The tensor is left
+// untouched on failure.
+iree_status_t read_serialized(iree::runtime::IREETensor *tensor,
+                              const char *buffer, size_t length) {
+  using namespace nx_iree::tensor_bundle;
+
+  size_t offset = 0;
+  auto read = [&](void *out, size_t bytes) {
+    if (bytes > length - offset) return false;
+    std::memcpy(out, buffer + offset, bytes);
+    offset += bytes;
+    return true;
+  };
+  auto truncated = [] {
+    return iree_make_status(IREE_STATUS_OUT_OF_RANGE,
+                            "serialized tensor is truncated");
+  };
+
+  uint8_t encoding;
+  iree_hal_element_type_t type;
+  size_t size;
+  if (!read(&encoding, sizeof(encoding)) || !read(&type, sizeof(type)) ||
+      !read(&size, sizeof(size))) {
+    return truncated();
+  }
+
+  size_t stored_size = size;
+  if (encoding != kEncodingRaw) {
+    if (encoding != kEncodingLz4 && encoding != kEncodingShuffleLz4) {
+      return iree_make_status(IREE_STATUS_INVALID_ARGUMENT,
+                              "unknown tensor encoding %u", encoding);
+    }
+    if (!read(&stored_size, sizeof(stored_size))) return truncated();
+  }
+  if (stored_size > length - offset) return truncated();
+
+  // Released with std::free
+  void *data = std::malloc(size);
+  if (data == nullptr && size > 0) {
+    return iree_make_status(IREE_STATUS_RESOURCE_EXHAUSTED,
+                            "unable to allocate %zu bytes", size);
+  }
+
+  const uint8_t *stored = reinterpret_cast<const uint8_t *>(buffer + offset);
+  if (encoding == kEncodingRaw) {
+    std::memcpy(data, stored, size);
+  } else {
+    iree_status_t status = decode(stored, stored_size, encoding, type,
+                                  static_cast<uint8_t *>(data), size);
+    if (!iree_status_is_ok(status)) {
+      std::free(data);
+      return status;
+    }
+  }
+  offset += stored_size;
+
+  size_t num_dims;
+  if (!read(&num_dims, sizeof(num_dims)) ||
+      num_dims > (length - offset) / sizeof(iree_hal_dim_t)) {
+    std::free(data);
+    return truncated();
+  }
+  std::vector<iree_hal_dim_t> dims(num_dims);
+  read(dims.data(), num_dims * sizeof(iree_hal_dim_t));
+
+  tensor->type = type;
+  tensor->size = size;
+  tensor->data = data;
+  tensor->dims = std::move(dims);
+  return iree_ok_status();
+}
+
+}  // namespace
+
 iree::runtime::Device::~Device() {
   if (ref) {
     iree_hal_device_release(ref);
@@ -51,6 +194,7 @@ iree::runtime::IREETensor::IREETensor(iree_hal_buffer_view_t *buffer_view,
   }
 
   data = nullptr;
+  set_backing(Backing::kDevice);
 }
 
 iree::runtime::IREETensor::IREETensor(void *data, size_t size,
@@ -67,61 +211,133 @@ iree::runtime::IREETensor::IREETensor(void *data, size_t size,
   std::memcpy(this->data, data, size);
 
   this->buffer_view = nullptr;
+  set_backing(Backing::kHost);
 }
 
-iree::runtime::IREETensor::IREETensor(char *buffer) {
-  size_t offset = 0;
-
-  // Deserialize 'type'
-  std::memcpy(&type, buffer + offset, sizeof(type));
-  offset += sizeof(type);
+iree::runtime::IREETensor::IREETensor(char *buffer)
+    : data(nullptr), size(0), buffer_view(nullptr), device(nullptr) {
+  iree_status_ignore(read_serialized(this, buffer, SIZE_MAX));
+  set_backing(Backing::kHost);
+}
 
-  // Deserialize 'size'
-  std::memcpy(&size, buffer + offset, sizeof(size));
-  offset += sizeof(size);
+iree::runtime::IREETensor::IREETensor(const char *buffer, size_t length,
+                                      iree_status_t *out_status)
+    : data(nullptr), size(0), buffer_view(nullptr), device(nullptr) {
+  *out_status = read_serialized(this, buffer, length);
+  set_backing(Backing::kHost);
+}
 
-  // Allocate memory and deserialize 'data'
-  data = operator new(size); // Allocate raw memory
-  std::memcpy(data, buffer + offset, size);
-  offset += size;
+iree::runtime::IREETensor::~IREETensor() { this->deallocate(); }
 
-  // Deserialize 'dims'
-  size_t num_dims;
-  std::memcpy(&num_dims, buffer + offset, sizeof(num_dims));
-  offset += sizeof(num_dims);
-  dims.resize(num_dims);
-  std::memcpy(dims.data(), buffer + offset, num_dims * sizeof(iree_hal_dim_t));
+void iree::runtime::IREETensor::set_backing(Backing backing) {
+  if (auto counter = counter_for(this->backing)) counter->remove(size);
+  if (auto counter = counter_for(backing)) counter->add(size);
+  this->backing = backing;
+}
 
-  this->buffer_view = nullptr;
+iree::runtime::LiveTensorStats live_tensor_stats() {
+  iree::runtime::LiveTensorStats stats;
+  stats.host_count = host_tensors.count.load(std::memory_order_relaxed);
+  stats.host_bytes = host_tensors.bytes.load(std::memory_order_relaxed);
+  stats.host_peak_bytes =
+      host_tensors.peak_bytes.load(std::memory_order_relaxed);
+  stats.device_count = device_tensors.count.load(std::memory_order_relaxed);
+  stats.device_bytes = device_tensors.bytes.load(std::memory_order_relaxed);
+  stats.device_peak_bytes =
+      device_tensors.peak_bytes.load(std::memory_order_relaxed);
+  return stats;
 }
 
-iree::runtime::IREETensor::~IREETensor() { this->deallocate(); }
+void iree::runtime::IREETensor::deallocate() { detach().release(); }
+
+iree::runtime::IREETensor::Contents iree::runtime::IREETensor::detach() {
+  std::lock_guard<std::mutex> lock(mapping_mutex);
+
+  Contents contents;
+  contents.data = data;
+  contents.buffer_view = buffer_view;
+  contents.mapping = mapping;
+  contents.mapped = mapped;
+  contents.backing = backing;
+  contents.size = size;
+  contents.charge = std::move(charge);
 
-void iree::runtime::IREETensor::deallocate() {
+  data = nullptr;
+  buffer_view = nullptr;
+  mapping = {};
+  mapped = false;
+  // The counters are left to the contents, which still hold the memory
+  backing = Backing::kNone;
+  charge.reset();
+
+  return contents;
+}
+
+void iree::runtime::IREETensor::Contents::release() {
   if (data != nullptr) {
     std::free(data);
     data = nullptr;
   }
 
+  if (mapped) {
+    iree_hal_buffer_unmap_range(&mapping);
+    mapped = false;
+  }
+
   if (buffer_view != nullptr) {
     iree_hal_buffer_view_release(buffer_view);
     buffer_view = nullptr;
   }
+
+  // Only once the memory is gone does it stop counting as live
+  if (auto counter = counter_for(backing)) counter->remove(size);
+  backing = Backing::kNone;
+  charge.reset();
 }
 
-std::vector<char> *iree::runtime::IREETensor::serialize() {
-  auto buffer = new std::vector<char>();
+iree_status_t iree::runtime::IREETensor::host_pointer(void **out_ptr) {
+  std::lock_guard<std::mutex> lock(mapping_mutex);
 
-  // Serialize 'type'
-  size_t type_size = sizeof(type);
-  buffer->insert(buffer->end(), reinterpret_cast<const char *>(&type),
-                 reinterpret_cast<const char *>(&type) + type_size);
+  // Host tensors which were never uploaded already own their contents,
+  // as do device tensors which were read back
+  if (data != nullptr) {
+    *out_ptr = data;
+    return iree_ok_status();
+  }
 
-  // Serialize 'size'
-  size_t size_size = sizeof(size);
-  buffer->insert(buffer->end(), reinterpret_cast<const char *>(&size),
-                 reinterpret_cast<const char *>(&size) + size_size);
+  if (buffer_view == nullptr) {
+    return iree_make_status(IREE_STATUS_FAILED_PRECONDITION,
+                            "tensor has been deallocated");
+  }
 
+  if (!mapped) {
+    iree_hal_buffer_t *buffer = iree_hal_buffer_view_buffer(buffer_view);
+
+    // Call outputs are allocated by the module, which only asks for
+    // persistent mappings on some devices. A host copy would silently
+    // stop sharing writes with the buffer, so it is left to the caller.
+    if (!iree_all_bits_set(iree_hal_buffer_allowed_usage(buffer),
+                           IREE_HAL_BUFFER_USAGE_MAPPING_PERSISTENT)) {
+      return iree_make_status(IREE_STATUS_FAILED_PRECONDITION,
+                              "tensor buffer can't be mapped persistently, "
+                              "read it into host memory instead");
+    }
+
+    // Imported read-only memory, such as a memory-mapped file, can only be
+    // mapped for reading
+    iree_hal_memory_access_t access =
+        iree_hal_buffer_allowed_access(buffer) & IREE_HAL_MEMORY_ACCESS_ALL;
+    IREE_RETURN_IF_ERROR(iree_hal_buffer_map_range(
+        buffer, IREE_HAL_MAPPING_MODE_PERSISTENT, access, 0, IREE_WHOLE_BUFFER,
+        &mapping));
+    mapped = true;
+  }
+
+  *out_ptr = mapping.contents.data;
+  return iree_ok_status();
+}
+
+std::vector<char> *iree::runtime::IREETensor::serialize(bool compress) {
   if (data == nullptr) {
     data = std::malloc(size);
 
@@ -132,20 +348,50 @@ std::vector<char> *iree::runtime::IREETensor::serialize() {
     auto status = read_buffer(device, buffer_view, data, size);
 
     if (!iree_status_is_ok(status)) {
+      // Otherwise the uninitialized memory would pass for the contents
+      std::free(data);
+      data = nullptr;
+      iree_status_ignore(status);
+      return nullptr;
+    }
+  }
+
+  // Uses the codec of tensor bundles, which keeps payloads that don't shrink raw
+  nx_iree::tensor_bundle::EncodedPayloads encoded;
+  if (compress) {
+    auto status = nx_iree::tensor_bundle::compress({this}, encoded);
+    if (!iree_status_is_ok(status)) {
+      iree_status_ignore(status);
       return nullptr;
     }
   }
-  // Serialize 'data'
-  buffer->insert(buffer->end(), reinterpret_cast<const char *>(data),
-                 reinterpret_cast<const char *>(data) + size);
 
-  // Serialize 'dims'
-  size_t dims_size = sizeof(iree_hal_dim_t) * dims.size();
+  uint8_t encoding = compress ? static_cast<uint8_t>(encoded.encodings[0])
+                              : nx_iree::tensor_bundle::kEncodingRaw;
+  const char *stored = reinterpret_cast<const char *>(data);
+  size_t stored_size = size;
+  if (encoding != nx_iree::tensor_bundle::kEncodingRaw) {
+    stored = reinterpret_cast<const char *>(encoded.data[0].data());
+    stored_size = encoded.data[0].size();
+  }
+
+  auto buffer = new std::vector<char>();
+  auto append = [buffer](const void *field, size_t field_size) {
+    auto bytes = reinterpret_cast<const char *>(field);
+    buffer->insert(buffer->end(), bytes, bytes + field_size);
+  };
+
+  append(&encoding, sizeof(encoding));
+  append(&type, sizeof(type));
+  append(&size, sizeof(size));
+  if (encoding != nx_iree::tensor_bundle::kEncodingRaw) {
+    append(&stored_size, sizeof(stored_size));
+  }
+  append(stored, stored_size);
+
   size_t num_dims = dims.size();
-  buffer->insert(buffer->end(), reinterpret_cast<const char *>(&num_dims),
-                 reinterpret_cast<const char *>(&num_dims) + sizeof(num_dims));
-  buffer->insert(buffer->end(), reinterpret_cast<const char *>(dims.data()),
-                 reinterpret_cast<const char *>(dims.data()) + dims_size);
+  append(&num_dims, sizeof(num_dims));
+  append(dims.data(), sizeof(iree_hal_dim_t) * num_dims);
 
   return buffer;
 }
@@ -187,6 +433,37 @@ iree_hal_element_type_t nx_type_to_iree_type(std::string type) {
   return type_enum::IREE_HAL_ELEMENT_TYPE_NONE;
 }
 
+#if defined(IREE_ARCH_X86_64)
+#define NX_IREE_HOST_CPU_ARCH "X86_64"
+#elif defined(IREE_ARCH_ARM_64)
+#define NX_IREE_HOST_CPU_ARCH "ARM_64"
+#elif defined(IREE_ARCH_RISCV_64)
+#define NX_IREE_HOST_CPU_ARCH "RISCV_64"
+#else
+#define NX_IREE_HOST_CPU_ARCH ""
+#endif
+
+std::vector<std::string> host_cpu_features() {
+  static std::once_flag cpu_initialized;
+  std::call_once(cpu_initialized,
+                 []() { iree_cpu_initialize(iree_allocator_system()); });
+
+  const uint64_t *fields = iree_cpu_data_fields();
+  std::vector<std::string> features;
+
+  // Expand IREE's table of known feature bits, keeping only the ones for the
+  // host architecture. The names are the ones LLVM expects in target features.
+#define IREE_CPU_FEATURE_BIT(arch, field_index, bit_pos, bit_name, llvm_name) \
+  if (std::strcmp(#arch, NX_IREE_HOST_CPU_ARCH) == 0 &&                       \
+      (fields[field_index] & (1ull << bit_pos))) {                            \
+    features.push_back(std::string("+") + llvm_name);                         \
+  }
+#include <iree/schemas/cpu_feature_bits.inl>
+#undef IREE_CPU_FEATURE_BIT
+
+  return features;
+}
+
 iree_vm_instance_t *create_instance() {
   iree_vm_instance_t *instance = nullptr;
   iree_status_t status = iree_vm_instance_create(
@@ -266,12 +543,12 @@ iree_status_t list_devices(iree_hal_driver_registry_t *registry,
   return iree_ok_status();
 }
 
-iree_status_t list_devices(iree_hal_driver_registry_t *registry,
-                           std::string driver_name,
-                           std::vector<iree::runtime::Device *> &devices) {
+iree_status_t query_devices(iree_hal_driver_registry_t *registry,
+                            std::string driver_name,
+                            std::vector<iree::runtime::Device *> &devices) {
   size_t device_info_count;
-  iree_hal_device_info_t *device_infos;
-  iree_hal_driver_t *driver;
+  iree_hal_device_info_t *device_infos = nullptr;
+  iree_hal_driver_t *driver = nullptr;
 
   iree_status_t status = iree_hal_driver_registry_try_create(
       registry, iree_make_cstring_view(driver_name.c_str()),
@@ -297,65 +574,189 @@ iree_status_t list_devices(iree_hal_driver_registry_t *registry,
     std::string device_urn(info.path.data, info.path.size);
     device->uri = driver_name + "://" + device_urn;
     device->id = info.device_id;
+    device->ref = nullptr;
+    devices.push_back(device);
+  }
 
-    status = iree_hal_create_device(registry,
-                                    iree_make_cstring_view(device->uri.c_str()),
-                                    iree_allocator_system(), &device->ref);
+  iree_allocator_free(iree_allocator_system(), device_infos);
+  iree_hal_driver_release(driver);
+  return iree_ok_status();
+}
 
-    if (!iree_status_is_ok(status)) {
-      for (size_t j = 0; j <= i; j++) {
-        delete devices[i];
-      }
-      iree_hal_driver_release(driver);
-      iree_allocator_free(iree_allocator_system(), device_infos);
-      return status;
-    }
+iree_status_t list_devices(iree_hal_driver_registry_t *registry,
+                           std::string driver_name,
+                           std::vector<iree::runtime::Device *> &devices) {
+  std::vector<iree::runtime::Device *> driver_devices;
 
-    RUN_IF_CUDA_ENABLED(if (driver_name == "cuda") {
-      const iree_hal_cuda_dynamic_symbols_t *cuda_symbols =
-          iree_hal_cuda_device_dynamic_symbols(device->ref);
-      auto ctx = iree_hal_cuda_device_context(device->ref);
-      cuda_symbols->cuCtxSetCurrent(ctx);
-    });
+  iree_status_t status = query_devices(registry, driver_name, driver_devices);
 
-    devices.push_back(device);
+  for (size_t i = 0; iree_status_is_ok(status) && i < driver_devices.size();
+       i++) {
+    status = create_device(registry, driver_devices[i]->uri,
+                           &driver_devices[i]->ref);
   }
 
-  iree_allocator_free(iree_allocator_system(), device_infos);
-  iree_hal_driver_release(driver);
+  if (!iree_status_is_ok(status)) {
+    for (auto device : driver_devices) {
+      delete device;
+    }
+    return status;
+  }
+
+  devices.insert(devices.end(), driver_devices.begin(), driver_devices.end());
   return iree_ok_status();
 }
 
-iree_hal_device_t *create_device(iree_hal_driver_registry_t *registry,
-                                 const std::string &device_uri) {
-  iree_hal_device_t *device = nullptr;
+iree_status_t create_device(iree_hal_driver_registry_t *registry,
+                            const std::string &device_uri,
+                            iree_hal_device_t **out_device) {
+  *out_device = nullptr;
 
-  iree_status_t status = iree_hal_create_device(
+  IREE_RETURN_IF_ERROR(iree_hal_create_device(
       registry, iree_make_cstring_view(device_uri.c_str()),
-      iree_allocator_system(), &device);
+      iree_allocator_system(), out_device));
 
   RUN_IF_CUDA_ENABLED(if (device_uri.find("cuda://") != std::string::npos) {
     const iree_hal_cuda_dynamic_symbols_t *cuda_symbols =
-        iree_hal_cuda_device_dynamic_symbols(device);
-    auto ctx = iree_hal_cuda_device_context(device);
+        iree_hal_cuda_device_dynamic_symbols(*out_device);
+    auto ctx = iree_hal_cuda_device_context(*out_device);
     cuda_symbols->cuCtxSetCurrent(ctx);
   });
 
+  return iree_ok_status();
+}
+
+iree_hal_device_t *create_device(iree_hal_driver_registry_t *registry,
+                                 const std::string &device_uri) {
+  iree_hal_device_t *device = nullptr;
+  iree_status_t status = create_device(registry, device_uri, &device);
+
   if (!iree_status_is_ok(status)) {
-    iree_hal_device_release(device);
+    iree_status_ignore(status);
     return nullptr;
   }
 
   return device;
 }
 
+iree_status_t load_bytecode_module(iree_vm_instance_t *instance,
+                                   std::string path, size_t offset,
+                                   int64_t length,
+                                   iree_vm_module_t **out_module) {
+  nx_iree::tracing::Span span("module_load");
+  iree_file_contents_t *contents = nullptr;
+
+  // The file is mapped read-only and the mapping is handed over to the module
+  // as its archive allocator, so the bytecode is paged in from the page cache
+  // instead of being copied onto the heap. The mapping is released together
+  // with the module.
+  IREE_RETURN_IF_ERROR(iree_file_read_contents(
+      path.c_str(), IREE_FILE_READ_FLAG_MMAP, iree_allocator_system(),
+      &contents));
+
+  iree_host_size_t file_size = contents->const_buffer.data_length;
+  iree_host_size_t archive_size =
+      length < 0 ? file_size - std::min<iree_host_size_t>(offset, file_size)
+                 : static_cast<iree_host_size_t>(length);
+
+  if (offset > file_size || archive_size > file_size - offset) {
+    iree_file_contents_free(contents);
+    return iree_make_status(IREE_STATUS_OUT_OF_RANGE,
+                            "module span [%zu, %zu) exceeds file size %zu",
+                            offset, offset + archive_size, file_size);
+  }
+
+  iree_status_t status = iree_vm_bytecode_module_create(
+      instance,
+      iree_make_const_byte_span(contents->const_buffer.data + offset,
+                                archive_size),
+      iree_file_contents_deallocator(contents), iree_allocator_system(),
+      out_module);
+
+  if (!iree_status_is_ok(status)) {
+    iree_file_contents_free(contents);
+  }
+
+  return status;
+}
+
+iree_status_t create_bytecode_module(iree_vm_instance_t *instance,
+                                     const uint8_t *data, size_t size,
+                                     iree_vm_module_t **out_module) {
+  nx_iree::tracing::Span span("module_load");
+
+  // The module outlives the buffer it was created from, so it owns a copy
+  // which is freed together with the module.
+  uint8_t *archive = nullptr;
+  IREE_RETURN_IF_ERROR(iree_allocator_malloc(iree_allocator_system(), size,
+                                             (void **)&archive));
+  std::memcpy(archive, data, size);
+
+  iree_status_t status = iree_vm_bytecode_module_create(
+      instance, iree_make_const_byte_span(archive, size),
+      iree_allocator_system(), iree_allocator_system(), out_module);
+
+  if (!iree_status_is_ok(status)) {
+    iree_allocator_free(iree_allocator_system(), archive);
+  }
+
+  return status;
+}
+
 std::pair<iree_status_t,
           std::optional<std::vector<iree::runtime::IREETensor *>>>
 call(iree_vm_instance_t *instance, iree_hal_device_t *device,
      std::string driver_name, unsigned char *bytecode, size_t bytecode_size,
-     std::vector<iree::runtime::IREETensor *> exla_inputs) {
-  iree_vm_module_t *hal_module = nullptr;
+     std::vector<iree::runtime::IREETensor *> exla_inputs,
+     iree::runtime::CallStats *stats, nx_iree::quota::Request *quota) {
   iree_vm_module_t *bytecode_module = nullptr;
+  iree::runtime::CallStats local_stats;
+  if (!stats) stats = &local_stats;
+  PhaseTimer timer;
+
+  const iree_const_byte_span_t module_data =
+      iree_make_const_byte_span(bytecode, bytecode_size);
+
+  // The bytecode is owned by the caller and outlives this call,
+  // so the module doesn't need to free it.
+  RETURN_PAIR_IF_ERROR(iree_vm_bytecode_module_create(
+      instance, module_data, iree_allocator_null(), iree_allocator_system(),
+      &bytecode_module));
+  timer.lap(stats->module_create_ns, "module_create");
+
+  auto result =
+      call(instance, device, driver_name, bytecode_module, exla_inputs, stats,
+           quota);
+
+  iree_vm_module_release(bytecode_module);
+  return result;
+}
+
+std::pair<iree_status_t,
+          std::optional<std::vector<iree::runtime::IREETensor *>>>
+call(iree_vm_instance_t *instance, iree_hal_device_t *device,
+     std::string driver_name, iree_vm_module_t *bytecode_module,
+     std::vector<iree::runtime::IREETensor *> exla_inputs,
+     iree::runtime::CallStats *stats, nx_iree::quota::Request *quota) {
+  iree::runtime::CallStats local_stats;
+  if (!stats) stats = &local_stats;
+
+  PhaseTimer timer;
+
+  // Memory for the uploads and the outputs is reserved before anything is
+  // allocated and given back once the call returns, when the outputs hold
+  // their own charges instead
+  std::shared_ptr<nx_iree::quota::Charge> reservation;
+  if (quota) {
+    uint64_t bytes = quota->expected_output_bytes;
+    for (auto input : exla_inputs) {
+      if (!input->buffer_view) bytes += input->size;
+    }
+    RETURN_PAIR_IF_ERROR(nx_iree::quota::reserve(
+        device, quota->tenant, bytes, &reservation, &quota->denial));
+  }
+
+  iree_vm_module_t *hal_module = nullptr;
   iree_vm_context_t *context = nullptr;
   const char kMainFunctionName[] = "module.main";
   iree_vm_function_t main_function;
@@ -373,21 +774,18 @@ call(iree_vm_instance_t *instance, iree_hal_device_t *device,
   RETURN_PAIR_IF_ERROR(iree_hal_module_create(
       instance, /*device_count=*/1, &device, IREE_HAL_MODULE_FLAG_SYNCHRONOUS,
       iree_allocator_system(), &hal_module));
-
-  const iree_const_byte_span_t module_data =
-      iree_make_const_byte_span(bytecode, bytecode_size);
-
-  RETURN_PAIR_IF_ERROR(iree_vm_bytecode_module_create(
-      instance, module_data, iree_allocator_system(), iree_allocator_system(),
-      &bytecode_module));
   IREE_TRACE_ZONE_END(call_module_create);
+  timer.lap(stats->module_create_ns, "module_create");
 
   IREE_TRACE_ZONE_BEGIN(call_context_create);
   iree_vm_module_t *modules[] = {hal_module, bytecode_module};
-  RETURN_PAIR_IF_ERROR(iree_vm_context_create_with_modules(
+  iree_status_t context_status = iree_vm_context_create_with_modules(
       instance, IREE_VM_CONTEXT_FLAG_NONE, IREE_ARRAYSIZE(modules), &modules[0],
-      iree_allocator_system(), &context));
-  IREE_TRACE_ZONE_END(call_module_create);
+      iree_allocator_system(), &context);
+  // The context retains the modules it was created with.
+  iree_vm_module_release(hal_module);
+  RETURN_PAIR_IF_ERROR(context_status);
+  IREE_TRACE_ZONE_END(call_context_create);
 
   RETURN_PAIR_IF_ERROR(iree_vm_context_resolve_function(
       context, iree_make_cstring_view(kMainFunctionName), &main_function));
@@ -395,14 +793,18 @@ call(iree_vm_instance_t *instance, iree_hal_device_t *device,
   RETURN_PAIR_IF_ERROR(iree_vm_list_create(iree_vm_make_undefined_type_def(),
                                            exla_inputs.size(),
                                            iree_allocator_system(), &inputs));
+  timer.lap(stats->context_create_ns, "context_create");
 
   IREE_TRACE_ZONE_BEGIN(call_input_allocation);
   for (auto input : exla_inputs) {
     iree_vm_ref_t arg_buffer_view_ref;
 
     if (input->buffer_view) {
-      arg_buffer_view_ref = iree_hal_buffer_view_move_ref(input->buffer_view);
+      // The input keeps its own reference, so device-resident tensors can be
+      // passed to several calls without being copied.
+      arg_buffer_view_ref = iree_hal_buffer_view_retain_ref(input->buffer_view);
     } else {
+      nx_iree::tracing::Span upload_span("upload");
       iree_hal_buffer_view_t *arg_buffer_view = nullptr;
       RETURN_PAIR_IF_ERROR(iree_hal_buffer_view_allocate_buffer_copy(
           device, iree_hal_device_allocator(device), input->dims.size(),
@@ -413,6 +815,7 @@ call(iree_vm_instance_t *instance, iree_hal_device_t *device,
               .type = IREE_HAL_MEMORY_TYPE_DEVICE_LOCAL,
           },
           input->data_byte_span(), &arg_buffer_view));
+      stats->bytes_uploaded += input->size;
 
       arg_buffer_view_ref = iree_hal_buffer_view_move_ref(arg_buffer_view);
     }
@@ -420,6 +823,7 @@ call(iree_vm_instance_t *instance, iree_hal_device_t *device,
         iree_vm_list_push_ref_move(inputs, &arg_buffer_view_ref));
   }
   IREE_TRACE_ZONE_END(call_input_allocation);
+  timer.lap(stats->input_upload_ns, "input_upload");
 
   iree_vm_function_signature_t signature =
       iree_vm_function_signature(&main_function);
@@ -439,6 +843,9 @@ call(iree_vm_instance_t *instance, iree_hal_device_t *device,
       context, main_function, IREE_VM_INVOCATION_FLAG_NONE,
       /*policy=*/NULL, inputs, outputs, iree_allocator_system()));
   IREE_TRACE_ZONE_END(call_invoke);
+  timer.lap(stats->invoke_ns, "invoke");
+  iree_string_view_t function_name = iree_vm_function_name(&main_function);
+  stats->function.assign(function_name.data, function_name.size);
 
   IREE_TRACE_ZONE_BEGIN(call_outputs);
   std::vector<iree::runtime::IREETensor *> results;
@@ -466,9 +873,16 @@ call(iree_vm_instance_t *instance, iree_hal_device_t *device,
       tensor->dims.push_back(out_shape[j]);
     }
 
+    if (quota) {
+      tensor->charge =
+          nx_iree::quota::charge(device, quota->tenant, tensor->size);
+    }
+
     results[i] = tensor;
+    stats->bytes_output += iree_hal_buffer_view_byte_length(output_buffer_view);
   }
   IREE_TRACE_ZONE_END(call_outputs);
+  timer.lap(stats->outputs_ns, "outputs");
 
   iree_vm_list_release(inputs);
   iree_vm_list_release(outputs);
@@ -478,6 +892,52 @@ call(iree_vm_instance_t *instance, iree_hal_device_t *device,
   return {iree_ok_status(), results};
 }
 
+iree_status_t import_host_buffer(iree_hal_device_t *device, void *ptr,
+                                 std::vector<int64_t> dims,
+                                 iree_hal_element_type_t type,
+                                 iree_hal_buffer_release_callback_t release,
+                                 iree::runtime::IREETensor **out_tensor,
+                                 iree_hal_memory_access_t access) {
+  std::vector<iree_hal_dim_t> shape;
+  shape.reserve(dims.size());
+  iree_device_size_t size = iree_hal_element_dense_byte_count(type);
+  for (auto dim : dims) {
+    shape.push_back(static_cast<iree_hal_dim_t>(dim));
+    size *= static_cast<iree_device_size_t>(dim);
+  }
+
+  iree_hal_external_buffer_t external_buffer = {};
+  external_buffer.type = IREE_HAL_EXTERNAL_BUFFER_TYPE_HOST_ALLOCATION;
+  external_buffer.flags = IREE_HAL_EXTERNAL_BUFFER_FLAG_NONE;
+  external_buffer.size = size;
+  external_buffer.handle.host_allocation.ptr = ptr;
+
+  iree_hal_buffer_params_t params = {};
+  params.usage = IREE_HAL_BUFFER_USAGE_DEFAULT | IREE_HAL_BUFFER_USAGE_MAPPING |
+                 IREE_HAL_BUFFER_USAGE_MAPPING_PERSISTENT;
+  params.access = access;
+  params.type =
+      IREE_HAL_MEMORY_TYPE_HOST_LOCAL | IREE_HAL_MEMORY_TYPE_DEVICE_VISIBLE;
+
+  iree_hal_buffer_t *buffer = nullptr;
+  IREE_RETURN_IF_ERROR(iree_hal_allocator_import_buffer(
+      iree_hal_device_allocator(device), params, &external_buffer, release,
+      &buffer));
+
+  iree_hal_buffer_view_t *buffer_view = nullptr;
+  iree_status_t status = iree_hal_buffer_view_create(
+      buffer, shape.size(), shape.data(), type,
+      IREE_HAL_ENCODING_TYPE_DENSE_ROW_MAJOR, iree_allocator_system(),
+      &buffer_view);
+  // The buffer view retains the buffer, which invokes `release` once the
+  // last reference is gone.
+  iree_hal_buffer_release(buffer);
+  IREE_RETURN_IF_ERROR(status);
+
+  *out_tensor = new iree::runtime::IREETensor(buffer_view, type, device);
+  return iree_ok_status();
+}
+
 iree_status_t read_buffer(iree_hal_device_t *device,
                           iree_hal_buffer_view_t *buffer_view,
                           void *output_buffer, size_t num_bytes) {
@@ -502,6 +962,7 @@ iree_status_t read_buffer(iree_hal_device_t *device,
     cuda_symbols->cuCtxSetCurrent(ctx);
   });
 
+  nx_iree::tracing::Span span("download");
   iree_status_t status = iree_hal_device_transfer_d2h(
       device, buffer, 0, output_buffer, num_bytes_actual,
       IREE_HAL_TRANSFER_BUFFER_FLAG_DEFAULT, iree_infinite_timeout());
@@ -7,13 +7,22 @@
 #include <iree/vm/bytecode/module.h>
 
 #include <memory>
+#include <mutex>
 #include <optional>
+#include <string>
 #include <vector>
 
 #ifdef __EMSCRIPTEN__
 #include <emscripten/val.h>
 #endif
 
+namespace nx_iree {
+namespace quota {
+class Charge;
+struct Request;
+}  // namespace quota
+}  // namespace nx_iree
+
 namespace iree {
 namespace runtime {
 
@@ -42,14 +51,44 @@ class Device {
 
 class IREETensor {
  public:
+  // Where the contents of a tensor live, as reported by live_tensor_stats().
+  // Tensors holding a HAL buffer count as device-backed, even when the buffer imports host memory.
+  enum class Backing { kNone, kHost, kDevice };
+
+  // The memory held by a tensor, which can be released apart from the tensor itself.
+  // It keeps counting as live, and stays charged to its quotas, until it is released.
+  struct Contents {
+    void* data = nullptr;
+    iree_hal_buffer_view_t* buffer_view = nullptr;
+    iree_hal_buffer_mapping_t mapping = {};
+    bool mapped = false;
+    Backing backing = Backing::kNone;
+    size_t size = 0;
+    std::shared_ptr<nx_iree::quota::Charge> charge;
+
+    void release();
+  };
+
   void* data;
   size_t size;
   std::vector<iree_hal_dim_t> dims;
   iree_hal_element_type_t type;
   iree_hal_buffer_view_t* buffer_view;
   iree_hal_device_t* device;
-
+  // Persistent host mapping of buffer_view, created by host_pointer() and released on deallocate().
+  // Guarded by mapping_mutex, as several processes may ask for the pointer at once.
+  iree_hal_buffer_mapping_t mapping = {};
+  bool mapped = false;
+  std::mutex mapping_mutex;
+  Backing backing = Backing::kNone;
+  // Held against the memory quotas the tensor was allocated under, released on deallocate().
+  std::shared_ptr<nx_iree::quota::Charge> charge;
+
+  // Reads a tensor written by serialize(). Does not validate its input.
   IREETensor(char* serialized_data);
+  // Reads a tensor written by serialize(), checking every field against the
+  // `length` bytes available. On failure, the tensor is left empty.
+  IREETensor(const char* serialized_data, size_t length, iree_status_t* out_status);
   IREETensor(iree_hal_buffer_view_t* buffer_view, iree_hal_element_type_t type, iree_hal_device_t* device, bool copy_buffer = false);
   IREETensor(void* data, size_t size, std::vector<int64_t> in_dims, iree_hal_element_type_t type);
 
@@ -68,6 +107,18 @@ class IREETensor {
 
   void deallocate();
 
+  // Deallocates the tensor like deallocate(), but hands over its memory
+  // instead of releasing it, together with its live tensor count and charge.
+  Contents detach();
+
+  // Moves the tensor to the live tensor counters of the given backing.
+  void set_backing(Backing backing);
+
+  // Returns a host pointer to the tensor contents, mapping the device buffer if needed.
+  // Buffers which can't be mapped persistently, such as some call outputs, fail with
+  // FAILED_PRECONDITION. The pointer stays valid until the tensor is deallocated.
+  iree_status_t host_pointer(void** out_ptr);
+
   // Disable copy and move semantics for simplicity
   IREETensor(const IREETensor&) = delete;
   IREETensor& operator=(const IREETensor&) = delete;
@@ -79,21 +130,71 @@ class IREETensor {
   }
 
   // Serializes the tensor to a buffer that can be transmitted over the wire.
-  // Fields in order: type, rank, dims, data
-  std::vector<char>* serialize();
+  // Fields in order: encoding (u8), type, size, stored size (only when not
+  // raw), data, rank, dims. The encodings are those of tensor bundles, and
+  // data is only compressed when asked to and when it shrinks.
+  std::vector<char>* serialize(bool compress = false);
+};
+
+// Time spent in each phase of call(), in nanoseconds, and the bytes involved.
+// Collecting them only costs a few clock reads per call, so they are always on.
+struct CallStats {
+  uint64_t module_create_ns = 0;
+  uint64_t context_create_ns = 0;
+  uint64_t input_upload_ns = 0;
+  uint64_t invoke_ns = 0;
+  uint64_t outputs_ns = 0;
+  // Host inputs copied onto the device by the call
+  uint64_t bytes_uploaded = 0;
+  // Outputs, which are left on the device
+  uint64_t bytes_output = 0;
+  // The invoked function, as named by the runtime
+  std::string function;
+};
+
+// Counts and bytes of the tensors alive right now, split by backing, and the
+// most bytes each backing has held at once since the library was loaded.
+struct LiveTensorStats {
+  uint64_t host_count = 0;
+  uint64_t host_bytes = 0;
+  uint64_t host_peak_bytes = 0;
+  uint64_t device_count = 0;
+  uint64_t device_bytes = 0;
+  uint64_t device_peak_bytes = 0;
 };
 
 }  // namespace runtime
 }  // namespace iree
 
+iree::runtime::LiveTensorStats live_tensor_stats();
+
 iree_hal_element_type_t nx_type_to_iree_type(std::string type_string);
 
+// Returns the host CPU features known to IREE, formatted as LLVM target features (e.g. "+avx512f").
+std::vector<std::string> host_cpu_features();
+
 iree_vm_instance_t* create_instance();
 iree_hal_driver_registry_t* get_driver_registry();
 iree_hal_device_t* create_device(iree_hal_driver_registry_t* registry, const std::string& device_uri);
+iree_status_t create_device(iree_hal_driver_registry_t* registry, const std::string& device_uri, iree_hal_device_t** out_device);
 
+// Creates a bytecode module backed by a read-only memory mapping of the file at the given path.
+// The module archive starts at `offset` and spans `length` bytes, or up to the end of the file if `length` is negative.
+iree_status_t load_bytecode_module(iree_vm_instance_t* instance, std::string path, size_t offset, int64_t length, iree_vm_module_t** out_module);
+
+// Creates a bytecode module from a copy of the given bytes, owned by the module.
+iree_status_t create_bytecode_module(iree_vm_instance_t* instance, const uint8_t* data, size_t size, iree_vm_module_t** out_module);
+
+// Wraps host memory owned by someone else as a device buffer, without copying.
+// `release` is invoked once the buffer is destroyed, so the caller can keep the memory alive until then.
+iree_status_t import_host_buffer(iree_hal_device_t* device, void* ptr, std::vector<int64_t> dims, iree_hal_element_type_t type, iree_hal_buffer_release_callback_t release, iree::runtime::IREETensor** out_tensor, iree_hal_memory_access_t access = IREE_HAL_MEMORY_ACCESS_ALL);
+
+std::pair<iree_status_t, std::optional<std::vector<iree::runtime::IREETensor*>>>
+call(iree_vm_instance_t* i, iree_hal_device_t*, std::string, unsigned char*, size_t, std::vector<iree::runtime::IREETensor*>, iree::runtime::CallStats* stats = nullptr, nx_iree::quota::Request* quota = nullptr);
+// When `quota` is given, the call first reserves memory for its uploads and expected outputs,
+// failing right away if it doesn't fit, and its outputs are charged to the quotas of the device and tenant.
 std::pair<iree_status_t, std::optional<std::vector<iree::runtime::IREETensor*>>>
-call(iree_vm_instance_t* i, iree_hal_device_t*, std::string, unsigned char*, size_t, std::vector<iree::runtime::IREETensor*>);
+call(iree_vm_instance_t* i, iree_hal_device_t*, std::string, iree_vm_module_t*, std::vector<iree::runtime::IREETensor*>, iree::runtime::CallStats* stats = nullptr, nx_iree::quota::Request* quota = nullptr);
 
 iree_status_t read_buffer(iree_hal_device_t* device, iree_hal_buffer_view_t* buffer_view, void* output_buffer, size_t num_bytes);
 std::string get_status_message(iree_status_t status);
@@ -103,5 +204,8 @@ iree_status_t register_all_drivers(iree_hal_driver_registry_t*);
 std::pair<iree_status_t, std::vector<iree::runtime::Driver*>> list_drivers(iree_hal_driver_registry_t*);
 iree_status_t list_devices(iree_hal_driver_registry_t*, std::vector<iree::runtime::Device*>&);
 iree_status_t list_devices(iree_hal_driver_registry_t*, std::string driver_name, std::vector<iree::runtime::Device*>&);
+// Like list_devices(), but only fills in the driver name, URI and id of each device,
+// leaving `ref` null. Devices can then be created on demand through create_device().
+iree_status_t query_devices(iree_hal_driver_registry_t*, std::string driver_name, std::vector<iree::runtime::Device*>&);
 
 bool is_ok(iree_status_t status);
\ No newline at end of file
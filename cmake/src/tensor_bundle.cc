@@ -0,0 +1,518 @@
+#include "tensor_bundle.h"
+
+#include <iree/base/internal/file_io.h>
+
+#include "codec.h"
+
+#include <array>
+#include <cstring>
+
+namespace nx_iree {
+namespace tensor_bundle {
+
+namespace {
+
+constexpr size_t kEntrySize = 40;
+constexpr uint32_t kMaxRank = 64;
+constexpr size_t kTableChecksumOffset = 24;
+
+void put_u16(uint8_t* out, uint16_t value) {
+  for (int i = 0; i < 2; i++) out[i] = static_cast<uint8_t>(value >> (8 * i));
+}
+
+void put_u32(uint8_t* out, uint32_t value) {
+  for (int i = 0; i < 4; i++) out[i] = static_cast<uint8_t>(value >> (8 * i));
+}
+
+void put_u64(uint8_t* out, uint64_t value) {
+  for (int i = 0; i < 8; i++) out[i] = static_cast<uint8_t>(value >> (8 * i));
+}
+
+uint16_t get_u16(const uint8_t* in) {
+  return static_cast<uint16_t>(in[0] | (in[1] << 8));
+}
+
+uint32_t get_u32(const uint8_t* in) {
+  uint32_t value = 0;
+  for (int i = 3; i >= 0; i--) value = (value << 8) | in[i];
+  return value;
+}
+
+uint64_t get_u64(const uint8_t* in) {
+  uint64_t value = 0;
+  for (int i = 7; i >= 0; i--) value = (value << 8) | in[i];
+  return value;
+}
+
+size_t align(size_t offset) {
+  return (offset + kAlignment - 1) & ~(kAlignment - 1);
+}
+
+struct Layout {
+  size_t table_size;
+  std::vector<size_t> offsets;
+  size_t total_size;
+};
+
+bool is_encoded(const EncodedPayloads* encoded, size_t i) {
+  return encoded && encoded->encodings[i] != kEncodingRaw;
+}
+
+Layout compute_layout(const std::vector<iree::runtime::IREETensor*>& tensors,
+                      const EncodedPayloads* encoded) {
+  Layout layout;
+  layout.table_size = 0;
+
+  for (auto tensor : tensors) {
+    layout.table_size += kEntrySize + 8 * tensor->dims.size();
+  }
+
+  size_t offset = align(kHeaderSize + layout.table_size);
+  layout.offsets.reserve(tensors.size());
+
+  for (size_t i = 0; i < tensors.size(); i++) {
+    layout.offsets.push_back(offset);
+    size_t stored_size =
+        is_encoded(encoded, i) ? encoded->data[i].size() : tensors[i]->size;
+    offset = align(offset + stored_size);
+  }
+
+  layout.total_size = offset;
+  return layout;
+}
+
+// Keeps the owner of wrapped memory alive until the buffer is destroyed
+void release_owner(void* user_data, iree_hal_buffer_t* buffer) {
+  delete reinterpret_cast<std::shared_ptr<void>*>(user_data);
+}
+
+iree_status_t wrap_or_copy_payload(iree_hal_device_t* device,
+                                   const uint8_t* payload, size_t size,
+                                   std::vector<int64_t>& dims,
+                                   iree_hal_element_type_t type,
+                                   const std::shared_ptr<void>& owner,
+                                   iree::runtime::IREETensor** out_tensor) {
+  if (owner && reinterpret_cast<uintptr_t>(payload) % kAlignment == 0) {
+    auto owner_ref = new std::shared_ptr<void>(owner);
+    iree_hal_buffer_release_callback_t release = {release_owner, owner_ref};
+
+    iree_status_t status = import_host_buffer(
+        device, const_cast<uint8_t*>(payload), dims, type, release, out_tensor,
+        IREE_HAL_MEMORY_ACCESS_READ);
+
+    if (iree_status_is_ok(status)) {
+      // The payload stays in the host memory of the bundle
+      (*out_tensor)->set_backing(iree::runtime::IREETensor::Backing::kHost);
+      return status;
+    }
+
+    // Devices which can't use host memory get a copy instead
+    delete owner_ref;
+    iree_status_ignore(status);
+  }
+
+  std::vector<iree_hal_dim_t> shape(dims.begin(), dims.end());
+  iree_hal_buffer_params_t params = {};
+  // Lets NxIREE.Backend.to_pointer/2 map the buffer where the device allows
+  params.usage = IREE_HAL_BUFFER_USAGE_DEFAULT |
+                 IREE_HAL_BUFFER_USAGE_MAPPING_PERSISTENT |
+                 IREE_HAL_BUFFER_USAGE_MAPPING_OPTIONAL;
+  params.type = IREE_HAL_MEMORY_TYPE_DEVICE_LOCAL;
+
+  iree_hal_buffer_view_t* buffer_view = nullptr;
+  IREE_RETURN_IF_ERROR(iree_hal_buffer_view_allocate_buffer_copy(
+      device, iree_hal_device_allocator(device), shape.size(), shape.data(),
+      type, IREE_HAL_ENCODING_TYPE_DENSE_ROW_MAJOR, params,
+      iree_make_const_byte_span(payload, size), &buffer_view));
+
+  *out_tensor = new iree::runtime::IREETensor(buffer_view, type, device);
+  return iree_ok_status();
+}
+
+size_t shuffle_element_size(iree_hal_element_type_t type) {
+  if (iree_hal_element_numerical_type_is_float(type) ||
+      iree_hal_element_numerical_type_is_complex_float(type)) {
+    return iree_hal_element_dense_byte_count(type);
+  }
+  return 1;
+}
+
+// Decodes into a host-visible device buffer when the device has one,
+// and through a host copy otherwise
+iree_status_t decode_payload(iree_hal_device_t* device, const uint8_t* stored,
+                             size_t stored_size, uint32_t encoding,
+                             size_t size, std::vector<int64_t>& dims,
+                             iree_hal_element_type_t type,
+                             iree::runtime::IREETensor** out_tensor) {
+  std::vector<iree_hal_dim_t> shape(dims.begin(), dims.end());
+
+  iree_hal_buffer_params_t params = {};
+  params.usage = IREE_HAL_BUFFER_USAGE_DEFAULT |
+                 IREE_HAL_BUFFER_USAGE_MAPPING_SCOPED |
+                 IREE_HAL_BUFFER_USAGE_MAPPING_PERSISTENT;
+  params.type =
+      IREE_HAL_MEMORY_TYPE_DEVICE_LOCAL | IREE_HAL_MEMORY_TYPE_HOST_VISIBLE;
+
+  iree_hal_buffer_t* buffer = nullptr;
+  iree_status_t status = iree_hal_allocator_allocate_buffer(
+      iree_hal_device_allocator(device), params, size, &buffer);
+
+  if (iree_status_is_ok(status)) {
+    iree_hal_buffer_mapping_t mapping;
+    status = iree_hal_buffer_map_range(
+        buffer, IREE_HAL_MAPPING_MODE_SCOPED,
+        IREE_HAL_MEMORY_ACCESS_DISCARD_WRITE, 0, size, &mapping);
+
+    if (iree_status_is_ok(status)) {
+      iree_status_t decode_status = decode(stored, stored_size, encoding, type,
+                                           mapping.contents.data, size);
+      status = iree_hal_buffer_unmap_range(&mapping);
+      if (!iree_status_is_ok(decode_status)) {
+        iree_status_ignore(status);
+        iree_hal_buffer_release(buffer);
+        return decode_status;
+      }
+    }
+
+    iree_hal_buffer_view_t* buffer_view = nullptr;
+    if (iree_status_is_ok(status)) {
+      status = iree_hal_buffer_view_create(
+          buffer, shape.size(), shape.data(), type,
+          IREE_HAL_ENCODING_TYPE_DENSE_ROW_MAJOR, iree_allocator_system(),
+          &buffer_view);
+    }
+    iree_hal_buffer_release(buffer);
+
+    if (iree_status_is_ok(status)) {
+      *out_tensor = new iree::runtime::IREETensor(buffer_view, type, device);
+      return status;
+    }
+  }
+
+  iree_status_ignore(status);
+
+  std::vector<uint8_t> decoded(size);
+  IREE_RETURN_IF_ERROR(
+      decode(stored, stored_size, encoding, type, decoded.data(), size));
+
+  return wrap_or_copy_payload(device, decoded.data(), size, dims, type,
+                              nullptr, out_tensor);
+}
+
+}  // namespace
+
+iree_status_t decode(const uint8_t* stored, size_t stored_size,
+                     uint32_t encoding, iree_hal_element_type_t type,
+                     uint8_t* out, size_t size) {
+  bool ok;
+
+  if (encoding == kEncodingLz4) {
+    ok = codec::lz4_decompress(stored, stored_size, out, size);
+  } else {
+    std::vector<uint8_t> shuffled(size);
+    ok = codec::lz4_decompress(stored, stored_size, shuffled.data(), size);
+    if (ok) {
+      codec::unshuffle(shuffled.data(), size, shuffle_element_size(type), out);
+    }
+  }
+
+  if (!ok) {
+    return iree_make_status(IREE_STATUS_DATA_LOSS,
+                            "malformed compressed payload");
+  }
+  return iree_ok_status();
+}
+
+uint32_t crc32(const uint8_t* data, size_t size, uint32_t crc) {
+  static const std::array<uint32_t, 256> table = [] {
+    std::array<uint32_t, 256> table;
+    for (uint32_t i = 0; i < 256; i++) {
+      uint32_t value = i;
+      for (int bit = 0; bit < 8; bit++) {
+        value = (value & 1) ? 0xEDB88320u ^ (value >> 1) : value >> 1;
+      }
+      table[i] = value;
+    }
+    return table;
+  }();
+
+  crc = ~crc;
+  for (size_t i = 0; i < size; i++) {
+    crc = table[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+  }
+  return ~crc;
+}
+
+iree_status_t compress(const std::vector<iree::runtime::IREETensor*>& tensors,
+                       EncodedPayloads& out) {
+  out.encodings.assign(tensors.size(), kEncodingRaw);
+  out.data.assign(tensors.size(), {});
+
+  std::vector<uint8_t> contents;
+  std::vector<uint8_t> shuffled;
+
+  for (size_t i = 0; i < tensors.size(); i++) {
+    auto tensor = tensors[i];
+    const uint8_t* source;
+
+    // Host contents are used as they are, device ones are read back first
+    if (tensor->data) {
+      source = static_cast<const uint8_t*>(tensor->data);
+    } else if (tensor->buffer_view) {
+      contents.resize(tensor->size);
+      IREE_RETURN_IF_ERROR(read_buffer(tensor->device, tensor->buffer_view,
+                                       contents.data(), tensor->size));
+      source = contents.data();
+    } else {
+      return iree_make_status(IREE_STATUS_FAILED_PRECONDITION,
+                              "tensor %zu has been deallocated", i);
+    }
+
+    uint32_t encoding = kEncodingLz4;
+    size_t element_size = shuffle_element_size(tensor->type);
+
+    if (element_size > 1) {
+      shuffled.resize(tensor->size);
+      codec::shuffle(source, tensor->size, element_size, shuffled.data());
+      source = shuffled.data();
+      encoding = kEncodingShuffleLz4;
+    }
+
+    std::vector<uint8_t> compressed(codec::lz4_compress_bound(tensor->size));
+    size_t compressed_size = codec::lz4_compress(
+        source, tensor->size, compressed.data(), compressed.size());
+
+    if (compressed_size > 0 && compressed_size < tensor->size) {
+      compressed.resize(compressed_size);
+      out.encodings[i] = encoding;
+      out.data[i] = std::move(compressed);
+    }
+  }
+
+  return iree_ok_status();
+}
+
+size_t serialized_size(const std::vector<iree::runtime::IREETensor*>& tensors,
+                       const EncodedPayloads* encoded) {
+  return compute_layout(tensors, encoded).total_size;
+}
+
+iree_status_t serialize(const std::vector<iree::runtime::IREETensor*>& tensors,
+                        uint8_t* out, size_t size,
+                        const EncodedPayloads* encoded) {
+  Layout layout = compute_layout(tensors, encoded);
+  uint16_t flags = 0;
+
+  if (size < layout.total_size) {
+    return iree_make_status(IREE_STATUS_OUT_OF_RANGE,
+                            "bundle needs %zu bytes, got %zu",
+                            layout.total_size, size);
+  }
+
+  std::memset(out, 0, layout.offsets.empty() ? layout.total_size
+                                             : layout.offsets[0]);
+
+  uint8_t* entry = out + kHeaderSize;
+
+  for (size_t i = 0; i < tensors.size(); i++) {
+    auto tensor = tensors[i];
+    uint8_t* payload = out + layout.offsets[i];
+    uint32_t encoding = kEncodingRaw;
+    size_t stored_size = tensor->size;
+
+    if (is_encoded(encoded, i)) {
+      encoding = encoded->encodings[i];
+      stored_size = encoded->data[i].size();
+      std::memcpy(payload, encoded->data[i].data(), stored_size);
+      flags |= kFlagEncoded;
+    } else if (tensor->buffer_view) {
+      IREE_RETURN_IF_ERROR(read_buffer(tensor->device, tensor->buffer_view,
+                                       payload, tensor->size));
+    } else if (tensor->data) {
+      std::memcpy(payload, tensor->data, tensor->size);
+    } else {
+      return iree_make_status(IREE_STATUS_FAILED_PRECONDITION,
+                              "tensor %zu has been deallocated", i);
+    }
+
+    size_t end = layout.offsets[i] + stored_size;
+    size_t next = i + 1 < tensors.size() ? layout.offsets[i + 1]
+                                         : layout.total_size;
+    std::memset(out + end, 0, next - end);
+
+    put_u32(entry, tensor->type);
+    put_u32(entry + 4, tensor->dims.size());
+    put_u64(entry + 8, layout.offsets[i]);
+    put_u64(entry + 16, tensor->size);
+    put_u64(entry + 24, stored_size);
+    put_u32(entry + 32, crc32(payload, stored_size));
+    put_u32(entry + 36, encoding);
+    for (size_t d = 0; d < tensor->dims.size(); d++) {
+      put_u64(entry + kEntrySize + 8 * d, tensor->dims[d]);
+    }
+    entry += kEntrySize + 8 * tensor->dims.size();
+  }
+
+  std::memcpy(out, kMagic, sizeof(kMagic));
+  put_u16(out + 4, kVersion);
+  put_u16(out + 6, flags);
+  put_u32(out + 8, tensors.size());
+  put_u32(out + 12, layout.table_size);
+  put_u64(out + 16, layout.total_size);
+  put_u32(out + kTableChecksumOffset,
+          crc32(out, kHeaderSize + layout.table_size));
+
+  return iree_ok_status();
+}
+
+iree_status_t deserialize(iree_hal_device_t* device, const uint8_t* data,
+                          size_t size, std::shared_ptr<void> owner,
+                          std::vector<iree::runtime::IREETensor*>& out_tensors) {
+  if (size < kHeaderSize || std::memcmp(data, kMagic, sizeof(kMagic)) != 0) {
+    return iree_make_status(IREE_STATUS_INVALID_ARGUMENT,
+                            "not a tensor bundle");
+  }
+
+  uint16_t version = get_u16(data + 4);
+  uint16_t flags = get_u16(data + 6);
+  uint32_t count = get_u32(data + 8);
+  uint64_t table_size = get_u32(data + 12);
+  uint64_t total_size = get_u64(data + 16);
+
+  if (version != kVersion) {
+    return iree_make_status(IREE_STATUS_UNIMPLEMENTED,
+                            "unsupported tensor bundle version %u", version);
+  }
+  if ((flags & ~kFlagEncoded) != 0) {
+    return iree_make_status(IREE_STATUS_UNIMPLEMENTED,
+                            "unsupported tensor bundle flags 0x%x", flags);
+  }
+  if (total_size < kHeaderSize || total_size > size ||
+      table_size > total_size - kHeaderSize) {
+    return iree_make_status(IREE_STATUS_OUT_OF_RANGE,
+                            "tensor bundle is truncated");
+  }
+
+  uint8_t header[kHeaderSize];
+  std::memcpy(header, data, kHeaderSize);
+  put_u32(header + kTableChecksumOffset, 0);
+  uint32_t checksum = crc32(header, kHeaderSize);
+  checksum = crc32(data + kHeaderSize, table_size, checksum);
+
+  if (checksum != get_u32(data + kTableChecksumOffset)) {
+    return iree_make_status(IREE_STATUS_DATA_LOSS,
+                            "tensor bundle header checksum mismatch");
+  }
+
+  const uint8_t* entry = data + kHeaderSize;
+  const uint8_t* table_end = entry + table_size;
+  uint64_t payloads_start = kHeaderSize + table_size;
+
+  std::vector<iree::runtime::IREETensor*> tensors;
+  iree_status_t status = iree_ok_status();
+
+  for (uint32_t i = 0; i < count && iree_status_is_ok(status); i++) {
+    if (static_cast<size_t>(table_end - entry) < kEntrySize) {
+      status = iree_make_status(IREE_STATUS_OUT_OF_RANGE,
+                                "tensor bundle table is truncated");
+      break;
+    }
+
+    auto type = static_cast<iree_hal_element_type_t>(get_u32(entry));
+    uint32_t rank = get_u32(entry + 4);
+    uint64_t offset = get_u64(entry + 8);
+    uint64_t payload_size = get_u64(entry + 16);
+    uint64_t stored_size = get_u64(entry + 24);
+    uint32_t payload_checksum = get_u32(entry + 32);
+    uint32_t encoding = get_u32(entry + 36);
+
+    if (rank > kMaxRank ||
+        static_cast<size_t>(table_end - entry) < kEntrySize + 8 * rank) {
+      status = iree_make_status(IREE_STATUS_OUT_OF_RANGE,
+                                "tensor %u has an invalid rank %u", i, rank);
+      break;
+    }
+
+    uint64_t element_size = iree_hal_element_dense_byte_count(type);
+    if (element_size == 0) {
+      status = iree_make_status(IREE_STATUS_INVALID_ARGUMENT,
+                                "tensor %u has an invalid element type", i);
+      break;
+    }
+
+    // The element count must match the payload size, without overflowing
+    uint64_t expected_size = element_size;
+    std::vector<int64_t> dims(rank);
+    for (uint32_t d = 0; d < rank; d++) {
+      dims[d] = static_cast<int64_t>(get_u64(entry + kEntrySize + 8 * d));
+      if (dims[d] < 0 ||
+          (dims[d] > 0 && expected_size > UINT64_MAX / dims[d])) {
+        expected_size = UINT64_MAX;
+        break;
+      }
+      expected_size *= dims[d];
+    }
+    entry += kEntrySize + 8 * rank;
+
+    if (expected_size != payload_size) {
+      status = iree_make_status(IREE_STATUS_INVALID_ARGUMENT,
+                                "tensor %u size does not match its shape", i);
+    } else if (encoding > kEncodingShuffleLz4 ||
+               (encoding != kEncodingRaw && !(flags & kFlagEncoded))) {
+      status = iree_make_status(IREE_STATUS_UNIMPLEMENTED,
+                                "tensor %u has an unsupported encoding %u", i,
+                                encoding);
+    } else if (encoding == kEncodingRaw && stored_size != payload_size) {
+      status = iree_make_status(IREE_STATUS_INVALID_ARGUMENT,
+                                "tensor %u size does not match its shape", i);
+    } else if (offset < payloads_start || offset % kAlignment != 0 ||
+               offset > total_size || stored_size > total_size - offset) {
+      status = iree_make_status(IREE_STATUS_OUT_OF_RANGE,
+                                "tensor %u payload is out of bounds", i);
+    } else if (crc32(data + offset, stored_size) != payload_checksum) {
+      status = iree_make_status(IREE_STATUS_DATA_LOSS,
+                                "tensor %u checksum mismatch", i);
+    } else {
+      iree::runtime::IREETensor* tensor = nullptr;
+      if (encoding == kEncodingRaw) {
+        status = wrap_or_copy_payload(device, data + offset, payload_size,
+                                      dims, type, owner, &tensor);
+      } else {
+        status = decode_payload(device, data + offset, stored_size, encoding,
+                                payload_size, dims, type, &tensor);
+      }
+      if (iree_status_is_ok(status)) {
+        tensors.push_back(tensor);
+      }
+    }
+  }
+
+  if (!iree_status_is_ok(status)) {
+    for (auto tensor : tensors) {
+      delete tensor;
+    }
+    return status;
+  }
+
+  out_tensors = std::move(tensors);
+  return iree_ok_status();
+}
+
+iree_status_t deserialize_file(
+    iree_hal_device_t* device, const std::string& path,
+    std::vector<iree::runtime::IREETensor*>& out_tensors) {
+  iree_file_contents_t* contents = nullptr;
+  IREE_RETURN_IF_ERROR(iree_file_read_contents(
+      path.c_str(), IREE_FILE_READ_FLAG_MMAP, iree_allocator_system(),
+      &contents));
+
+  std::shared_ptr<void> owner(contents, [](void* contents) {
+    iree_file_contents_free(reinterpret_cast<iree_file_contents_t*>(contents));
+  });
+
+  return deserialize(device, contents->const_buffer.data,
+                     contents->const_buffer.data_length, owner, out_tensors);
+}
+
+}  // namespace tensor_bundle
+}  // namespace nx_iree
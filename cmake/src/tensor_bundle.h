@@ -0,0 +1,84 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "runtime.h"
+
+// A container holding many tensors at once.
+//
+// Layout, all integers little-endian:
+//
+//   header (64 bytes)
+//     magic "NXTB", version (u16), flags (u16), tensor count (u32),
+//     table size in bytes (u32), total size in bytes (u64),
+//     table checksum (u32), zero padding
+//   table, one variable-sized entry per tensor
+//     element type (u32), rank (u32), payload offset (u64),
+//     payload size (u64), stored size (u64), payload checksum (u32),
+//     encoding (u32), dims (i64 * rank)
+//   payloads, each starting at a multiple of 64 bytes from the start
+//
+// Checksums are CRC32 (IEEE). The table checksum covers the header, with the
+// checksum field zeroed, and the table. Payload checksums cover the stored
+// bytes. Payloads at 64-byte aligned addresses can be used in place.
+//
+// Payloads are stored raw unless the kFlagEncoded header flag is set, in
+// which case each entry may use one of the other encodings, so readers
+// which don't know about them reject the bundle up front.
+namespace nx_iree {
+namespace tensor_bundle {
+
+constexpr char kMagic[4] = {'N', 'X', 'T', 'B'};
+constexpr uint16_t kVersion = 1;
+constexpr size_t kHeaderSize = 64;
+constexpr size_t kAlignment = 64;
+
+constexpr uint16_t kFlagEncoded = 1;
+
+constexpr uint32_t kEncodingRaw = 0;
+constexpr uint32_t kEncodingLz4 = 1;
+// Bytes are grouped by their position within each element before LZ4
+constexpr uint32_t kEncodingShuffleLz4 = 2;
+
+// Payloads encoded before the bundle is laid out, one per tensor.
+// Payloads which are stored raw have no data.
+struct EncodedPayloads {
+  std::vector<uint32_t> encodings;
+  std::vector<std::vector<uint8_t>> data;
+};
+
+uint32_t crc32(const uint8_t* data, size_t size, uint32_t crc = 0);
+
+// Compresses the tensor payloads with LZ4, byte-shuffling floating-point ones
+// first. Payloads which don't shrink are kept raw.
+iree_status_t compress(const std::vector<iree::runtime::IREETensor*>& tensors, EncodedPayloads& out);
+
+// Decodes a payload stored with the given encoding into the `size` bytes at
+// `out`. Fails if the payload is malformed.
+iree_status_t decode(const uint8_t* stored, size_t stored_size, uint32_t encoding, iree_hal_element_type_t type, uint8_t* out, size_t size);
+
+// Returns the size of the bundle holding the given tensors.
+size_t serialized_size(const std::vector<iree::runtime::IREETensor*>& tensors, const EncodedPayloads* encoded = nullptr);
+
+// Writes the tensors into `out`, which must hold serialized_size() bytes.
+// Raw device tensors are read straight into `out`.
+iree_status_t serialize(const std::vector<iree::runtime::IREETensor*>& tensors, uint8_t* out, size_t size, const EncodedPayloads* encoded = nullptr);
+
+// Reads the tensors of the bundle into buffers of `device`.
+//
+// When a raw payload is suitably aligned and the device can use host memory,
+// the buffer wraps the payload in place and holds a reference to `owner`,
+// which must keep `data` alive. Otherwise, and always when `owner` is null,
+// the payload is copied. Wrapped payloads count as host-backed tensors. Encoded
+// payloads are decoded straight into host-visible device buffers.
+iree_status_t deserialize(iree_hal_device_t* device, const uint8_t* data, size_t size, std::shared_ptr<void> owner, std::vector<iree::runtime::IREETensor*>& out_tensors);
+
+// Memory-maps the bundle at `path` and deserializes it. The mapping stays
+// alive for as long as any tensor wrapping it.
+iree_status_t deserialize_file(iree_hal_device_t* device, const std::string& path, std::vector<iree::runtime::IREETensor*>& out_tensors);
+
+}  // namespace tensor_bundle
+}  // namespace nx_iree
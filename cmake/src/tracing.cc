@@ -0,0 +1,182 @@
+#include "tracing.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#ifdef _WIN32
+#include <process.h>
+#define getpid _getpid
+#else
+#include <unistd.h>
+#endif
+
+namespace nx_iree {
+namespace tracing {
+
+namespace detail {
+std::atomic<bool> enabled{false};
+}
+
+namespace {
+
+// Each slot is guarded by a sequence number, odd while the slot is being
+// written, so readers can detect and skip spans overwritten under them.
+struct Slot {
+  std::atomic<uint64_t> sequence{0};
+  std::atomic<const char*> name{nullptr};
+  std::atomic<uint64_t> start_ns{0};
+  std::atomic<uint64_t> end_ns{0};
+  std::atomic<uint32_t> thread_id{0};
+};
+
+struct Ring {
+  explicit Ring(size_t capacity) : capacity(capacity), slots(new Slot[capacity]) {}
+
+  size_t capacity;
+  std::unique_ptr<Slot[]> slots;
+  std::atomic<uint64_t> head{0};
+  // Spans before this index belong to a previous enable() and are skipped
+  std::atomic<uint64_t> start{0};
+};
+
+std::atomic<Ring*> current_ring{nullptr};
+
+// Writers may still hold a replaced ring, so rings are never freed. Instead,
+// enable() reuses a ring of the same capacity, so only one ring is kept per
+// capacity ever asked for.
+std::mutex retired_mutex;
+std::vector<std::unique_ptr<Ring>> retired_rings;
+
+std::atomic<uint32_t> next_thread_id{1};
+
+uint32_t current_thread_id() {
+  thread_local uint32_t thread_id = next_thread_id.fetch_add(1, std::memory_order_relaxed);
+  return thread_id;
+}
+
+void append_json_string(std::string& out, const char* value) {
+  out += '"';
+  for (const char* c = value; *c; c++) {
+    if (*c == '"' || *c == '\\') {
+      out += '\\';
+      out += *c;
+    } else if (static_cast<unsigned char>(*c) < 0x20) {
+      char escaped[8];
+      std::snprintf(escaped, sizeof(escaped), "\\u%04x", static_cast<unsigned char>(*c));
+      out += escaped;
+    } else {
+      out += *c;
+    }
+  }
+  out += '"';
+}
+
+}  // namespace
+
+void enable(size_t capacity) {
+  std::lock_guard<std::mutex> lock(retired_mutex);
+  capacity = capacity > 0 ? capacity : 1;
+
+  Ring* ring = current_ring.load(std::memory_order_acquire);
+
+  if (!ring || ring->capacity != capacity) {
+    auto reusable = std::find_if(
+        retired_rings.begin(), retired_rings.end(),
+        [capacity](const std::unique_ptr<Ring>& retired) { return retired->capacity == capacity; });
+
+    if (reusable != retired_rings.end()) {
+      ring = reusable->release();
+      retired_rings.erase(reusable);
+    } else {
+      ring = new Ring(capacity);
+    }
+
+    Ring* previous = current_ring.exchange(ring, std::memory_order_acq_rel);
+    if (previous) {
+      retired_rings.emplace_back(previous);
+    }
+  }
+
+  // Slot sequences are derived from the index, which keeps increasing, so
+  // spans left over from before can't pass for new ones
+  ring->start.store(ring->head.load(std::memory_order_acquire), std::memory_order_release);
+
+  detail::enabled.store(true, std::memory_order_release);
+}
+
+void disable() {
+  detail::enabled.store(false, std::memory_order_release);
+}
+
+uint64_t now_ns() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+void record(const char* name, uint64_t start_ns, uint64_t end_ns) {
+  Ring* ring = current_ring.load(std::memory_order_acquire);
+  if (!ring) return;
+
+  uint64_t index = ring->head.fetch_add(1, std::memory_order_relaxed);
+  Slot& slot = ring->slots[index % ring->capacity];
+
+  slot.sequence.store(2 * index + 1, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+
+  slot.name.store(name, std::memory_order_relaxed);
+  slot.start_ns.store(start_ns, std::memory_order_relaxed);
+  slot.end_ns.store(end_ns, std::memory_order_relaxed);
+  slot.thread_id.store(current_thread_id(), std::memory_order_relaxed);
+
+  slot.sequence.store(2 * index + 2, std::memory_order_release);
+}
+
+std::string export_chrome_trace() {
+  std::string out = "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[";
+  Ring* ring = current_ring.load(std::memory_order_acquire);
+
+  if (ring) {
+    uint64_t head = ring->head.load(std::memory_order_acquire);
+    uint64_t begin = head > ring->capacity ? head - ring->capacity : 0;
+    begin = std::max(begin, ring->start.load(std::memory_order_acquire));
+    int pid = getpid();
+    bool first = true;
+
+    for (uint64_t index = begin; index < head; index++) {
+      Slot& slot = ring->slots[index % ring->capacity];
+
+      uint64_t sequence = slot.sequence.load(std::memory_order_acquire);
+      if (sequence != 2 * index + 2) continue;
+
+      const char* name = slot.name.load(std::memory_order_relaxed);
+      uint64_t start_ns = slot.start_ns.load(std::memory_order_relaxed);
+      uint64_t end_ns = slot.end_ns.load(std::memory_order_relaxed);
+      uint32_t thread_id = slot.thread_id.load(std::memory_order_relaxed);
+
+      std::atomic_thread_fence(std::memory_order_acquire);
+      if (slot.sequence.load(std::memory_order_relaxed) != sequence) continue;
+
+      // Complete events, with timestamps in microseconds
+      char fields[160];
+      std::snprintf(fields, sizeof(fields),
+                    ",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":%d,\"tid\":%u}",
+                    start_ns / 1000.0, (end_ns - start_ns) / 1000.0, pid, thread_id);
+
+      out += first ? "{\"name\":" : ",{\"name\":";
+      append_json_string(out, name);
+      out += fields;
+      first = false;
+    }
+  }
+
+  out += "]}";
+  return out;
+}
+
+}  // namespace tracing
+}  // namespace nx_iree
@@ -0,0 +1,65 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// Lightweight tracing which can be switched on and off at runtime.
+//
+// Spans are recorded into a fixed-size ring buffer shared by all threads.
+// Recording is lock-free and never allocates, and the oldest spans are
+// overwritten once the buffer is full. While tracing is disabled, a span
+// costs a single relaxed atomic load.
+//
+// Span names must be string literals, or otherwise outlive the buffer.
+namespace nx_iree {
+namespace tracing {
+
+namespace detail {
+extern std::atomic<bool> enabled;
+}
+
+inline bool enabled() {
+  return detail::enabled.load(std::memory_order_relaxed);
+}
+
+// Starts recording spans into a buffer holding `capacity` spans.
+// Spans recorded before are discarded.
+void enable(size_t capacity);
+
+// Stops recording spans. Recorded spans are kept until the next enable().
+void disable();
+
+// Monotonic timestamp in nanoseconds, shared by all spans.
+uint64_t now_ns();
+
+// Records a span which ran from `start_ns` to `end_ns` on the calling thread.
+void record(const char* name, uint64_t start_ns, uint64_t end_ns);
+
+// Returns the recorded spans in the Chrome trace event format, which can be
+// opened with Perfetto or chrome://tracing.
+std::string export_chrome_trace();
+
+// Records a span from its construction until end() or its destruction.
+class Span {
+ public:
+  explicit Span(const char* name) : name_(enabled() ? name : nullptr), start_ns_(name_ ? now_ns() : 0) {}
+  ~Span() { end(); }
+
+  void end() {
+    if (name_) {
+      record(name_, start_ns_, now_ns());
+      name_ = nullptr;
+    }
+  }
+
+  Span(const Span&) = delete;
+  Span& operator=(const Span&) = delete;
+
+ private:
+  const char* name_;
+  uint64_t start_ns_;
+};
+
+}  // namespace tracing
+}  // namespace nx_iree
@@ -0,0 +1,215 @@
+// Tests the LZ4 block codec and the byte shuffle of serialized tensors.
+//
+// The reference vectors were produced by LZ4_compress_default() of liblz4
+// 1.9.4, so decoding them checks compatibility with the reference encoder.
+// Malformed blocks must be rejected without reading or writing out of bounds,
+// which is best checked by building with -fsanitize=address.
+//
+// Usage:
+//
+//   nx_iree_codec_test
+
+#include "codec.h"
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+namespace {
+
+using nx_iree::codec::lz4_compress;
+using nx_iree::codec::lz4_compress_bound;
+using nx_iree::codec::lz4_decompress;
+using nx_iree::codec::shuffle;
+using nx_iree::codec::unshuffle;
+
+int failures = 0;
+
+#define CHECK(condition)                                                  \
+  do {                                                                    \
+    if (!(condition)) {                                                   \
+      std::fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, \
+                   #condition);                                           \
+      failures++;                                                         \
+    }                                                                     \
+  } while (0)
+
+using Bytes = std::vector<uint8_t>;
+
+Bytes bytes(const std::string& text) { return Bytes(text.begin(), text.end()); }
+
+Bytes compress(const Bytes& src) {
+  Bytes dst(lz4_compress_bound(src.size()));
+  size_t size = lz4_compress(src.data(), src.size(), dst.data(), dst.size());
+  dst.resize(size);
+  return dst;
+}
+
+bool decompress(const Bytes& src, size_t size, Bytes& out) {
+  out.assign(size, 0);
+  return lz4_decompress(src.data(), src.size(), out.data(), out.size());
+}
+
+// Deterministic bytes which no LZ4 match can shorten
+Bytes noise(size_t size) {
+  Bytes data(size);
+  uint32_t state = 2463534242u;
+  for (auto& byte : data) {
+    state ^= state << 13;
+    state ^= state >> 17;
+    state ^= state << 5;
+    byte = static_cast<uint8_t>(state);
+  }
+  return data;
+}
+
+void test_reference_vectors() {
+  struct Vector {
+    Bytes decoded;
+    Bytes encoded;
+  };
+
+  std::string text;
+  for (int i = 0; i < 8; i++) text += "nx_iree ";
+
+  Vector vectors[] = {
+      // A literal run followed by an overlapping match
+      {bytes(text),
+       {0x8f, 0x6e, 0x78, 0x5f, 0x69, 0x72, 0x65, 0x65, 0x20, 0x08, 0x00,
+        0x20, 0x50, 0x69, 0x72, 0x65, 0x65, 0x20}},
+      // A match length continued over several bytes
+      {Bytes(300, 0),
+       {0x1f, 0x00, 0x01, 0x00, 0xff, 0x14, 0x50, 0x00, 0x00, 0x00, 0x00,
+        0x00}},
+      // A literal length continued over a second byte
+      {bytes("0123456789abcdefghij"),
+       {0xf0, 0x05, 0x30, 0x31, 0x32, 0x33, 0x34, 0x35, 0x36, 0x37, 0x38,
+        0x39, 0x61, 0x62, 0x63, 0x64, 0x65, 0x66, 0x67, 0x68, 0x69, 0x6a}},
+      // An empty block
+      {Bytes(), {0x00}},
+  };
+
+  for (auto& vector : vectors) {
+    Bytes out;
+    CHECK(decompress(vector.encoded, vector.decoded.size(), out));
+    CHECK(out == vector.decoded);
+
+    Bytes encoded = compress(vector.decoded);
+    CHECK(!encoded.empty());
+    CHECK(decompress(encoded, vector.decoded.size(), out));
+    CHECK(out == vector.decoded);
+  }
+}
+
+void test_round_trips() {
+  Bytes ramp(70000);
+  for (size_t i = 0; i < ramp.size(); i++) ramp[i] = static_cast<uint8_t>(i / 7);
+
+  // Longer than the largest offset, so matches must stay within the window
+  Bytes repeated;
+  Bytes block = noise(1000);
+  for (int i = 0; i < 80; i++) repeated.insert(repeated.end(), block.begin(), block.end());
+
+  for (size_t size : {size_t(1), size_t(12), size_t(13), size_t(64)}) {
+    Bytes zeros(size, 0), out;
+    Bytes encoded = compress(zeros);
+    CHECK(decompress(encoded, size, out));
+    CHECK(out == zeros);
+  }
+
+  for (auto* data : {&ramp, &repeated}) {
+    Bytes encoded = compress(*data), out;
+    CHECK(encoded.size() < data->size());
+    CHECK(decompress(encoded, data->size(), out));
+    CHECK(out == *data);
+  }
+}
+
+void test_incompressible() {
+  Bytes data = noise(65536), out;
+  Bytes encoded = compress(data);
+
+  CHECK(!encoded.empty());
+  CHECK(encoded.size() <= lz4_compress_bound(data.size()));
+  CHECK(decompress(encoded, data.size(), out));
+  CHECK(out == data);
+
+  // Doesn't fit when the destination is no larger than the input
+  Bytes small(data.size());
+  CHECK(lz4_compress(data.data(), data.size(), small.data(), small.size()) == 0);
+}
+
+void test_zero_length() {
+  Bytes encoded = compress(Bytes()), out;
+  CHECK(encoded == Bytes({0x00}));
+  CHECK(decompress(encoded, 0, out));
+
+  // No input at all decodes to nothing
+  CHECK(lz4_decompress(nullptr, 0, nullptr, 0));
+  CHECK(!decompress(Bytes(), 1, out));
+}
+
+void test_malformed() {
+  Bytes out;
+
+  // Five literals announced, two given
+  CHECK(!decompress({0x50, 'a', 'b'}, 5, out));
+  // A literal length continuation which is cut off
+  CHECK(!decompress({0xf0, 0xff}, 300, out));
+  // An offset which points before the start of the output
+  CHECK(!decompress({0x10, 'a', 0x02, 0x00, 0x00}, 6, out));
+  // An offset of zero
+  CHECK(!decompress({0x10, 'a', 0x00, 0x00, 0x00}, 6, out));
+  // An offset which is cut off
+  CHECK(!decompress({0x10, 'a', 0x01}, 6, out));
+  // A match length continuation which is cut off
+  CHECK(!decompress({0x1f, 'a', 0x01, 0x00, 0xff}, 300, out));
+  // Literals which overflow the output
+  CHECK(!decompress({0x50, 'a', 'b', 'c', 'd', 'e'}, 4, out));
+  // A match which overflows the output
+  CHECK(!decompress({0x1f, 'a', 0x01, 0x00, 0x10, 0x00}, 20, out));
+  // A block which decodes to fewer bytes than expected
+  CHECK(!decompress({0x20, 'a', 'b'}, 3, out));
+
+  // Truncating a valid block anywhere must fail cleanly
+  Bytes data = noise(512), encoded;
+  for (int i = 0; i < 4; i++) data.insert(data.end(), data.begin(), data.begin() + 512);
+  encoded = compress(data);
+  for (size_t size = 0; size < encoded.size(); size++) {
+    Bytes truncated(encoded.begin(), encoded.begin() + size);
+    CHECK(!decompress(truncated, data.size(), out));
+  }
+}
+
+void test_shuffle() {
+  // Nine bytes of four-byte elements leave one trailing byte as is
+  Bytes data = {1, 2, 3, 4, 5, 6, 7, 8, 9};
+  Bytes shuffled(data.size()), out(data.size());
+
+  shuffle(data.data(), data.size(), 4, shuffled.data());
+  CHECK(shuffled == Bytes({1, 5, 2, 6, 3, 7, 4, 8, 9}));
+
+  unshuffle(shuffled.data(), shuffled.size(), 4, out.data());
+  CHECK(out == data);
+}
+
+}  // namespace
+
+int main() {
+  test_reference_vectors();
+  test_round_trips();
+  test_incompressible();
+  test_zero_length();
+  test_malformed();
+  test_shuffle();
+
+  if (failures > 0) {
+    std::fprintf(stderr, "%d checks failed\n", failures);
+    return 1;
+  }
+
+  std::printf("all codec checks passed\n");
+  return 0;
+}
@@ -0,0 +1,389 @@
+defmodule Mix.Tasks.NxIree.Bench do
+  @moduledoc """
+  Measures compilation, calls and transfers end to end.
+
+  Benchmarks are grouped as follows and run on a single device:
+
+    * `compile` - `NxIREE.compile/3` without a cache (cold) and with a
+      populated `:cache_dir` (warm)
+    * `defn` - `Nx.Defn.compile/3` with `NxIREE.Compiler`, cold and warm
+    * `eager` - `NxIREE.Backend` ops outside of `defn`
+    * `call` - `NxIREE.call/3` from 1 up to `--concurrency` processes at once
+    * `transfer` - `Nx.from_binary/3` and `Nx.to_binary/1` throughput
+
+  Results can be written to a file and compared against a previous run,
+  which is useful to evaluate a new `IREE_GIT_REV` against known workloads:
+
+      $ mix nx_iree.bench --output base.bench
+      $ NX_IREE_GIT_REV=... mix nx_iree.bench --baseline base.bench
+
+  Result files hold Erlang terms, which can be read with `:file.consult/1`.
+
+  ## Options
+
+    * `--device` - the device to run on. Defaults to `local-task://`
+    * `--only` - comma-separated groups to run. Defaults to all of them
+    * `--iterations` - measured iterations for calls and transfers.
+      Defaults to `200`
+    * `--compile-iterations` - measured iterations for the `compile`,
+      `defn` and `eager` groups. Defaults to `5`
+    * `--concurrency` - the highest number of concurrent callers.
+      Defaults to the number of online schedulers
+    * `--compiler-flag` - a flag for `iree-compile`, may be given
+      several times. Defaults to targeting `llvm-cpu`
+    * `--output` - writes the results to the given file
+    * `--baseline` - compares the results with the ones in the given file
+    * `--threshold` - the relative p50 slowdown, in percent, which counts
+      as a regression. Defaults to `10`
+    * `--fail-on-regression` - exits with an error if there are regressions
+  """
+
+  @shortdoc "Runs the end-to-end benchmarks"
+
+  use Mix.Task
+
+  @groups ~w(compile defn eager call transfer)
+  @default_flags ["--iree-hal-target-backends=llvm-cpu", "--iree-input-type=stablehlo_xla"]
+  @transfer_sizes [256, 262_144, 4_194_304]
+
+  @switches [
+    device: :string,
+    only: :string,
+    iterations: :integer,
+    compile_iterations: :integer,
+    concurrency: :integer,
+    compiler_flag: :keep,
+    output: :string,
+    baseline: :string,
+    threshold: :float,
+    fail_on_regression: :boolean
+  ]
+
+  @impl Mix.Task
+  def run(args) do
+    {parsed, _rest} = OptionParser.parse!(args, strict: @switches)
+    Mix.Task.run("app.start")
+
+    flags =
+      case Keyword.get_values(parsed, :compiler_flag) do
+        [] -> @default_flags
+        flags -> flags
+      end
+
+    config = %{
+      device: parsed[:device] || "local-task://",
+      iterations: parsed[:iterations] || 200,
+      compile_iterations: parsed[:compile_iterations] || 5,
+      concurrency: parsed[:concurrency] || System.schedulers_online(),
+      flags: flags
+    }
+
+    groups = if only = parsed[:only], do: String.split(only, ",", trim: true), else: @groups
+
+    if unknown = Enum.find(groups, &(&1 not in @groups)) do
+      Mix.raise("unknown group #{inspect(unknown)}, expected one of: #{Enum.join(@groups, ", ")}")
+    end
+
+    results =
+      for group <- @groups, group in groups, result <- run_group(group, config) do
+        print_result(result)
+        result
+      end
+
+    report = %{metadata: metadata(config), results: results}
+
+    if output = parsed[:output] do
+      File.write!(output, :io_lib.format(~c"~tp.~n", [report]))
+      Mix.shell().info("Results written to #{output}")
+    end
+
+    if baseline = parsed[:baseline] do
+      {:ok, [baseline_report]} = :file.consult(String.to_charlist(baseline))
+      regressions = compare(baseline_report, report, parsed[:threshold] || 10.0)
+
+      if regressions != [] and parsed[:fail_on_regression] do
+        Mix.raise("#{length(regressions)} benchmark(s) regressed")
+      end
+    end
+  end
+
+  ## Groups
+
+  defp run_group("compile", config) do
+    {mlir_module, _templates} = dense_mlir_module(64, 256)
+
+    cold =
+      with_app_cache_dir(nil, fn ->
+        measure(config.compile_iterations, fn -> NxIREE.compile(mlir_module, config.flags) end)
+      end)
+
+    warm =
+      with_cache_dir(fn cache_dir ->
+        NxIREE.compile(mlir_module, config.flags, cache_dir: cache_dir)
+
+        measure(config.compile_iterations, fn ->
+          NxIREE.compile(mlir_module, config.flags, cache_dir: cache_dir)
+        end)
+      end)
+
+    [
+      result("compile.cold", %{batch: 64, features: 256}, cold),
+      result("compile.warm", %{batch: 64, features: 256}, warm)
+    ]
+  end
+
+  defp run_group("defn", config) do
+    templates = dense_templates(64, 256)
+
+    opts = [
+      compiler: NxIREE.Compiler,
+      iree_compiler_flags: config.flags,
+      iree_runtime_options: [device: config.device]
+    ]
+
+    compile = fn -> Nx.Defn.compile(&dense/3, templates, opts) end
+    cold = with_app_cache_dir(nil, fn -> measure(config.compile_iterations, compile) end)
+
+    warm =
+      with_cache_dir(fn cache_dir ->
+        with_app_cache_dir(cache_dir, fn ->
+          compile.()
+          measure(config.compile_iterations, compile)
+        end)
+      end)
+
+    [
+      result("defn.cold", %{batch: 64, features: 256}, cold),
+      result("defn.warm", %{batch: 64, features: 256}, warm)
+    ]
+  end
+
+  defp run_group("eager", config) do
+    backend = {NxIREE.Backend, device: config.device}
+    a = Nx.iota({256, 256}, type: :f32, backend: backend)
+    b = Nx.iota({256, 256}, type: :f32, backend: backend)
+
+    for {name, fun} <- [add: &Nx.add(a, &1), dot: &Nx.dot(a, &1), sum: &Nx.sum(&1, axes: [1])] do
+      samples =
+        measure(config.compile_iterations, fn ->
+          Nx.backend_deallocate(fun.(b))
+        end)
+
+      result("eager.#{name}", %{shape: "256x256"}, samples)
+    end
+  end
+
+  defp run_group("call", config) do
+    {mlir_module, templates} = dense_mlir_module(64, 256)
+    module = NxIREE.compile(mlir_module, config.flags)
+    inputs = Enum.map(templates, &Nx.broadcast(Nx.tensor(0.5, type: &1.type), &1.shape))
+
+    for concurrency <- concurrency_levels(config.concurrency) do
+      calls = max(div(config.iterations, concurrency), 1)
+
+      {wall_time, samples} =
+        :timer.tc(fn ->
+          1..concurrency
+          |> Task.async_stream(
+            fn _ ->
+              measure(calls, fn ->
+                {:ok, outputs} = NxIREE.call(module, inputs, device: config.device)
+                Enum.each(outputs, &Nx.backend_deallocate/1)
+              end)
+            end,
+            max_concurrency: concurrency,
+            timeout: :infinity
+          )
+          |> Enum.flat_map(fn {:ok, samples} -> samples end)
+        end)
+
+      calls_per_second = length(samples) / (wall_time / 1_000_000)
+
+      result("call", %{concurrency: concurrency}, samples, {calls_per_second, "calls/s"})
+    end
+  end
+
+  defp run_group("transfer", config) do
+    backend = {NxIREE.Backend, device: config.device}
+
+    Enum.flat_map(@transfer_sizes, fn elements ->
+      binary = Nx.iota({elements}, type: :f32, backend: Nx.BinaryBackend) |> Nx.to_binary()
+      bytes = byte_size(binary)
+      tensor = Nx.from_binary(binary, :f32, backend: backend)
+
+      from_binary =
+        measure(config.iterations, fn ->
+          binary |> Nx.from_binary(:f32, backend: backend) |> Nx.backend_deallocate()
+        end)
+
+      to_binary = measure(config.iterations, fn -> Nx.to_binary(tensor) end)
+      Nx.backend_deallocate(tensor)
+
+      [
+        result("transfer.from_binary", %{bytes: bytes}, from_binary, bytes_per_second(bytes)),
+        result("transfer.to_binary", %{bytes: bytes}, to_binary, bytes_per_second(bytes))
+      ]
+    end)
+  end
+
+  ## Workloads
+
+  defp dense(x, w, b), do: x |> Nx.dot(w) |> Nx.add(b) |> Nx.sigmoid()
+
+  defp dense_templates(batch, features) do
+    [
+      Nx.template({batch, features}, :f32),
+      Nx.template({features, features}, :f32),
+      Nx.template({features}, :f32)
+    ]
+  end
+
+  defp dense_mlir_module(batch, features) do
+    templates = dense_templates(batch, features)
+    %{mlir_module: mlir_module} = EXLA.to_mlir_module(&dense/3, templates)
+    {mlir_module, templates}
+  end
+
+  defp concurrency_levels(max_concurrency) do
+    1
+    |> Stream.iterate(&(&1 * 2))
+    |> Enum.take_while(&(&1 < max_concurrency))
+    |> Kernel.++([max_concurrency])
+    |> Enum.uniq()
+  end
+
+  defp with_cache_dir(fun) do
+    name = "nx_iree_bench_#{System.unique_integer([:positive])}"
+    cache_dir = Path.join(System.tmp_dir!(), name)
+    File.mkdir_p!(cache_dir)
+
+    try do
+      fun.(cache_dir)
+    after
+      File.rm_rf!(cache_dir)
+    end
+  end
+
+  defp with_app_cache_dir(cache_dir, fun) do
+    previous = Application.get_env(:nx_iree, :cache_dir)
+    Application.put_env(:nx_iree, :cache_dir, cache_dir)
+
+    try do
+      fun.()
+    after
+      Application.put_env(:nx_iree, :cache_dir, previous)
+    end
+  end
+
+  ## Measurements
+
+  # Runs `fun` once to warm up and then `iterations` times, returning the
+  # duration of each run in microseconds
+  defp measure(iterations, fun) do
+    fun.()
+
+    for _ <- 1..max(iterations, 1) do
+      {time, _} = :timer.tc(fun)
+      time
+    end
+  end
+
+  defp bytes_per_second(bytes), do: fn mean -> {bytes / (mean / 1_000_000), "B/s"} end
+
+  defp result(name, params, samples, throughput \\ nil) do
+    sorted = Enum.sort(samples)
+    count = length(sorted)
+    mean = Enum.sum(sorted) / count
+
+    throughput =
+      case throughput do
+        nil -> {1_000_000 / mean, "ops/s"}
+        fun when is_function(fun, 1) -> fun.(mean)
+        throughput -> throughput
+      end
+
+    %{
+      name: name,
+      params: params,
+      iterations: count,
+      min_us: hd(sorted),
+      p50_us: NxIREE.Measure.percentile(sorted, 0.5),
+      p90_us: NxIREE.Measure.percentile(sorted, 0.9),
+      p99_us: NxIREE.Measure.percentile(sorted, 0.99),
+      max_us: List.last(sorted),
+      mean_us: round(mean),
+      throughput: throughput
+    }
+  end
+
+  defp metadata(config) do
+    compiler_path = Path.join(:code.priv_dir(:nx_iree), "iree-compile")
+
+    iree_compile =
+      case System.cmd(compiler_path, ["--version"], stderr_to_stdout: true) do
+        {version, 0} -> String.trim(version)
+        _ -> nil
+      end
+
+    %{
+      device: config.device,
+      compiler_flags: config.flags,
+      iree_compile: iree_compile,
+      nx_iree: to_string(Application.spec(:nx_iree, :vsn)),
+      elixir: System.version(),
+      otp: List.to_string(:erlang.system_info(:otp_release)),
+      schedulers: System.schedulers_online(),
+      date: DateTime.to_iso8601(DateTime.utc_now())
+    }
+  end
+
+  ## Reporting
+
+  defp print_result(result) do
+    {throughput, unit} = result.throughput
+
+    Mix.shell().info(
+      "#{label(result)}: p50 #{result.p50_us}us, p90 #{result.p90_us}us, " <>
+        "p99 #{result.p99_us}us, #{format_number(throughput)} #{unit}"
+    )
+  end
+
+  @doc false
+  # Prints the p50 change of every benchmark present in both reports and
+  # returns the ones which slowed down by more than `threshold` percent
+  def compare(baseline, current, threshold) do
+    baseline_results = Map.new(baseline.results, &{{&1.name, &1.params}, &1})
+
+    Mix.shell().info("\nCompared to the baseline from #{baseline.metadata.date}:")
+
+    Enum.flat_map(current.results, fn result ->
+      case Map.fetch(baseline_results, {result.name, result.params}) do
+        {:ok, previous} ->
+          change = (result.p50_us - previous.p50_us) / max(previous.p50_us, 1) * 100
+          regressed? = change > threshold
+          marker = if regressed?, do: "  <- regression", else: ""
+
+          Mix.shell().info(
+            "#{label(result)}: p50 #{previous.p50_us}us -> #{result.p50_us}us " <>
+              "(#{format_change(change)})#{marker}"
+          )
+
+          if regressed?, do: [result], else: []
+
+        :error ->
+          Mix.shell().info("#{label(result)}: not in the baseline")
+          []
+      end
+    end)
+  end
+
+  defp label(%{name: name, params: params}) do
+    params = Enum.map_join(params, ", ", fn {key, value} -> "#{key}=#{value}" end)
+    "#{name} (#{params})"
+  end
+
+  defp format_change(change) when change >= 0, do: "+#{format_number(change)}%"
+  defp format_change(change), do: "#{format_number(change)}%"
+
+  defp format_number(number), do: :erlang.float_to_binary(number / 1, decimals: 1)
+end
@@ -19,6 +19,7 @@ defmodule NxIREE do
 
   `NxIREE.Compiler` also provides a `to_bytecode` function which outputs the bytecode for usage with embedded devices,
   such as the iOS devices usable through [`LiveNxIREE`](https://github.com/elixir-nx/nx_iree/tree/main/embedded_devices/live_nx_iree).
+  The resulting module can be persisted with `NxIREE.Bundle` and loaded back without recompiling.
   """
 
   @doc """
@@ -36,12 +37,50 @@ defmodule NxIREE do
       ...>\"""
       iex> flags = ["--iree-hal-target-backends=llvm-cpu", "--iree-input-type=stablehlo_xla", "--iree-execution-model=async-internal"]
       iex> NxIREE.compile(mlir_module, flags)
+
+  ## Options
+
+    * `:output_container` - the container stored in the resulting module.
+    * `:compiler_path` - the `iree-compile` executable to use.
+      Defaults to the one shipped in the `:nx_iree` priv directory.
+    * `:cache_dir` - a directory where compiled bytecode is cached,
+      keyed on the MLIR module, the flags and the compiler executable.
+      Defaults to the `:cache_dir` setting of the `:nx_iree` application.
+      No caching happens if neither is set.
   """
   def compile(mlir_module, flags, opts \\ []) do
     output_container = opts[:output_container]
-    {:ok, tmpfile} = create_temp_file(mlir_module)
-
     compiler_path = opts[:compiler_path] || Path.join(:code.priv_dir(:nx_iree), "iree-compile")
+    cache_dir = opts[:cache_dir] || Application.get_env(:nx_iree, :cache_dir)
+
+    bytecode =
+      if cache_dir do
+        key = NxIREE.Compiler.Cache.key(mlir_module, flags, compiler_path)
+
+        case NxIREE.Compiler.Cache.fetch(cache_dir, key) do
+          {:ok, bytecode} ->
+            bytecode
+
+          :error ->
+            bytecode = run_compiler(compiler_path, mlir_module, flags)
+            NxIREE.Compiler.Cache.put(cache_dir, key, bytecode)
+            bytecode
+        end
+      else
+        run_compiler(compiler_path, mlir_module, flags)
+      end
+
+    %NxIREE.Module{
+      bytecode: bytecode,
+      hash: :crypto.hash(:sha256, bytecode),
+      compilation_flags: flags,
+      mlir_module: mlir_module,
+      output_container: output_container
+    }
+  end
+
+  defp run_compiler(compiler_path, mlir_module, flags) do
+    {:ok, tmpfile} = create_temp_file(mlir_module)
 
     try do
       {output, 0} =
@@ -50,12 +89,7 @@ defmodule NxIREE do
           flags ++ [tmpfile]
         )
 
-      %NxIREE.Module{
-        bytecode: output,
-        compilation_flags: flags,
-        mlir_module: mlir_module,
-        output_container: output_container
-      }
+      output
     after
       File.rm(tmpfile)
     end
@@ -70,6 +104,67 @@ defmodule NxIREE do
     end
   end
 
+  @doc """
+  Loads a compiled `.vmfb` file into the runtime and registers it under a name.
+
+  The file is memory-mapped instead of being read into the BEAM heap,
+  so loading large modules only costs page-cache time and the pages are
+  shared between all processes calling the module.
+
+  Returns an `NxIREE.Module` which can be passed to `call/3` directly
+  or fetched later through `fetch_module/1`.
+
+  ## Options
+
+    * `:name` - the name to register the module under. Defaults to the
+      file name without the `.vmfb` extension.
+    * `:output_container` - the output container for the module. If not
+      provided, `call/3` returns a flat list of tensors.
+  """
+  def load_module(path, opts \\ []) do
+    opts = Keyword.validate!(opts, [:name, :output_container])
+    path = Path.expand(path)
+    name = opts[:name] || Path.basename(path, ".vmfb")
+
+    case NxIREE.VM.load_module(path) do
+      {:ok, ref} ->
+        module = %NxIREE.Module{ref: ref, output_container: opts[:output_container]}
+        :ok = NxIREE.VM.register_module(name, module)
+        {:ok, module}
+
+      {:error, reason} ->
+        {:error, List.to_string(reason)}
+    end
+  end
+
+  @doc """
+  Loads every `.vmfb` file in the given directory through `load_module/2`.
+
+  Returns the names the modules were registered under.
+  """
+  def preload_modules(dir) do
+    dir
+    |> Path.join("*.vmfb")
+    |> Path.wildcard()
+    |> Enum.reduce_while({:ok, []}, fn path, {:ok, names} ->
+      case load_module(path) do
+        {:ok, _module} -> {:cont, {:ok, [Path.basename(path, ".vmfb") | names]}}
+        {:error, reason} -> {:halt, {:error, {path, reason}}}
+      end
+    end)
+    |> case do
+      {:ok, names} -> {:ok, Enum.reverse(names)}
+      error -> error
+    end
+  end
+
+  @doc """
+  Fetches a module previously registered through `load_module/2`.
+  """
+  def fetch_module(name) do
+    NxIREE.VM.fetch_module(name)
+  end
+
   @doc """
   Calls a function in the given module with the provided Nx inputs.
 
@@ -78,38 +173,126 @@ defmodule NxIREE do
     # `:function` - The name of the function to call in the module. If not provided, will default to `"main"`.
     * `:device` - The device to run the module on. If not provided, will default to known GPU devices (CUDA, ROCm, Metal, Vulkan) over others.
       Valid values can be obtained through `list_devices/0` or `list_devices/1`.
+      Devices on other nodes are given as `{node, device_uri}`, see `NxIREE.Remote`.
+    * `:quota_timeout` - how long to wait, in milliseconds or `:infinity`, for memory
+      to be released when the call doesn't fit in the quota of the device or tenant,
+      before raising `NxIREE.QuotaExceededError`. See `NxIREE.Quota`. Defaults to the
+      `:quota_timeout` application environment, or `5000`.
+    * `:tenant` - the tenant whose quota the call is charged to. Defaults to
+      the tenant of the calling process, see `NxIREE.Quota.put_tenant/1`.
+
+  ## Telemetry
+
+  Calls on local devices are wrapped in a `[:nx_iree, :call]` span, emitting
+  `[:nx_iree, :call, :start]`, `[:nx_iree, :call, :stop]` and
+  `[:nx_iree, :call, :exception]` events with the `:device` URI and the
+  `:driver` as metadata. Besides the `:duration`, the stop event measures
+  how long each phase of the call took, in native time units:
+
+    * `:quota_wait` - waiting for memory to fit in a quota
+    * `:module_create` - creating the runtime modules
+    * `:context_create` - creating the VM context and resolving the function
+    * `:input_upload` - copying inputs which are not on the device yet
+    * `:invoke` - running the function
+    * `:outputs` - collecting the outputs
+
+  as well as the `:bytes_uploaded` for those inputs and the `:bytes_output`
+  held by the outputs, which stay on the device until they are read.
+  Reads emit `[:nx_iree, :read_buffer, :start | :stop | :exception]` events,
+  with the `:bytes_downloaded` measured on stop.
   """
-  def call(
-        %NxIREE.Module{bytecode: bytecode, output_container: output_container},
-        inputs,
-        opts \\ []
-      ) do
-    opts = Keyword.validate!(opts, function: "main", device: nil)
-
-    {:ok, %NxIREE.Device{driver_name: driver_name, ref: device_ref, uri: device_uri}} =
-      NxIREE.Device.get(opts[:device])
-
-    input_refs =
-      Enum.map(inputs, fn
-        %Nx.Tensor{data: %NxIREE.Backend{ref: ref}} ->
-          ref
-
-        fun when is_function(fun, 0) ->
-          {:ok, ref} = NxIREE.VM.allocate_buffer(fun.(), device_ref)
-          ref
-
-        t ->
-          {:ok, ref} = NxIREE.VM.allocate_buffer(t, device_ref)
-          ref
+  def call(%NxIREE.Module{} = module, inputs, opts \\ []) do
+    quota_timeout = Application.get_env(:nx_iree, :quota_timeout, 5_000)
+    opts =
+      Keyword.validate!(opts,
+        function: "main",
+        device: nil,
+        quota_timeout: quota_timeout,
+        tenant: NxIREE.Quota.get_tenant()
+      )
+
+    {:ok, device} = NxIREE.Device.get(opts[:device])
+
+    if NxIREE.Device.remote?(device) do
+      NxIREE.Remote.call(module, inputs, device, opts[:function])
+    else
+      call_local(module, inputs, device, opts)
+    end
+  end
+
+  defp call_local(module, inputs, %NxIREE.Device{} = device, opts) do
+    metadata = %{device: device.uri, driver: device.driver_name}
+
+    :telemetry.span([:nx_iree, :call], metadata, fn ->
+      {result, measurements} = run_call(module, inputs, device, opts)
+      {result, measurements, metadata}
+    end)
+  end
+
+  defp run_call(
+         %NxIREE.Module{
+           bytecode: bytecode,
+           hash: hash,
+           ref: module_ref,
+           output_container: output_container
+         },
+         inputs,
+         %NxIREE.Device{driver_name: driver_name, ref: device_ref, uri: device_uri} = device,
+         opts
+       ) do
+    upload_start = System.monotonic_time()
+
+    # Tensors already on the target device are passed by reference. Everything
+    # else is copied into temporary buffers which are released after the call.
+    # The runtime counts the bytes it uploads, as these are only host copies.
+    {input_refs, temporary_refs} =
+      Enum.map_reduce(inputs, [], fn input, temporary_refs ->
+        input = if is_function(input, 0), do: input.(), else: input
+
+        case input do
+          %Nx.Tensor{data: %NxIREE.Backend{ref: ref, data: nil, device: ^device_ref}} ->
+            {ref, temporary_refs}
+
+          t ->
+            {:ok, ref} = NxIREE.VM.allocate_buffer(t, device_ref)
+            {ref, [ref | temporary_refs]}
+        end
       end)
 
+    upload_time = System.monotonic_time() - upload_start
     instance_ref = NxIREE.VM.get_instance()
 
-    result =
-      NxIREE.Native.call_io(instance_ref, device_ref, driver_name, bytecode, input_refs)
+    # The temporary inputs are not charged yet, so the call reserves them
+    # together with the outputs it is expected to return
+    quota = NxIREE.Quota.__request__(opts[:tenant], expected_output_bytes(output_container))
+
+    {result, quota_wait} =
+      try do
+        NxIREE.Quota.__retry__(opts[:quota_timeout], fn ->
+          NxIREE.Native.call_io(
+            instance_ref,
+            device_ref,
+            driver_name,
+            module_ref || bytecode,
+            input_refs,
+            :erlang.monotonic_time(:nanosecond),
+            quota,
+            hash || ""
+          )
+        end)
+      after
+        Enum.each(temporary_refs, &NxIREE.Native.deallocate_buffer/1)
+      end
 
     case result do
-      {:ok, refs} ->
+      {:ok, refs, stats} when output_container == nil ->
+        # Modules loaded straight from .vmfb files carry no output container,
+        # so we rebuild the tensors from what the runtime reports instead.
+        tensors = Enum.map(refs, &NxIREE.Backend.from_ref(&1, device))
+
+        {{:ok, tensors}, call_measurements(stats, upload_time, quota_wait)}
+
+      {:ok, refs, stats} ->
         {tensors, []} =
           Nx.Defn.Composite.traverse(output_container, refs, fn hole,
                                                                 [{ref, _dims, _type_str} | refs] ->
@@ -124,31 +307,152 @@ defmodule NxIREE do
             {%{hole | data: data}, refs}
           end)
 
-        # tensors =
-        #   Enum.map(refs, fn {ref, dims, type_str} ->
-        #     %Nx.Tensor{
-        #       names: Enum.map(dims, fn _ -> nil end),
-        #       type: type_str_to_nx(type_str),
-        #       shape: List.to_tuple(dims),
-        #       data: %NxIREE.Backend{
-        #         ref: ref,
-        #         data: nil,
-        #         device_uri: device,
-        #         device: device_ref,
-        #         driver: driver_name
-        #       }
-        #     }
-        #   end)
-
-        {:ok, tensors}
+        {{:ok, tensors}, call_measurements(stats, upload_time, quota_wait)}
+
+      {:error, {:quota_exceeded, _, _, _, _} = reason} ->
+        NxIREE.Quota.__raise__(reason)
 
       {:error, error} ->
         raise "IREE call failed due to: #{inspect(error)}"
     end
   end
 
+  defp expected_output_bytes(nil), do: 0
+
+  defp expected_output_bytes(output_container) do
+    Nx.Defn.Composite.reduce(output_container, 0, &(Nx.byte_size(&1) + &2))
+  end
+
+  # The runtime reports nanoseconds, while telemetry durations are in native units
+  defp call_measurements(stats, upload_time, quota_wait) do
+    native = &System.convert_time_unit(&1, :nanosecond, :native)
+
+    %{
+      quota_wait: quota_wait,
+      module_create: native.(stats.module_create),
+      context_create: native.(stats.context_create),
+      input_upload: upload_time + native.(stats.input_upload),
+      invoke: native.(stats.invoke),
+      outputs: native.(stats.outputs),
+      bytes_uploaded: stats.bytes_uploaded,
+      bytes_output: stats.bytes_output
+    }
+  end
+
+  @doc """
+  Warms up a module before it serves traffic.
+
+  The first call to a module pays for parsing it, loading its executables,
+  growing the device allocator and faulting in fresh pages. This function
+  loads the module into the runtime, unless it already was, and then calls
+  it `:runs` times on synthetic inputs built from `templates`, so that real
+  requests only see the warm path.
+
+  `templates` are the inputs `call/3` expects, as tensors or templates from
+  `Nx.template/3`. Pass `nil` to use the `:input_templates` the module was
+  compiled with.
+
+  Returns `{:ok, module, stats}`, where `module` should be used for the
+  following calls. `stats` holds the `:load_us` spent loading the module,
+  the `:cold_us` of the first call, and the `:runs`, `:min_us`, `:p50_us`,
+  `:p99_us`, `:max_us` and `:mean_us` of the warm calls, in microseconds.
+  A readiness probe can warm up until the p99 latency stops changing:
+
+      {:ok, module, %{p99_us: p99}} = NxIREE.warmup(module, templates, runs: 50)
+
+  If loading the module or any of the calls fails, `{:error, reason}` is
+  returned instead.
+
+  ## Options
+
+    * `:runs` - how many warm calls to time. Defaults to `10`.
+    * `:device` - the device to warm up, as in `call/3`.
+  """
+  def warmup(%NxIREE.Module{} = module, templates, opts \\ []) do
+    opts = Keyword.validate!(opts, runs: 10, device: nil)
+    {:ok, device} = NxIREE.Device.get(opts[:device])
+    call_opts = [device: device]
+
+    inputs = synthetic_inputs(module, templates)
+    {load_time, loaded} = :timer.tc(fn -> load_for_warmup(module, device) end)
+
+    with {:ok, module} <- loaded,
+         {:ok, cold_time} <- timed_call(module, inputs, call_opts),
+         {:ok, samples} <- timed_runs(module, inputs, call_opts, max(opts[:runs], 1), []) do
+      {:ok, module, warmup_stats(load_time, cold_time, samples)}
+    end
+  end
+
+  # Modules on remote devices are loaded on their node by the first call
+  defp load_for_warmup(%NxIREE.Module{ref: nil, bytecode: bytecode} = module, device) do
+    if NxIREE.Device.remote?(device) do
+      {:ok, module}
+    else
+      case NxIREE.VM.load_module_from_binary(bytecode) do
+        {:ok, ref} -> {:ok, %{module | ref: ref}}
+        {:error, reason} -> {:error, List.to_string(reason)}
+      end
+    end
+  end
+
+  defp load_for_warmup(module, _device), do: {:ok, module}
+
+  defp synthetic_inputs(%NxIREE.Module{input_templates: nil}, nil) do
+    raise ArgumentError, "the module carries no input templates, so they must be given"
+  end
+
+  defp synthetic_inputs(%NxIREE.Module{input_templates: templates, used_inputs: used}, nil) do
+    templates
+    |> NxIREE.Measure.synthetic_inputs()
+    |> NxIREE.Compiler.filter_inputs_by_indices(used)
+  end
+
+  defp synthetic_inputs(_module, templates), do: NxIREE.Measure.synthetic_inputs(templates)
+
+  # Outputs are released right away so every run allocates like a real request.
+  # Failed calls raise, so the error is rescued and returned to the caller.
+  defp timed_call(module, inputs, opts) do
+    {time, {:ok, outputs}} = :timer.tc(fn -> call(module, inputs, opts) end)
+
+    outputs
+    |> List.wrap()
+    |> Nx.Defn.Composite.flatten_list()
+    |> Enum.each(&Nx.backend_deallocate/1)
+
+    {:ok, time}
+  rescue
+    e -> {:error, Exception.message(e)}
+  end
+
+  defp timed_runs(_module, _inputs, _opts, 0, samples), do: {:ok, samples}
+
+  defp timed_runs(module, inputs, opts, runs, samples) do
+    with {:ok, time} <- timed_call(module, inputs, opts) do
+      timed_runs(module, inputs, opts, runs - 1, [time | samples])
+    end
+  end
+
+  defp warmup_stats(load_time, cold_time, samples) do
+    sorted = Enum.sort(samples)
+    count = length(sorted)
+
+    %{
+      load_us: load_time,
+      cold_us: cold_time,
+      runs: count,
+      min_us: hd(sorted),
+      p50_us: NxIREE.Measure.percentile(sorted, 0.5),
+      p99_us: NxIREE.Measure.percentile(sorted, 0.99),
+      max_us: List.last(sorted),
+      mean_us: round(Enum.sum(sorted) / count)
+    }
+  end
+
   @doc """
   Lists all devices available for running IREE modules.
+
+  Devices are enumerated when the application starts, but each one is only
+  created once it is first used and is reused from then on.
   """
   @spec list_devices(String.t()) :: {:ok, list(String.t())}
   def list_devices do
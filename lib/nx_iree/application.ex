@@ -4,11 +4,15 @@ defmodule NxIREE.Application do
   use Application
 
   def start(_type, _args) do
-    children = []
+    children = [NxIREE.Remote]
 
     :ok = NxIREE.Device.init()
     {:ok, _instance} = NxIREE.VM.create_instance()
 
+    if dir = Application.get_env(:nx_iree, :preload_modules_dir) do
+      {:ok, _names} = NxIREE.preload_modules(dir)
+    end
+
     Supervisor.start_link(children, strategy: :one_for_one, name: NxIREE.Supervisor)
   end
 end
@@ -6,7 +6,7 @@ defmodule NxIREE.Backend do
   handling output buffer references for IREE call outputs.
   """
 
-  defstruct [:data, :ref, :device, :device_uri, :driver]
+  defstruct [:data, :ref, :device, :device_uri, :driver, :node, :lease]
 
   @behaviour Nx.Backend
 
@@ -55,7 +55,8 @@ defmodule NxIREE.Backend do
   def from_binary(out, binary, opts) do
     {:ok, %NxIREE.Device{ref: device_ref, uri: device_uri}} = NxIREE.Device.get(opts[:device])
 
-    {:ok, ref} = NxIREE.VM.allocate_buffer(binary, device_ref, out.shape, out.type)
+    quota = NxIREE.Quota.__request__()
+    {:ok, ref} = NxIREE.VM.allocate_buffer(binary, device_ref, out.shape, out.type, quota)
 
     %{
       out
@@ -63,6 +64,33 @@ defmodule NxIREE.Backend do
     }
   end
 
+  # Builds a tensor from a {ref, dims, type} tuple returned by the runtime
+  @doc false
+  def from_ref({ref, dims, type_str}, %NxIREE.Device{} = device) do
+    %Nx.Tensor{
+      names: Enum.map(dims, fn _ -> nil end),
+      type: type_str_to_nx(type_str),
+      shape: List.to_tuple(dims),
+      data: %__MODULE__{
+        ref: ref,
+        data: nil,
+        device_uri: device.uri,
+        device: device.ref,
+        driver: device.driver_name
+      }
+    }
+  end
+
+  defp type_str_to_nx(type_str) do
+    case List.to_string(type_str) do
+      "i" <> size -> {:s, String.to_integer(size)}
+      "u" <> size -> {:u, String.to_integer(size)}
+      "bf" <> size -> {:bf, String.to_integer(size)}
+      "f" <> size -> {:f, String.to_integer(size)}
+      "c" <> size -> {:c, String.to_integer(size)}
+    end
+  end
+
   @impl true
   def backend_deallocate(tensor) do
     :ok = NxIREE.VM.deallocate_buffer(tensor.data)
@@ -96,10 +124,14 @@ defmodule NxIREE.Backend do
     # TO-DO: implement reading with limit. For now, truncate locally
     data =
       case data do
-        %{data: nil} ->
+        %{data: nil, node: nil} ->
           {:ok, binary} = NxIREE.VM.read_buffer(data.device, data.ref, bytes)
           binary
 
+        %{data: nil} ->
+          {:ok, binary} = NxIREE.VM.read_buffer(data)
+          binary
+
         %{data: data} ->
           data
       end
@@ -218,14 +250,87 @@ defmodule NxIREE.Backend do
     jit([], wrapper_fun, tensors, [List.to_tuple(tensors)])
   end
 
+  @doc """
+  Returns a `Nx.Pointer` to the tensor contents in host memory.
+
+  Device buffers are mapped into host memory, which requires a device
+  whose memory is host-visible, such as the CPU drivers. Writes through
+  the pointer are seen by the following calls which use the tensor.
+  Buffers which can't be mapped persistently, such as the call outputs of
+  some devices, raise instead, in which case the tensor should be read
+  with `Nx.to_binary/1`.
+  The pointer is valid for as long as the tensor is not deallocated nor
+  garbage collected.
+
+  Only `mode: :local` is supported.
+  """
   @impl true
-  def to_pointer(_, _) do
-    raise "function not supported yet by NxIREE"
+  def to_pointer(%Nx.Tensor{data: %__MODULE__{} = data}, opts) do
+    opts = Keyword.validate!(opts, mode: :local)
+
+    if opts[:mode] != :local do
+      raise ArgumentError,
+            "NxIREE.Backend only supports mode: :local, got: #{inspect(opts[:mode])}"
+    end
+
+    case NxIREE.VM.to_pointer(data) do
+      {:ok, {address, size}} ->
+        %Nx.Pointer{kind: :local, address: address, data_size: size}
+
+      {:error, reason} ->
+        raise RuntimeError, "unable to get tensor pointer: #{reason}"
+    end
   end
 
+  @doc """
+  Wraps host memory as a tensor without copying it.
+
+  The memory is imported as a buffer of the given device, which must be
+  able to access host memory, such as the CPU drivers. It must stay valid
+  and must not be freed for as long as the tensor is alive.
+
+  ## Backend options
+
+    * `:device` - the device to import the memory into.
+    * `:owner` - a term, such as the resource or binary which holds the
+      memory, which is kept alive until the tensor is garbage collected.
+  """
   @impl true
-  def from_pointer(_, _, _, _, _) do
-    raise "function not supported yet by NxIREE"
+  def from_pointer(%Nx.Pointer{kind: :local} = pointer, type, shape, backend_opts, opts) do
+    backend_opts = Keyword.validate!(backend_opts, [:device, :owner])
+
+    {:ok, %NxIREE.Device{ref: device_ref, uri: device_uri}} =
+      NxIREE.Device.get(backend_opts[:device])
+
+    {_, bits} = type
+    byte_size = Nx.size(shape) * div(bits, 8)
+
+    if pointer.data_size && pointer.data_size < byte_size do
+      raise ArgumentError,
+            "pointer holds #{pointer.data_size} bytes, " <>
+              "expected at least #{byte_size} for #{inspect(type)} #{inspect(shape)}"
+    end
+
+    owner = backend_opts[:owner]
+
+    ref =
+      case NxIREE.VM.from_pointer(pointer.address, device_ref, shape, type, owner) do
+        {:ok, ref} -> ref
+        {:error, reason} -> raise RuntimeError, "unable to import pointer: #{reason}"
+      end
+
+    names = opts[:names] || List.duplicate(nil, tuple_size(shape))
+
+    %Nx.Tensor{
+      type: type,
+      shape: shape,
+      names: names,
+      data: %__MODULE__{ref: ref, device: device_ref, device_uri: device_uri}
+    }
+  end
+
+  def from_pointer(%Nx.Pointer{kind: kind}, _type, _shape, _backend_opts, _opts) do
+    raise ArgumentError, "NxIREE.Backend only supports :local pointers, got: #{inspect(kind)}"
   end
 
   binary_ops =
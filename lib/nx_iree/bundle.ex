@@ -0,0 +1,227 @@
+defmodule NxIREE.Bundle do
+  @moduledoc """
+  Persists compiled `NxIREE.Module`s to disk so they can be loaded
+  in a release without recompiling.
+
+  A bundle holds the compiled bytecode together with everything needed
+  to call it: the input templates, the output container, the compiler
+  flags and the CPU features the code was compiled for. Loading a bundle
+  requires neither EXLA nor `iree-compile`.
+
+      {:ok, module} = NxIREE.Compiler.to_bytecode(&Nx.add/2, [Nx.template({4}, :f32), Nx.template({4}, :f32)], opts)
+      :ok = NxIREE.Bundle.write(module, "add.nxiree")
+
+      # later, possibly on another node
+      {:ok, add} = NxIREE.Bundle.load_function("add.nxiree", device: "local-sync://")
+      add.([Nx.iota({4}, type: :f32), Nx.iota({4}, type: :f32)])
+
+  ## Format
+
+  All integers are little-endian.
+
+    * magic - `"NXIREEBN"`
+    * format version - unsigned 32 bits
+    * reserved - 32 bits
+    * metadata size - unsigned 64 bits
+    * bytecode offset - unsigned 64 bits
+    * bytecode size - unsigned 64 bits
+    * metadata - an Erlang external term format encoded map
+    * zero padding up to the bytecode offset
+    * bytecode - the `.vmfb` contents
+
+  The bytecode is aligned to 64 bytes so that it can be memory-mapped
+  in place, as in `NxIREE.load_module/2`.
+  """
+
+  @magic "NXIREEBN"
+  @version 1
+  @header_size 40
+  @alignment 64
+
+  @doc """
+  Writes the given module to a bundle file at `path`.
+
+  The module must have been compiled through `NxIREE.Compiler`,
+  for instance through `NxIREE.Compiler.to_bytecode/3`, so that its
+  input templates are known.
+  """
+  def write(%NxIREE.Module{bytecode: bytecode, input_templates: templates} = module, path)
+      when is_binary(bytecode) and is_list(templates) do
+    metadata =
+      :erlang.term_to_binary(%{
+        input_templates: templates,
+        used_inputs: module.used_inputs,
+        output_container: to_template(module.output_container),
+        compilation_flags: module.compilation_flags,
+        target_cpu_features: target_cpu_features(module.compilation_flags)
+      })
+
+    metadata_size = byte_size(metadata)
+    payload_offset = align(@header_size + metadata_size)
+    padding = payload_offset - @header_size - metadata_size
+
+    header =
+      <<@magic, @version::little-unsigned-32, 0::32, metadata_size::little-unsigned-64,
+        payload_offset::little-unsigned-64, byte_size(bytecode)::little-unsigned-64>>
+
+    # Write to a temporary file first so readers never observe a partial bundle
+    tmp_path = "#{path}.#{System.unique_integer([:positive])}.tmp"
+
+    with :ok <- File.write(tmp_path, [header, metadata, <<0::size(padding)-unit(8)>>, bytecode]),
+         :ok <- File.rename(tmp_path, path) do
+      :ok
+    else
+      error ->
+        File.rm(tmp_path)
+        error
+    end
+  end
+
+  def write(%NxIREE.Module{}, _path) do
+    raise ArgumentError,
+          "only modules compiled through NxIREE.Compiler, with bytecode and input templates, can be bundled"
+  end
+
+  @doc """
+  Loads the bundle at `path` into an `NxIREE.Module`.
+
+  The bytecode is memory-mapped in place instead of being read into
+  the BEAM heap.
+
+  ## Options
+
+    * `:check_cpu_features` - whether to refuse bundles compiled for CPU
+      features the host does not have. Running such code would crash with
+      an illegal instruction. Defaults to `true`.
+  """
+  def load(path, opts \\ []) do
+    path = Path.expand(path)
+
+    with {:ok, {metadata, payload_offset, payload_size}} <- read_header(path),
+         :ok <- check_cpu_features(metadata, Keyword.get(opts, :check_cpu_features, true)),
+         {:ok, ref} <- NxIREE.VM.load_module(path, payload_offset, payload_size) do
+      {:ok,
+       %NxIREE.Module{
+         ref: ref,
+         compilation_flags: metadata.compilation_flags,
+         output_container: metadata.output_container,
+         input_templates: metadata.input_templates,
+         used_inputs: metadata.used_inputs
+       }}
+    else
+      {:error, reason} when is_list(reason) -> {:error, List.to_string(reason)}
+      {:error, reason} -> {:error, reason}
+    end
+  end
+
+  @doc """
+  Reads the metadata stored in the bundle at `path` without loading the bytecode.
+  """
+  def metadata(path) do
+    with {:ok, {metadata, _payload_offset, _payload_size}} <- read_header(path) do
+      {:ok, metadata}
+    end
+  end
+
+  @doc """
+  Loads the bundle at `path` and returns a function that runs it.
+
+  The function receives the list of arguments the module was compiled with,
+  which must match the stored input templates. `runtime_opts` are passed to
+  `NxIREE.call/3`, except for `:check_cpu_features`, which is given to `load/2`.
+  """
+  def load_function(path, runtime_opts \\ []) do
+    {load_opts, runtime_opts} = Keyword.split(runtime_opts, [:check_cpu_features])
+
+    with {:ok, module} <- load(path, load_opts) do
+      {:ok, to_function(module, runtime_opts)}
+    end
+  end
+
+  @doc """
+  Returns a function that calls the given module with a list of arguments.
+
+  See `load_function/2`.
+  """
+  def to_function(%NxIREE.Module{input_templates: templates} = module, runtime_opts \\ []) do
+    flat_templates = Nx.Defn.Composite.flatten_list(templates)
+
+    fn args when is_list(args) ->
+      flat_args = Nx.Defn.Composite.flatten_list(args)
+
+      if length(flat_args) != length(flat_templates) do
+        raise ArgumentError,
+              "expected #{length(flat_templates)} tensor arguments, got: #{length(flat_args)}"
+      end
+
+      Enum.zip_with(flat_args, flat_templates, fn arg, template ->
+        unless arg.shape == template.shape and arg.type == template.type do
+          raise ArgumentError,
+                "expected argument compatible with #{inspect(template)}, got: #{inspect(arg)}"
+        end
+      end)
+
+      inputs = NxIREE.Compiler.filter_inputs_by_indices(flat_args, module.used_inputs)
+      {:ok, result} = NxIREE.call(module, inputs, runtime_opts)
+      result
+    end
+  end
+
+  defp read_header(path) do
+    File.open(path, [:read, :binary], fn file ->
+      case IO.binread(file, @header_size) do
+        <<@magic, @version::little-unsigned-32, _reserved::32, metadata_size::little-unsigned-64,
+          payload_offset::little-unsigned-64, payload_size::little-unsigned-64>> ->
+          case IO.binread(file, metadata_size) do
+            metadata when is_binary(metadata) and byte_size(metadata) == metadata_size ->
+              {:ok, {:erlang.binary_to_term(metadata, [:safe]), payload_offset, payload_size}}
+
+            _ ->
+              {:error, "truncated bundle metadata"}
+          end
+
+        <<@magic, version::little-unsigned-32, _::binary>> ->
+          {:error, "unsupported bundle format version #{version}"}
+
+        _ ->
+          {:error, "not an NxIREE bundle"}
+      end
+    end)
+    |> case do
+      {:ok, result} -> result
+      error -> error
+    end
+  end
+
+  defp check_cpu_features(_metadata, false), do: :ok
+
+  defp check_cpu_features(%{target_cpu_features: [_ | _] = features}, true) do
+    # Only enabled features ("+feature") are requirements on the host
+    required = for "+" <> _ = feature <- features, do: feature
+
+    case required -- NxIREE.Device.host_cpu_features() do
+      [] ->
+        :ok
+
+      missing ->
+        {:error,
+         "bundle requires CPU features missing on this host: #{Enum.join(missing, ",")}"}
+    end
+  end
+
+  defp check_cpu_features(_metadata, true), do: :ok
+
+  defp to_template(nil), do: nil
+  defp to_template(container), do: Nx.Defn.Composite.traverse(container, &Nx.to_template/1)
+
+  defp align(offset) do
+    div(offset + @alignment - 1, @alignment) * @alignment
+  end
+
+  defp target_cpu_features(flags) do
+    Enum.flat_map(flags || [], fn
+      "--iree-llvmcpu-target-cpu-features=" <> features -> String.split(features, ",", trim: true)
+      _ -> []
+    end)
+  end
+end
@@ -1,9 +1,42 @@
 defmodule NxIREE.Compiler do
   @moduledoc """
   Compiler for Nx defn
+
+  ## Options
+
+    * `:iree_compiler_flags` - flags passed to `iree-compile`.
+    * `:iree_runtime_options` - options passed to `NxIREE.call/3`.
+    * `:iree_host_cpu_features` - when targeting `llvm-cpu`, adds the host CPU
+      features to the compiler flags so that the generated code can use them.
+      Skipped if the flags already specify a target CPU, its features or a
+      target triple. Defaults to `true`.
+    * `:iree_autotune` - `true` or a list of options to pick the compiler
+      flags by benchmarking candidates on the target device.
+      Not used when the function is split across devices.
+      See `NxIREE.Compiler.Autotune`. Defaults to `false`.
+    * `:iree_partitioner` - splits the function between an accelerator and
+      a host device, using a cost model to place each op. Functions
+      targeting Metal are always split, but without this option only the
+      ops Metal does not support run on the host and the cost model is
+      skipped. See `NxIREE.Compiler.Partitioner`.
+    * `:iree_data_parallel` - splits the inputs along their batch axis and
+      runs one replica of the function per device concurrently, gathering
+      the results. See `NxIREE.Compiler.DataParallel`.
+    * `:iree_compile_concurrency` - how many stages of a function split
+      across devices are lowered and compiled at once. Defaults to the
+      number of online schedulers.
+    * `:iree_partition_devices` - the devices `Nx.Serving` partitions run
+      on when started with `partitions: true`, one partition per device.
+      See also `NxIREE.Serving`.
+
+  Compiled bytecode is cached on disk when the `:cache_dir` setting of the
+  `:nx_iree` application is set. See `NxIREE.compile/3`.
   """
 
+  alias NxIREE.Compiler.DataParallel
   alias NxIREE.Compiler.GraphSplitter
+  alias NxIREE.Compiler.Partitioner
+  alias NxIREE.Compiler.StageExecutor
   alias Nx.Tensor, as: T
   alias Nx.Defn.Expr
 
@@ -23,11 +56,33 @@ defmodule NxIREE.Compiler do
     {iree_compiler_flags, opts} = Keyword.pop(opts, :iree_compiler_flags, [])
     {iree_runtime_options, opts} = Keyword.pop(opts, :iree_runtime_options, [])
     {output_mode, opts} = Keyword.pop(opts, :output_mode, nil)
+    {host_cpu_features?, opts} = Keyword.pop(opts, :iree_host_cpu_features, true)
+    {autotune, opts} = Keyword.pop(opts, :iree_autotune, false)
+    {partitioner_opts, opts} = Keyword.pop(opts, :iree_partitioner)
+    {data_parallel_opts, opts} = Keyword.pop(opts, :iree_data_parallel)
+    {_partition_devices, opts} = Keyword.pop(opts, :iree_partition_devices)
+
+    {compile_concurrency, opts} =
+      Keyword.pop(opts, :iree_compile_concurrency, System.schedulers_online())
 
     unless is_list(iree_compiler_flags) do
       raise "missing :iree_compiler_flags option"
     end
 
+    iree_runtime_options =
+      cond do
+        # The partitioner and data-parallel devices win over the default
+        # runtime device, as the modules are compiled for them
+        accelerator = partitioner_opts[:accelerator] ->
+          Keyword.put(iree_runtime_options, :device, accelerator)
+
+        data_parallel_opts ->
+          Keyword.put(iree_runtime_options, :device, hd(data_parallel_opts[:devices]))
+
+        true ->
+          iree_runtime_options
+      end
+
     has_target_backend_flag? =
       Enum.any?(iree_compiler_flags, &String.starts_with?(&1, "--iree-hal-target-backends"))
 
@@ -54,25 +109,52 @@ defmodule NxIREE.Compiler do
           {iree_compiler_flags, backend}
       end
 
+    # Remote devices may run on a different CPU than this one
+    host_cpu_features? =
+      host_cpu_features? and not NxIREE.Device.remote?(iree_runtime_options[:device])
+
+    iree_compiler_flags =
+      maybe_add_host_cpu_features(iree_compiler_flags, backend, host_cpu_features?)
+
     exla_opts = opts |> Keyword.put(:within_defn_compiler, true) |> Keyword.put(:client, :host)
 
-    if output_mode != :bytecode and backend == "metal-spirv" do
-      compile_with_graph_splitter(
-        fun,
-        vars,
-        exla_opts,
-        iree_compiler_flags,
-        iree_runtime_options
-      )
-    else
-      compile_without_graph_splitter(
-        fun,
-        vars,
-        exla_opts,
-        iree_compiler_flags,
-        iree_runtime_options,
-        output_mode
-      )
+    cond do
+      output_mode != :bytecode and data_parallel_opts != nil ->
+        build_replica_module = fn replica_vars ->
+          build_module(
+            fun,
+            replica_vars,
+            exla_opts,
+            iree_compiler_flags,
+            iree_runtime_options,
+            autotune
+          )
+        end
+
+        DataParallel.compile(vars, data_parallel_opts, build_replica_module)
+
+      output_mode != :bytecode and (backend == "metal-spirv" or partitioner_opts != nil) ->
+        compile_with_graph_splitter(
+          fun,
+          vars,
+          exla_opts,
+          iree_compiler_flags,
+          iree_runtime_options,
+          host_cpu_features?,
+          compile_concurrency,
+          partitioner_opts || [optimize: false]
+        )
+
+      true ->
+        compile_without_graph_splitter(
+          fun,
+          vars,
+          exla_opts,
+          iree_compiler_flags,
+          iree_runtime_options,
+          output_mode,
+          autotune
+        )
     end
   end
 
@@ -82,20 +164,18 @@ defmodule NxIREE.Compiler do
          exla_opts,
          iree_compiler_flags,
          iree_runtime_options,
-         output_mode
+         output_mode,
+         autotune
        ) do
-    %{mlir_module: mlir_module, output_container: output_container, used_inputs: used_inputs} =
-      EXLA.to_mlir_module(fun, vars, exla_opts)
-
     nx_iree_module =
-      NxIREE.compile(mlir_module, iree_compiler_flags, output_container: output_container)
+      build_module(fun, vars, exla_opts, iree_compiler_flags, iree_runtime_options, autotune)
 
     if output_mode == :bytecode do
       throw({:bytecode, nx_iree_module})
     else
       fn [inputs] ->
         filtered_inputs =
-          filter_inputs_by_indices(inputs, used_inputs)
+          filter_inputs_by_indices(inputs, nx_iree_module.used_inputs)
 
         {:ok, result} =
           NxIREE.call(
@@ -109,134 +189,153 @@ defmodule NxIREE.Compiler do
     end
   end
 
+  defp build_module(fun, vars, exla_opts, iree_compiler_flags, iree_runtime_options, autotune) do
+    %{mlir_module: mlir_module, output_container: output_container, used_inputs: used_inputs} =
+      EXLA.to_mlir_module(fun, vars, exla_opts)
+
+    input_templates =
+      Enum.map(vars, &Nx.Defn.Composite.traverse(&1, fn t -> Nx.to_template(t) end))
+
+    nx_iree_module =
+      case autotune do
+        false ->
+          NxIREE.compile(mlir_module, iree_compiler_flags, output_container: output_container)
+
+        autotune ->
+          NxIREE.Compiler.Autotune.tune(
+            mlir_module,
+            iree_compiler_flags,
+            [output_container: output_container],
+            input_templates,
+            used_inputs,
+            iree_runtime_options,
+            if(autotune == true, do: [], else: autotune)
+          )
+      end
+
+    %{nx_iree_module | input_templates: input_templates, used_inputs: used_inputs}
+  end
+
   defp compile_with_graph_splitter(
          fun,
          vars,
          exla_opts,
          iree_compiler_flags,
-         iree_runtime_options
+         iree_runtime_options,
+         host_cpu_features?,
+         compile_concurrency,
+         partitioner_opts
        ) do
     expr = fun.(vars)
 
-    {stages, _, _} = GraphSplitter.traverse(expr)
+    {:ok, accelerator} =
+      NxIREE.Device.get(
+        partitioner_opts[:accelerator] || iree_runtime_options[:device] ||
+          NxIREE.Device.find_default_device("metal")
+      )
+
+    {:ok, host} = NxIREE.Device.get(partitioner_opts[:host] || "local-sync://")
+
+    partitioner_opts =
+      partitioner_opts
+      |> Keyword.put(:accelerator, accelerator)
+      |> Keyword.put(:host, host)
+
+    host_nodes = Partitioner.place(expr, partitioner_opts)
+    {stages, _, _} = GraphSplitter.traverse(expr, %{}, host_nodes)
+
+    host_compiler_flags =
+      iree_compiler_flags
+      |> Enum.map(fn
+        "--iree-hal-target-backends=" <> _ ->
+          "--iree-hal-target-backends=#{host.compiler_target_backend}"
 
+        flag ->
+          flag
+      end)
+      |> maybe_add_host_cpu_features(host.compiler_target_backend, host_cpu_features?)
+
+    targets = %{
+      none: {accelerator, iree_compiler_flags},
+      force_host: {host, host_compiler_flags}
+    }
+
+    caller_state = caller_state()
+
+    build_stage = fn stage ->
+      Enum.each(caller_state, fn {key, value} -> Process.put(key, value) end)
+
+      stage
+      |> lower_stage(exla_opts)
+      |> compile_stage(targets, iree_runtime_options)
+    end
+
+    # Stages are independent at compile time, so they are lowered and compiled
+    # concurrently. Results keep the stage order, which execution relies on.
     function_chain =
-      for {stage_id, tag, expr, arguments, argument_sources} <- stages do
-        fun = fn _ -> expr end
-
-        mlir_args =
-          arguments
-          |> Map.values()
-          |> Enum.sort_by(fn
-            %T{data: %Expr{op: :parameter, args: [idx]}} -> idx
-            _ -> nil
-          end)
+      stages
+      |> Task.async_stream(build_stage,
+        max_concurrency: compile_concurrency,
+        ordered: true,
+        timeout: :infinity
+      )
+      |> Enum.map(fn {:ok, stage} -> stage end)
 
-        %{mlir_module: mlir_module, output_container: output_container, used_inputs: used_inputs} =
-          EXLA.to_mlir_module(fun, mlir_args, exla_opts)
-
-        iree_compiler_flags =
-          if tag == :force_host do
-            Enum.map(iree_compiler_flags, fn
-              "--iree-hal-target-backends=metal-spirv" -> "--iree-hal-target-backends=llvm-cpu"
-              flag -> flag
-            end)
-          else
-            iree_compiler_flags
-          end
-
-        iree_runtime_options =
-          if tag == :force_host do
-            {:ok, device} = NxIREE.Device.get("local-sync://")
-            Keyword.put(iree_runtime_options, :device, device)
-          else
-            Keyword.put_new(
-              iree_runtime_options,
-              :device,
-              NxIREE.Device.find_default_device("metal")
-            )
-          end
+    fn [args] -> StageExecutor.run(function_chain, args) end
+  end
 
-        nx_iree_module =
-          NxIREE.compile(mlir_module, iree_compiler_flags, output_container: output_container)
+  # Nx and EXLA keep settings, such as the default backend, in the process
+  # dictionary, so tasks lowering stages start from the one of the caller
+  defp caller_state do
+    Enum.reject(Process.get(), fn {key, _value} ->
+      key in [:"$ancestors", :"$callers", :"$initial_call"]
+    end)
+  end
 
-        runtime_fun = fn [inputs] ->
-          filtered_inputs =
-            filter_inputs_by_indices(inputs, used_inputs)
+  defp lower_stage({stage_id, tag, expr, arguments, argument_sources}, exla_opts) do
+    fun = fn _ -> expr end
 
-          {:ok, result} =
-            NxIREE.call(
-              nx_iree_module,
-              filtered_inputs,
-              iree_runtime_options
-            )
+    mlir_args =
+      arguments
+      |> Map.values()
+      |> Enum.sort_by(fn
+        %T{data: %Expr{op: :parameter, args: [idx]}} -> idx
+        _ -> nil
+      end)
 
-          [result]
-        end
+    lowered = EXLA.to_mlir_module(fun, mlir_args, exla_opts)
+    {stage_id, tag, lowered, arguments, argument_sources}
+  end
 
-        {stage_id, tag, iree_runtime_options[:device], runtime_fun, arguments, argument_sources}
-      end
+  defp compile_stage(
+         {stage_id, tag, lowered, arguments, argument_sources},
+         targets,
+         iree_runtime_options
+       ) do
+    %{mlir_module: mlir_module, output_container: output_container, used_inputs: used_inputs} =
+      lowered
 
-    fn [args] ->
-      input_sources =
-        args
-        |> Enum.with_index()
-        |> Map.new(fn {arg, idx} ->
-          {{nil, idx}, arg}
-        end)
+    {device, iree_compiler_flags} = Map.fetch!(targets, tag)
+    iree_runtime_options = Keyword.put(iree_runtime_options, :device, device)
 
-      {_input_sources, result} =
-        for {stage_id, _tag, device, runtime_fun, arguments, argument_sources} <- function_chain,
-            reduce: {input_sources, nil} do
-          {input_sources, _prev_result} ->
-            {args, input_sources} =
-              Enum.map_reduce(arguments, input_sources, fn {id, param}, input_sources ->
-                %Nx.Tensor{data: %Nx.Defn.Expr{op: :parameter, args: [idx]}} = param
-                source_key = argument_sources[id]
-
-                case input_sources[source_key] do
-                  input when is_function(input, 0) ->
-                    val = input.()
-
-                    val =
-                      Nx.Defn.Composite.traverse(val, fn
-                        %Nx.Tensor{data: %NxIREE.Backend{}} = t -> t
-                        t -> Nx.backend_transfer(t, {NxIREE.Backend, device: device})
-                      end)
-
-                    {{idx, val}, Map.put(input_sources, source_key, val)}
-
-                  val ->
-                    {{idx, val}, input_sources}
-                end
-              end)
-
-            args =
-              args
-              |> Enum.sort_by(&elem(&1, 0))
-              |> Enum.map(fn {_idx, arg} ->
-                {:ok, buffer_ref} = NxIREE.VM.allocate_buffer(arg, device.ref)
-                arg = put_in(arg.data.ref, buffer_ref)
-                put_in(arg.data.device, device.ref)
-                put_in(arg.data.device_uri, device.uri)
-                put_in(arg.data.driver, device.driver_name)
-              end)
-
-            [results] = runtime_fun.([args])
-
-            input_sources =
-              [results]
-              |> Nx.Defn.Composite.flatten_list()
-              |> Enum.with_index()
-              |> Enum.reduce(input_sources, fn {result, idx}, acc ->
-                Map.put(acc, {stage_id, idx}, result)
-              end)
-
-            {input_sources, [results]}
-        end
+    nx_iree_module =
+      NxIREE.compile(mlir_module, iree_compiler_flags, output_container: output_container)
+
+    runtime_fun = fn [inputs] ->
+      filtered_inputs =
+        filter_inputs_by_indices(inputs, used_inputs)
+
+      {:ok, result} =
+        NxIREE.call(
+          nx_iree_module,
+          filtered_inputs,
+          iree_runtime_options
+        )
 
-      result
+      [result]
     end
+
+    {stage_id, tag, device, runtime_fun, arguments, argument_sources}
   end
 
   @impl true
@@ -245,17 +344,58 @@ defmodule NxIREE.Compiler do
   end
 
   @impl true
-  def __stream__(_key, _input, _acc, _vars, _fun, _args, _opts) do
-    raise "__stream__ not supported yet in NxIREE"
+  def __stream__(key, input, acc, vars, fun, [args], opts) do
+    # Streams always run as a single module, which is loaded once and
+    # called for every chunk
+    module =
+      try do
+        __compile__(key, vars, fun, Keyword.put(opts, :output_mode, :bytecode))
+      catch
+        {:bytecode, module} -> module
+      end
+
+    runtime_options = Keyword.get(opts, :iree_runtime_options, [])
+    [NxIREE.Stream.start_link(module, input, acc, args, runtime_options)]
   end
 
   @impl true
-  defdelegate __partitions_options__(opts), to: EXLA.Defn
+  def __partitions_options__(opts) do
+    case Keyword.pop(opts, :iree_partition_devices) do
+      {nil, opts} ->
+        [opts]
+
+      {devices, opts} ->
+        Enum.map(devices, fn device ->
+          Keyword.update(opts, :iree_runtime_options, [device: device], fn runtime_opts ->
+            Keyword.put(runtime_opts, :device, device)
+          end)
+        end)
+    end
+  end
 
   @impl true
   defdelegate __to_backend__(opts), to: EXLA.Defn
 
-  defp filter_inputs_by_indices(args, inputs) do
+  defp maybe_add_host_cpu_features(flags, "llvm-cpu", true) do
+    targets_host? =
+      not Enum.any?(
+        flags,
+        &String.starts_with?(&1, ["--iree-llvmcpu-target-cpu", "--iree-llvmcpu-target-triple"])
+      )
+
+    case NxIREE.Device.host_cpu_features() do
+      [_ | _] = features when targets_host? ->
+        flags ++ ["--iree-llvmcpu-target-cpu-features=" <> Enum.join(features, ",")]
+
+      _ ->
+        flags
+    end
+  end
+
+  defp maybe_add_host_cpu_features(flags, _backend, _host_cpu_features?), do: flags
+
+  @doc false
+  def filter_inputs_by_indices(args, inputs) do
     filter_by_indices_list(args, 0, Enum.sort(inputs), fn x, _ -> x end)
   end
 
@@ -0,0 +1,217 @@
+defmodule NxIREE.Compiler.Autotune do
+  @moduledoc """
+  Picks `iree-compile` flags for a model by measuring them.
+
+  The model is compiled once per candidate flag set and each resulting
+  module is run on the target device. The flags of the fastest module
+  are recorded so that the next compilation of the same model with the
+  same base flags for the same device skips the search. Records are kept in memory and, when
+  the `:cache_dir` setting of the `:nx_iree` application is set, also on
+  disk next to the compiled artifacts.
+
+  This is used by `NxIREE.Compiler` through the `:iree_autotune` option:
+
+      Nx.Defn.jit(&MyModel.predict/2,
+        compiler: NxIREE.Compiler,
+        iree_compiler_flags: ["--iree-input-type=stablehlo_xla"],
+        iree_runtime_options: [device: "local-task://"],
+        iree_autotune: [runs: 20]
+      )
+
+  ## Options
+
+    * `:candidates` - a list of flag lists to try. Each candidate is merged
+      into the base flags, replacing base flags that set the same option.
+      Defaults to `default_candidates/0`.
+    * `:inputs` - representative inputs, in the same structure as the
+      arguments of the function. Defaults to inputs filled with ones.
+    * `:runs` - how many times each candidate is run. The median time,
+      the mean of the two middle times for even runs, is kept. Defaults
+      to `10`.
+    * `:warmup` - how many runs are discarded before measuring. Defaults to `1`.
+    * `:force` - searches again even if a record exists. Defaults to `false`.
+  """
+
+  require Logger
+
+  @records_key {__MODULE__, :records}
+
+  @default_candidates [
+    [],
+    ["--iree-opt-data-tiling=true"],
+    ["--iree-llvmcpu-enable-ukernels=all"],
+    ["--iree-opt-data-tiling=true", "--iree-llvmcpu-enable-ukernels=all"],
+    ["--iree-flow-enable-aggressive-fusion=true"],
+    ["--iree-opt-aggressively-propagate-transposes=true"]
+  ]
+
+  @doc """
+  The candidate flag sets tried by default.
+  """
+  def default_candidates, do: @default_candidates
+
+  @doc """
+  Returns the recorded flags for the given MLIR module, base flags and
+  device, if any.
+
+  `device` is given as in `NxIREE.call/3` and defaults to the default
+  device. Timings only hold for the device they were taken on, so every
+  device gets its own records.
+  """
+  def fetch_record(mlir_module, flags, device \\ nil) do
+    key = record_key(mlir_module, flags, device)
+
+    case :persistent_term.get(@records_key, %{}) do
+      %{^key => record} ->
+        {:ok, record}
+
+      _ ->
+        with cache_dir when is_binary(cache_dir) <- Application.get_env(:nx_iree, :cache_dir),
+             {:ok, binary} <- NxIREE.Compiler.Cache.fetch(cache_dir, key, ".tuning") do
+          record = :erlang.binary_to_term(binary, [:safe])
+          put_record_in_memory(key, record)
+          {:ok, record}
+        else
+          _ -> :error
+        end
+    end
+  end
+
+  @doc """
+  Compiles `mlir_module` with each candidate flag set and returns the
+  module compiled with the fastest one.
+
+  `input_templates` and `used_inputs` describe the arguments of the
+  module as in `NxIREE.Module`. `runtime_opts` are given to `NxIREE.call/3`.
+  """
+  def tune(mlir_module, flags, compile_opts, input_templates, used_inputs, runtime_opts, opts) do
+    opts =
+      Keyword.validate!(opts,
+        candidates: @default_candidates,
+        inputs: nil,
+        runs: 10,
+        warmup: 1,
+        force: false
+      )
+
+    device = runtime_opts[:device]
+    record = if opts[:force], do: :error, else: fetch_record(mlir_module, flags, device)
+
+    case record do
+      {:ok, %{flags: best_flags}} ->
+        NxIREE.compile(mlir_module, best_flags, compile_opts)
+
+      :error ->
+        inputs = synthetic_inputs(input_templates, used_inputs, opts[:inputs])
+
+        results =
+          for candidate <- Enum.uniq(opts[:candidates]),
+              candidate_flags = merge_flags(flags, candidate),
+              {:ok, module, time} <-
+                [measure(mlir_module, candidate_flags, compile_opts, inputs, runtime_opts, opts)] do
+            {candidate_flags, module, time}
+          end
+
+        if results == [] do
+          raise "none of the autotuning candidates could be compiled and run"
+        end
+
+        {best_flags, best_module, best_time} = Enum.min_by(results, &elem(&1, 2))
+
+        record(mlir_module, flags, device, %{
+          flags: best_flags,
+          time_us: best_time,
+          timings: Enum.map(results, fn {flags, _, time} -> {flags, time} end)
+        })
+
+        best_module
+    end
+  end
+
+  @doc """
+  Merges `extra` into `flags`, dropping flags from `flags` that set
+  the same option as a flag in `extra`.
+  """
+  def merge_flags(flags, extra) do
+    names = MapSet.new(extra, &flag_name/1)
+    Enum.reject(flags, &(flag_name(&1) in names)) ++ extra
+  end
+
+  defp flag_name(flag), do: flag |> String.split("=", parts: 2) |> hd()
+
+  defp measure(mlir_module, flags, compile_opts, inputs, runtime_opts, opts) do
+    module = NxIREE.compile(mlir_module, flags, compile_opts)
+
+    for _ <- 1..opts[:warmup]//1 do
+      {:ok, _} = NxIREE.call(module, inputs, runtime_opts)
+    end
+
+    times =
+      for _ <- 1..max(opts[:runs], 1) do
+        {time, {:ok, _}} = :timer.tc(fn -> NxIREE.call(module, inputs, runtime_opts) end)
+        time
+      end
+
+    {:ok, module, median(times)}
+  rescue
+    error ->
+      Logger.debug(
+        "autotuning candidate #{inspect(flags)} failed: " <> Exception.message(error)
+      )
+
+      :error
+  end
+
+  defp median(times) do
+    sorted = Enum.sort(times)
+    count = length(sorted)
+    middle = div(count, 2)
+
+    if rem(count, 2) == 1 do
+      Enum.at(sorted, middle)
+    else
+      div(Enum.at(sorted, middle - 1) + Enum.at(sorted, middle), 2)
+    end
+  end
+
+  defp synthetic_inputs(input_templates, used_inputs, nil) do
+    input_templates
+    |> NxIREE.Measure.synthetic_inputs()
+    |> NxIREE.Compiler.filter_inputs_by_indices(used_inputs)
+  end
+
+  defp synthetic_inputs(_input_templates, used_inputs, inputs) do
+    inputs
+    |> Nx.Defn.Composite.flatten_list()
+    |> NxIREE.Compiler.filter_inputs_by_indices(used_inputs)
+  end
+
+  defp record(mlir_module, flags, device, record) do
+    key = record_key(mlir_module, flags, device)
+    put_record_in_memory(key, record)
+
+    if cache_dir = Application.get_env(:nx_iree, :cache_dir) do
+      NxIREE.Compiler.Cache.put(cache_dir, key, :erlang.term_to_binary(record), ".tuning")
+    end
+
+    :ok
+  end
+
+  defp put_record_in_memory(key, record) do
+    records = :persistent_term.get(@records_key, %{})
+    :persistent_term.put(@records_key, Map.put(records, key, record))
+  end
+
+  # Devices sharing a compiler target backend still run at different speeds,
+  # so the key tells them apart by node and URI
+  defp record_key(mlir_module, flags, device) do
+    device =
+      case NxIREE.Device.get(device) do
+        {:ok, %NxIREE.Device{node: node, uri: uri}} -> {node, uri}
+        _ -> nil
+      end
+
+    :crypto.hash(:sha256, :erlang.term_to_binary({mlir_module, flags, device}))
+    |> Base.encode16(case: :lower)
+  end
+end
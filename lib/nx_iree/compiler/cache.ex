@@ -0,0 +1,47 @@
+defmodule NxIREE.Compiler.Cache do
+  @moduledoc false
+
+  # On-disk cache of compiled bytecode.
+  #
+  # Entries are keyed on the MLIR module, the compiler flags (which include
+  # the target CPU features, see `NxIREE.Compiler`) and the compiler binary
+  # itself, so that artifacts built for another host or by another
+  # `iree-compile` are never reused. Other artifacts derived from a model,
+  # such as autotuning records, are stored alongside under another extension.
+
+  def key(mlir_module, flags, compiler_path) do
+    compiler_stamp =
+      case File.stat(compiler_path, time: :posix) do
+        {:ok, %File.Stat{size: size, mtime: mtime}} -> {size, mtime}
+        {:error, _} -> nil
+      end
+
+    :crypto.hash(:sha256, :erlang.term_to_binary({mlir_module, flags, compiler_stamp}))
+    |> Base.encode16(case: :lower)
+  end
+
+  def fetch(cache_dir, key, extension \\ ".vmfb") do
+    case File.read(entry_path(cache_dir, key, extension)) do
+      {:ok, bytecode} -> {:ok, bytecode}
+      {:error, _} -> :error
+    end
+  end
+
+  def put(cache_dir, key, contents, extension \\ ".vmfb") do
+    path = entry_path(cache_dir, key, extension)
+    # Write to a temporary file first so concurrent readers never observe a partial entry
+    tmp_path = "#{path}.#{System.unique_integer([:positive])}.tmp"
+
+    with :ok <- File.mkdir_p(cache_dir),
+         :ok <- File.write(tmp_path, contents),
+         :ok <- File.rename(tmp_path, path) do
+      :ok
+    else
+      error ->
+        File.rm(tmp_path)
+        error
+    end
+  end
+
+  defp entry_path(cache_dir, key, extension), do: Path.join(cache_dir, key <> extension)
+end
@@ -0,0 +1,209 @@
+defmodule NxIREE.Compiler.DataParallel do
+  @moduledoc """
+  Data-parallel execution of a function over several devices.
+
+  The sharded inputs are split along their batch axis into one slice per
+  device. A replica of the function runs on each device concurrently, and
+  the outputs are concatenated back along the batch axis. This only
+  gives the same result as a single call when the function treats batch
+  entries independently, as is the case for most inference workloads.
+  The gathered outputs are placed on the first device.
+
+  This is used by `NxIREE.Compiler` through the `:iree_data_parallel` option:
+
+      Nx.Defn.jit(&MyModel.predict/2,
+        compiler: NxIREE.Compiler,
+        iree_compiler_flags: ["--iree-input-type=stablehlo_xla"],
+        iree_data_parallel: [
+          devices: ["local-task://", "local-task://"],
+          input_axes: [nil, 0]
+        ]
+      )
+
+  The same device may be listed more than once, in which case its
+  replicas run concurrently on it. All devices must share the same
+  compiler target backend.
+
+  ## Options
+
+    * `:devices` - the devices to run the replicas on, as URIs or
+      `NxIREE.Device` structs. Required.
+    * `:input_axes` - the batch axis of each argument, or `nil` for
+      arguments which are replicated on every device instead of split.
+      Applies to every tensor within an argument. Defaults to `0` for
+      every argument.
+    * `:output_axis` - the axis along which the outputs are concatenated.
+      Every output must be batched along it, otherwise compilation raises.
+      Defaults to `0`.
+  """
+
+  alias Nx.Defn.Composite
+
+  @doc """
+  Compiles a replica of the function for each distinct slice size and
+  returns the runtime function.
+
+  `build_module` receives the templates of a replica's arguments and
+  returns the compiled `NxIREE.Module`.
+  """
+  def compile(vars, opts, build_module) do
+    opts = Keyword.validate!(opts, [:devices, input_axes: nil, output_axis: 0])
+
+    devices =
+      Enum.map(opts[:devices] || [], fn device ->
+        {:ok, device} = NxIREE.Device.get(device)
+        device
+      end)
+
+    if devices == [] do
+      raise ArgumentError, ":iree_data_parallel requires a non-empty list of :devices"
+    end
+
+    input_axes = opts[:input_axes] || List.duplicate(0, length(vars))
+
+    if length(input_axes) != length(vars) do
+      raise ArgumentError,
+            "expected one entry in :input_axes per argument (#{length(vars)}), " <>
+              "got: #{inspect(input_axes)}"
+    end
+
+    batch_size = batch_size(vars, input_axes)
+    slice_sizes = slice_sizes(batch_size, length(devices))
+
+    modules =
+      slice_sizes
+      |> Enum.uniq()
+      |> Map.new(fn size -> {size, build_module.(replica_vars(vars, input_axes, size))} end)
+
+    output_axis = opts[:output_axis]
+
+    if length(slice_sizes) > 1 do
+      Enum.each(modules, fn {size, module} ->
+        check_batched_outputs!(module, size, output_axis)
+      end)
+    end
+
+    # The flat argument positions that belong to each argument
+    flat_axes =
+      Enum.zip_with(vars, input_axes, fn var, axis ->
+        List.duplicate(axis, length(Composite.flatten_list([var])))
+      end)
+      |> List.flatten()
+
+    replicas =
+      devices
+      |> Enum.zip(slice_sizes)
+      |> Enum.map_reduce(0, fn {device, size}, offset ->
+        {{device, offset, size}, offset + size}
+      end)
+      |> elem(0)
+
+    gather_device = hd(devices)
+
+    fn [args] ->
+      args = Enum.map(args, fn arg -> if is_function(arg, 0), do: arg.(), else: arg end)
+      tenant = NxIREE.Quota.get_tenant()
+
+      results =
+        replicas
+        |> Enum.map(fn {device, offset, size} ->
+          module = Map.fetch!(modules, size)
+          inputs = slice_inputs(args, flat_axes, offset, size)
+
+          Task.async(fn ->
+            inputs = NxIREE.Compiler.filter_inputs_by_indices(inputs, module.used_inputs)
+            {:ok, result} = NxIREE.call(module, inputs, device: device, tenant: tenant)
+            result
+          end)
+        end)
+        |> Task.await_many(:infinity)
+
+      [gather(results, output_axis, gather_device)]
+    end
+  end
+
+  defp batch_size(vars, input_axes) do
+    sizes =
+      for {var, axis} <- Enum.zip(vars, input_axes),
+          axis != nil,
+          %Nx.Tensor{shape: shape} <- Composite.flatten_list([var]),
+          uniq: true,
+          do: elem(shape, axis)
+
+    case sizes do
+      [size] ->
+        size
+
+      [] ->
+        raise ArgumentError,
+              ":iree_data_parallel requires at least one argument with a batch axis"
+
+      sizes ->
+        raise ArgumentError,
+              "all sharded inputs must have the same batch size, got: #{inspect(sizes)}"
+    end
+  end
+
+  # Splits the batch as evenly as possible, leaving out devices with nothing to do
+  defp slice_sizes(batch_size, num_devices) do
+    base = div(batch_size, num_devices)
+    remainder = rem(batch_size, num_devices)
+
+    0..(num_devices - 1)
+    |> Enum.map(fn i -> if i < remainder, do: base + 1, else: base end)
+    |> Enum.reject(&(&1 == 0))
+  end
+
+  # Gathering concatenates every output along the output axis, so outputs
+  # which do not grow with the batch would come back with the wrong shape
+  defp check_batched_outputs!(%NxIREE.Module{output_container: container}, size, axis) do
+    for %Nx.Tensor{shape: shape} <- Composite.flatten_list([container]),
+        tuple_size(shape) <= axis or elem(shape, axis) != size do
+      raise ArgumentError,
+            "every output must be batched along the output axis #{axis} to be gathered, " <>
+              "got an output of shape #{inspect(shape)} for a slice of #{size} entries"
+    end
+
+    :ok
+  end
+
+  defp replica_vars(vars, input_axes, size) do
+    Enum.zip_with(vars, input_axes, fn
+      var, nil ->
+        Composite.traverse(var, &Nx.to_template/1)
+
+      var, axis ->
+        Composite.traverse(var, fn %Nx.Tensor{shape: shape, type: type, names: names} ->
+          Nx.template(put_elem(shape, axis, size), type, names: names)
+        end)
+    end)
+  end
+
+  defp slice_inputs(args, flat_axes, offset, size) do
+    Enum.zip_with(args, flat_axes, fn
+      arg, nil -> arg
+      arg, axis -> Nx.slice_along_axis(arg, offset, size, axis: axis)
+    end)
+  end
+
+  defp gather([result], _axis, _device), do: result
+
+  # The shards live on different devices, so they are staged on the host
+  # and the concatenated output is uploaded to the gather device
+  defp gather([first | _] = results, axis, device) do
+    outputs =
+      results
+      |> Enum.map(&Composite.flatten_list([&1]))
+      |> Enum.zip_with(fn shards ->
+        shards
+        |> Enum.map(&Nx.backend_transfer(&1, Nx.BinaryBackend))
+        |> Nx.concatenate(axis: axis)
+        |> Nx.backend_transfer({NxIREE.Backend, device: device})
+      end)
+
+    {result, []} =
+      Composite.traverse(first, outputs, fn _, [output | outputs] -> {output, outputs} end)
+
+    result
+  end
+end
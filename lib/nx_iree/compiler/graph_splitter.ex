@@ -4,21 +4,29 @@ defmodule NxIREE.Compiler.GraphSplitter do
   alias Nx.Tensor, as: T
   alias Nx.Defn.Expr
 
-  @non_metal_ops [
-    :count_leading_zeros,
-    :population_count,
-    :sort,
-    :mode,
-    :argmax,
-    :argmin,
-    :is_nan,
-    :median
-  ]
-
-  def traverse(expr, expr_shards \\ %{}) do
+  alias NxIREE.Compiler.Partitioner
+
+  # Ops whose arguments hold bodies with their own scope. Values inside
+  # them are never shared across stages.
+  @scoped_ops [:fun, :while, :cond, :token]
+
+  # Ops that are cheaper to recompute than to pass between stages
+  @not_reusable_ops [:parameter, :constant, :tensor, :iota, :eye, :fun]
+
+  @doc """
+  Splits `expr` into stages.
+
+  `host_nodes` is the set of node ids which run on the host device, as
+  returned by `NxIREE.Compiler.Partitioner.place/2`. Defaults to the ops
+  Metal does not support.
+  """
+  def traverse(expr, expr_shards \\ %{}, host_nodes \\ nil) do
+    host_nodes = host_nodes || Partitioner.place(expr, optimize: false)
+
     # expression_chain is going to be a reverse-accumulation of {category, subexpr}
     # that we can then compile and chain-execute elsewhere. category is either :gather, :reduce or :none
     state = %{
+      host_nodes: host_nodes,
       expression_chain: [],
       nodes_to_replace: %{},
       # contains the sharding configuration for each node by id
@@ -30,75 +38,156 @@ defmodule NxIREE.Compiler.GraphSplitter do
     cache = %{}
     {expr, {cache, state}} = composite_eval(expr, state, cache)
 
+    # Stages are accumulated in reverse, so we flip them into execution order.
+    # Each stage may reuse values computed by the stages before it, which are
+    # then exported as extra outputs of the stage that computes them.
+    stages =
+      Enum.reverse([{make_ref(), :none, expr, state.nodes_to_replace} | state.expression_chain])
+
+    reuse = %{
+      # id of a node computed by a previous stage -> parameter that replaces it
+      reusable: %{},
+      # parameter id -> {producer stage_id, node id}
+      producers: %{},
+      # producer stage_id -> node ids to export, in output order
+      exports: %{},
+      # parameter id -> {producer stage_id, output_container_position}
+      sources: %{},
+      # stage_id -> number of outputs before exports
+      output_counts: %{},
+      # stage_id -> node id -> node, as computed within the stage
+      computed: %{},
+      # reuse parameters are numbered after all other parameters
+      param_offset: map_size(state.args)
+    }
+
+    {expr_chain, reuse} =
+      Enum.map_reduce(stages, reuse, fn {id, category, expr, nodes_to_replace}, reuse ->
+        {expr, %{used_args: used_args}} =
+          composite_rewrite_subtree(
+            expr,
+            rewrite_state(state, nodes_to_replace, reuse.reusable)
+          )
+
+        reuse = export_reused_args(used_args, reuse)
+
+        arg_remapping =
+          used_args
+          |> Enum.sort_by(fn {_id, {%T{data: %Expr{op: :parameter, args: [idx]}}, _shards}} ->
+            idx
+          end)
+          |> Enum.with_index(fn
+            {id, {expr, nil}}, idx ->
+              {id, put_in(expr.data.args, [idx])}
+
+            {id, {expr, shard_propagation}}, idx ->
+              expr = put_in(expr.data.args, [idx])
+              expr = Expr.metadata(expr, %{shards: shard_propagation.shards})
+              {id, expr}
+          end)
+          |> Map.new()
+
+        {expr, %{computed: computed}} =
+          composite_rewrite_subtree(expr, rewrite_state(state, arg_remapping, %{}))
+
+        expr =
+          Composite.traverse(expr, fn
+            %T{data: %Expr{id: id}} = t ->
+              if shard_propagation = state.shards[id] do
+                Expr.metadata(t, %{shards: shard_propagation.shards})
+              else
+                t
+              end
+
+            other ->
+              other
+          end)
+
+        arguments = Map.new(arg_remapping, fn {_id, expr} -> {expr.data.id, expr} end)
+
+        argument_sources =
+          Map.merge(state.args, reuse.sources)
+          |> Map.take(Map.keys(arg_remapping))
+          |> Map.new(fn {remap_id, v} ->
+            {arg_remapping[remap_id].data.id, v}
+          end)
+
+        reuse = register_computed(id, expr, computed, reuse)
+
+        {{id, category, expr, arguments, argument_sources}, reuse}
+      end)
+
     expr_chain =
-      Enum.reduce(
-        [{make_ref(), :none, expr, state.nodes_to_replace} | state.expression_chain],
-        [],
-        fn {id, category, expr, nodes_to_replace}, acc ->
-          # TO-DO: we need to also do a pass to avoid recalculating results that have been previously calculated.
-          # For example:
-          # x = arg0 + arg1
-          # y = arg0 - arg1
-          # z = x + y
-          # -----
-          # w = dot(z, arg1)
-          # y + w <- here, we currently have to recalculate y given that only z, arg0 and arg1 will be passed as arguments.
-          #          ideally, we should also pass y as a value to avoid recalculating it.
-          #          We might be able to calculate this in the first traversal somehow.
-
-          {expr, %{used_args: used_args}} =
-            composite_rewrite_subtree(
-              expr,
-              %{state | nodes_to_replace: nodes_to_replace}
-            )
-
-          arg_remapping =
-            used_args
-            |> Enum.sort_by(fn {_id, {%T{data: %Expr{op: :parameter, args: [idx]}}, _shards}} ->
-              idx
-            end)
-            |> Enum.with_index(fn
-              {id, {expr, nil}}, idx ->
-                {id, put_in(expr.data.args, [idx])}
-
-              {id, {expr, shard_propagation}}, idx ->
-                expr = put_in(expr.data.args, [idx])
-                expr = Expr.metadata(expr, %{shards: shard_propagation.shards})
-                {id, expr}
-            end)
-            |> Map.new()
-
-          {expr, _} =
-            composite_rewrite_subtree(expr, %{state | nodes_to_replace: arg_remapping})
-
-          expr =
-            Composite.traverse(expr, fn
-              %T{data: %Expr{id: id}} = t ->
-                if shard_propagation = state.shards[id] do
-                  Expr.metadata(t, %{shards: shard_propagation.shards})
-                else
-                  t
-                end
-
-              other ->
-                other
-            end)
-
-          arguments = Map.new(arg_remapping, fn {_id, expr} -> {expr.data.id, expr} end)
-
-          argument_sources =
-            Map.take(state.args, Map.keys(arg_remapping))
-            |> Map.new(fn {remap_id, v} ->
-              {arg_remapping[remap_id].data.id, v}
-            end)
-
-          [{id, category, expr, arguments, argument_sources} | acc]
+      Enum.map(expr_chain, fn {id, category, expr, arguments, argument_sources} = stage ->
+        case reuse.exports do
+          %{^id => node_ids} ->
+            exported = Enum.map(node_ids, &Map.fetch!(reuse.computed[id], &1))
+            expr = List.to_tuple(Tuple.to_list(expr) ++ exported)
+            {id, category, expr, arguments, argument_sources}
+
+          _ ->
+            stage
         end
-      )
+      end)
 
     {expr_chain, Map.delete(state, :expression_chain), cache}
   end
 
+  defp rewrite_state(state, nodes_to_replace, reusable) do
+    state
+    |> Map.put(:nodes_to_replace, nodes_to_replace)
+    |> Map.put(:reusable, reusable)
+    |> Map.put(:nested?, false)
+  end
+
+  # Assigns an output position in the producer stage to each reused
+  # value, appending it to the producer's exports the first time.
+  defp export_reused_args(used_args, reuse) do
+    Enum.reduce(used_args, reuse, fn {param_id, _}, reuse ->
+      case reuse.producers do
+        %{^param_id => {stage_id, node_id}} when not is_map_key(reuse.sources, param_id) ->
+          exports = Map.get(reuse.exports, stage_id, [])
+          position = reuse.output_counts[stage_id] + length(exports)
+
+          %{
+            reuse
+            | exports: Map.put(reuse.exports, stage_id, exports ++ [node_id]),
+              sources: Map.put(reuse.sources, param_id, {stage_id, position})
+          }
+
+        _ ->
+          reuse
+      end
+    end)
+  end
+
+  # Makes the values computed by a stage available to the following stages.
+  # Values computed by an earlier stage keep their original producer.
+  defp register_computed(stage_id, expr, computed, reuse) do
+    reuse =
+      Enum.reduce(computed, reuse, fn {node_id, node}, reuse ->
+        if Map.has_key?(reuse.reusable, node_id) do
+          reuse
+        else
+          param = Expr.parameter(node, reuse.param_offset + map_size(reuse.producers))
+
+          %{
+            reuse
+            | reusable: Map.put(reuse.reusable, node_id, param),
+              producers: Map.put(reuse.producers, param.data.id, {stage_id, node_id})
+          }
+        end
+      end)
+
+    output_count = length(Composite.flatten_list([expr]))
+
+    %{
+      reuse
+      | output_counts: Map.put(reuse.output_counts, stage_id, output_count),
+        computed: Map.put(reuse.computed, stage_id, computed)
+    }
+  end
+
   defp composite_eval(expr, state, cache) do
     Composite.traverse(expr, {cache, state}, &eval/2)
   end
@@ -114,7 +203,7 @@ defmodule NxIREE.Compiler.GraphSplitter do
 
       {_, _} ->
         cond do
-          op in @non_metal_ops ->
+          MapSet.member?(state.host_nodes, id) ->
             rewrite_args(ans, {cache, state})
 
           true ->
@@ -127,60 +216,124 @@ defmodule NxIREE.Compiler.GraphSplitter do
     {other, {cache, state}}
   end
 
+  # Host nodes connected to each other run as a single :force_host stage,
+  # preceded by a stage computing the inputs the island reads from the
+  # accelerator. Every node of the island is an output, as nodes outside
+  # the island may read any of them.
   defp rewrite_args(expr, {cache, state}) do
-    {args, {cache, state}} = Nx.Defn.Tree.apply_args(expr, {cache, state}, &eval/2)
+    stage_id = make_ref()
+    second_stage_id = make_ref()
+
+    island = %{stage_id: stage_id, inputs: %{}, tensor_args: [], nodes: %{}, absorbed: []}
+    {new_expr, {cache, state, island}} = absorb(expr, {cache, state, island})
 
     # We need to save this so that each previous stage
     # isn't affected by following ones
     nodes_to_replace = state.nodes_to_replace
 
-    stage_id = make_ref()
-    second_stage_id = make_ref()
+    state = %{state | nodes_to_replace: Map.merge(state.nodes_to_replace, island.inputs)}
+    outputs = [new_expr | Enum.reverse(island.absorbed)]
 
-    {args, {tensor_args, _out_position, state}} =
-      Enum.map_reduce(args, {[], 0, state}, fn
-        %T{} = expr, {tensor_args, out_position, state} ->
-          arg = Expr.parameter(expr, map_size(state.args))
+    {[arg | _], {cache, state}} =
+      outputs
+      |> Enum.with_index()
+      |> Enum.map_reduce({cache, state}, fn {node, position}, {cache, state} ->
+        arg = Expr.parameter(node, map_size(state.args))
 
-          state = %{
-            state
-            | args: Map.put(state.args, arg.data.id, {stage_id, out_position}),
-              nodes_to_replace: Map.put(state.nodes_to_replace, expr.data.id, arg),
-              shards: Map.put(state.shards, arg.data.id, state.shards[expr.data.id])
-          }
-
-          {arg, {[expr | tensor_args], out_position + 1, state}}
+        state = %{
+          state
+          | args: Map.put(state.args, arg.data.id, {second_stage_id, position}),
+            nodes_to_replace: Map.put(state.nodes_to_replace, node.data.id, arg)
+        }
 
-        non_tensor_arg, acc ->
-          {non_tensor_arg, acc}
+        cache = Map.put(cache, node.data.id, node)
+        cache = Map.put(cache, arg.data.id, arg)
+        {arg, {cache, state}}
       end)
 
-    new_expr = put_in(expr.data.args, args)
-
-    arg = Expr.parameter(new_expr, map_size(state.args))
-
-    state = %{
-      state
-      | args: Map.put(state.args, arg.data.id, {second_stage_id, 0}),
-        nodes_to_replace: Map.put(state.nodes_to_replace, new_expr.data.id, arg)
-    }
+    args_stages =
+      if island.tensor_args == [] do
+        []
+      else
+        tensor_args = List.to_tuple(Enum.reverse(island.tensor_args))
+        [{stage_id, :none, tensor_args, nodes_to_replace}]
+      end
 
     state =
       update_in(
         state.expression_chain,
         &[
-          {second_stage_id, :force_host, {new_expr}, nodes_to_replace},
-          {stage_id, :none, List.to_tuple(Enum.reverse(tensor_args)), nodes_to_replace}
-          | &1
+          {second_stage_id, :force_host, List.to_tuple(outputs), nodes_to_replace}
+          | args_stages ++ &1
         ]
       )
 
-    cache = Map.put(cache, new_expr.data.id, new_expr)
-    cache = Map.put(cache, arg.data.id, arg)
-
     {arg, {cache, state}}
   end
 
+  # Pulls the host nodes `expr` reads into its island. Bodies of scoped
+  # ops are left alone, as their values never leave the scope.
+  defp absorb(%T{data: %Expr{op: op}} = expr, acc) do
+    {args, {cache, state, island}} =
+      Nx.Defn.Tree.apply_args(expr, acc, &absorb_arg(&1, &2, op not in @scoped_ops))
+
+    expr = put_in(expr.data.args, args)
+    island = %{island | nodes: Map.put(island.nodes, expr.data.id, expr)}
+    {expr, {cache, state, island}}
+  end
+
+  defp absorb_arg(%T{data: %Expr{id: id}} = arg, {cache, state, island}, absorb?) do
+    cond do
+      node = island.nodes[id] ->
+        {node, {cache, state, island}}
+
+      absorb? and MapSet.member?(state.host_nodes, id) and not is_map_key(cache, id) and
+          not is_map_key(state.nodes_to_replace, id) ->
+        {node, {cache, state, island}} = absorb(arg, {cache, state, island})
+        {node, {cache, state, %{island | absorbed: [node | island.absorbed]}}}
+
+      true ->
+        {arg, {cache, state}} = eval(arg, {cache, state})
+        {arg, state, island} = island_input(arg, state, island)
+        {arg, {cache, state, island}}
+    end
+  end
+
+  defp absorb_arg(other, acc, _absorb?), do: {other, acc}
+
+  # Already the output of a previous stage or a function argument,
+  # so it can be read directly instead of going through a new stage
+  defp island_input(%T{data: %Expr{op: :parameter}} = param, state, island) do
+    {param, state, island}
+  end
+
+  defp island_input(%T{data: %Expr{id: id}} = expr, state, island) do
+    case island.inputs do
+      %{^id => arg} ->
+        {arg, state, island}
+
+      %{} ->
+        arg = Expr.parameter(expr, map_size(state.args))
+        position = map_size(island.inputs)
+
+        state = %{
+          state
+          | args: Map.put(state.args, arg.data.id, {island.stage_id, position}),
+            shards: Map.put(state.shards, arg.data.id, state.shards[id])
+        }
+
+        island = %{
+          island
+          | inputs: Map.put(island.inputs, id, arg),
+            tensor_args: [expr | island.tensor_args]
+        }
+
+        {arg, state, island}
+    end
+  end
+
+  defp island_input(non_tensor_arg, state, island), do: {non_tensor_arg, state, island}
+
   defp eval_apply(:parameter, %T{data: %Expr{id: id, args: [idx]}} = expr, {cache, state}) do
     state = put_in(state.args[id], {nil, idx})
     {expr, {Map.put(cache, id, expr), state}}
@@ -198,7 +351,7 @@ defmodule NxIREE.Compiler.GraphSplitter do
     {ans, {Map.put(cache, id, ans), state}}
   end
 
-  defp composite_rewrite_subtree(container, state, acc \\ %{used_args: %{}})
+  defp composite_rewrite_subtree(container, state, acc \\ %{used_args: %{}, computed: %{}})
 
   defp composite_rewrite_subtree(container, state, acc) when is_list(container) do
     Enum.map_reduce(container, acc, fn
@@ -243,17 +396,34 @@ defmodule NxIREE.Compiler.GraphSplitter do
     end
   end
 
-  defp rewrite_subtree(%T{data: %Expr{id: id, args: args}} = expr, state, acc) do
-    case state.nodes_to_replace do
-      %{^id => res} ->
+  defp rewrite_subtree(%T{data: %Expr{id: id, op: op, args: args}} = expr, state, acc) do
+    case state do
+      %{nodes_to_replace: %{^id => res}} ->
         # nodes_to_replace always contains a param
         {res, put_in(acc.used_args[id], {res, state.shards[id]})}
 
+      %{nested?: false, reusable: %{^id => param}} ->
+        # computed by a previous stage, which exports it
+        {param, put_in(acc.used_args[param.data.id], {param, state.shards[id]})}
+
       _ ->
-        {args, acc} = composite_rewrite_subtree(args, state, acc)
-        {put_in(expr.data.args, args), acc}
+        args_state = if op in @scoped_ops, do: %{state | nested?: true}, else: state
+        {args, acc} = composite_rewrite_subtree(args, args_state, acc)
+        expr = put_in(expr.data.args, args)
+
+        acc =
+          if state.nested? or not reusable?(expr) do
+            acc
+          else
+            put_in(acc.computed[id], expr)
+          end
+
+        {expr, acc}
     end
   end
 
   defp rewrite_subtree(other, _, acc), do: {other, acc}
+
+  defp reusable?(%T{type: {:tuple, _}}), do: false
+  defp reusable?(%T{data: %Expr{op: op}}), do: op not in @not_reusable_ops
 end
@@ -0,0 +1,320 @@
+defmodule NxIREE.Compiler.Partitioner do
+  @moduledoc """
+  Decides which nodes of a `defn` expression run on the host device
+  when a function is split across two devices.
+
+  The function runs on an accelerator device, which may not support
+  every op, and on a host device, which supports all of them. Nodes
+  the accelerator does not support always run on the host. Every other
+  node is placed where its estimated cost is lowest, accounting for:
+
+    * the node's compute time on each device, from its FLOPs and the
+      device throughput
+    * the time to move its inputs and outputs between devices, from the
+      tensor sizes, the transfer bandwidth and a fixed per-transfer latency
+
+  Placement starts from the legal placement and improves it by local
+  search. This also merges small host islands back into the accelerator
+  when the transfers around them cost more than the compute they save.
+
+  Both devices can be CPUs. For example, `local-sync://` can run small
+  ops without scheduling overhead while `local-task://` runs the large ones:
+
+      Nx.Defn.jit(&MyModel.predict/2,
+        compiler: NxIREE.Compiler,
+        iree_compiler_flags: ["--iree-input-type=stablehlo_xla"],
+        iree_partitioner: [accelerator: "local-task://", host: "local-sync://"]
+      )
+
+  ## Options
+
+    * `:accelerator` - the accelerator device, as a URI or `NxIREE.Device`.
+      Defaults to `"metal://"`.
+    * `:host` - the host device, as a URI or `NxIREE.Device`.
+      Defaults to `"local-sync://"`.
+    * `:profiles` - per-driver profiles, keyed by driver name. Each is merged
+      into the matching entry of `default_profiles/0`. A profile is a map with
+      `:unsupported_ops`, `:flops_per_second` and `:launch_overhead` (in seconds).
+    * `:transfer_bandwidth` - bytes per second between the devices, or
+      `:measure` to measure it with `measure_transfer_bandwidth/3`.
+      Defaults to `1.0e10`.
+    * `:transfer_latency` - fixed cost of each transfer, in seconds.
+      The launch overhead of the destination device is added to it.
+      Defaults to `5.0e-6`.
+    * `:optimize` - whether to run the cost model. When `false`, only the
+      ops the accelerator does not support are placed on the host.
+      Defaults to `true`.
+  """
+
+  alias Nx.Tensor, as: T
+  alias Nx.Defn.Expr
+
+  @non_metal_ops [
+    :count_leading_zeros,
+    :population_count,
+    :sort,
+    :mode,
+    :argmax,
+    :argmin,
+    :is_nan,
+    :median
+  ]
+
+  @default_profiles %{
+    "metal" => %{
+      unsupported_ops: @non_metal_ops,
+      flops_per_second: 2.0e12,
+      launch_overhead: 2.0e-5
+    },
+    "local-sync" => %{unsupported_ops: [], flops_per_second: 2.0e10, launch_overhead: 1.0e-6},
+    "local-task" => %{unsupported_ops: [], flops_per_second: 1.0e11, launch_overhead: 2.0e-5}
+  }
+
+  @fallback_profile %{unsupported_ops: [], flops_per_second: 1.0e11, launch_overhead: 1.0e-5}
+
+  # Nodes which are never moved on their own, either because the splitter
+  # handles them structurally or because they hold nested scopes
+  @unplaceable_ops [
+    :parameter,
+    :constant,
+    :tensor,
+    :elem,
+    :metadata,
+    :fun,
+    :while,
+    :cond,
+    :token,
+    :optional
+  ]
+
+  @max_passes 8
+
+  @doc """
+  The built-in device profiles, keyed by driver name.
+  """
+  def default_profiles, do: @default_profiles
+
+  @doc """
+  Returns the set of node ids to run on the host device.
+
+  See the module documentation for options.
+  """
+  def place(expr, opts \\ []) do
+    opts =
+      Keyword.validate!(opts,
+        accelerator: "metal://",
+        host: "local-sync://",
+        profiles: %{},
+        transfer_bandwidth: 1.0e10,
+        transfer_latency: 5.0e-6,
+        optimize: true
+      )
+
+    accelerator = profile(driver_name(opts[:accelerator]), opts[:profiles])
+    host = profile(driver_name(opts[:host]), opts[:profiles])
+
+    nodes = collect_nodes(expr)
+
+    placement =
+      Map.new(nodes, fn {id, node, _args} ->
+        if forced_to_host?(node, accelerator), do: {id, :host}, else: {id, :accelerator}
+      end)
+
+    placement =
+      if opts[:optimize] do
+        bandwidth =
+          case opts[:transfer_bandwidth] do
+            :measure -> measure_transfer_bandwidth(opts[:accelerator], opts[:host])
+            bandwidth -> bandwidth
+          end
+
+        model = %{
+          accelerator: accelerator,
+          host: host,
+          bandwidth: bandwidth,
+          latency: opts[:transfer_latency],
+          consumers: consumers(nodes),
+          nodes: Map.new(nodes, fn {id, node, args} -> {id, {node, args}} end)
+        }
+
+        candidates =
+          for {id, node, _args} <- nodes,
+              placeable?(node) and not forced_to_host?(node, accelerator),
+              do: id
+
+        optimize(placement, candidates, model, @max_passes)
+      else
+        placement
+      end
+
+    for {id, :host} <- placement, into: MapSet.new(), do: id
+  end
+
+  @doc """
+  Measures the transfer bandwidth between two devices, in bytes per second.
+
+  A buffer of `bytes` is allocated on `from`, read back and uploaded to `to`.
+  """
+  def measure_transfer_bandwidth(from, to, bytes \\ 8 * 1024 * 1024) do
+    {:ok, from} = NxIREE.Device.get(from)
+    {:ok, to} = NxIREE.Device.get(to)
+    binary = :binary.copy(<<0>>, bytes)
+
+    {:ok, ref} = NxIREE.VM.allocate_buffer(binary, from.ref, {bytes}, {:u, 8})
+
+    {time, {:ok, copy_ref}} =
+      :timer.tc(fn ->
+        {:ok, data} = NxIREE.VM.read_buffer(from.ref, ref)
+        NxIREE.VM.allocate_buffer(data, to.ref, {bytes}, {:u, 8})
+      end)
+
+    NxIREE.Native.deallocate_buffer(ref)
+    NxIREE.Native.deallocate_buffer(copy_ref)
+
+    bytes / max(time, 1) * 1_000_000
+  end
+
+  defp optimize(placement, _candidates, _model, 0), do: placement
+
+  defp optimize(placement, candidates, model, passes) do
+    {placement, changed?} =
+      Enum.reduce(candidates, {placement, false}, fn id, {placement, changed?} ->
+        best =
+          if cost(id, :host, placement, model) < cost(id, :accelerator, placement, model) do
+            :host
+          else
+            :accelerator
+          end
+
+        if best == placement[id] do
+          {placement, changed?}
+        else
+          {Map.put(placement, id, best), true}
+        end
+      end)
+
+    if changed?, do: optimize(placement, candidates, model, passes - 1), else: placement
+  end
+
+  # The cost of running the node on `target`, including the transfers to
+  # and from its neighbours placed on the other device
+  defp cost(id, target, placement, model) do
+    {node, args} = model.nodes[id]
+    profile = model[target]
+
+    compute = flops(node) / profile.flops_per_second
+
+    inputs =
+      Enum.reduce(args, 0, fn arg_id, acc ->
+        acc + edge_cost(arg_id, target, placement, model)
+      end)
+
+    outputs =
+      model.consumers
+      |> Map.get(id, [])
+      |> Enum.reduce(0, fn consumer_id, acc ->
+        consumer_target = placement[consumer_id]
+
+        if consumer_target == target do
+          acc
+        else
+          acc + transfer_cost(Nx.byte_size(node), model[consumer_target], model)
+        end
+      end)
+
+    compute + inputs + outputs
+  end
+
+  defp edge_cost(arg_id, target, placement, model) do
+    {arg, _} = model.nodes[arg_id]
+
+    cond do
+      # Function arguments and constants are uploaded wherever they are needed
+      not placeable?(arg) -> 0
+      placement[arg_id] == target -> 0
+      true -> transfer_cost(Nx.byte_size(arg), model[target], model)
+    end
+  end
+
+  defp transfer_cost(bytes, destination, model) do
+    model.latency + destination.launch_overhead + bytes / model.bandwidth
+  end
+
+  # A rough FLOP count, enough to tell cheap elementwise ops from
+  # contractions and reductions
+  defp flops(%T{data: %Expr{op: :dot, args: [left, contract_axes, _, _, _, _]}} = out) do
+    contracted = Enum.reduce(contract_axes, 1, &(elem(left.shape, &1) * &2))
+    2 * Nx.size(out) * contracted
+  end
+
+  defp flops(%T{data: %Expr{op: :conv, args: [_input, kernel, _opts]}} = out) do
+    2 * Nx.size(out) * div(Nx.size(kernel), max(elem(kernel.shape, 0), 1))
+  end
+
+  defp flops(%T{data: %Expr{op: op, args: [%T{} = input | _]}})
+       when op in [:sum, :product, :reduce_max, :reduce_min, :all, :any, :argmax, :argmin] do
+    Nx.size(input)
+  end
+
+  defp flops(%T{data: %Expr{op: op, args: [%T{} = input | _]}}) when op in [:sort, :argsort] do
+    n = max(Nx.size(input), 2)
+    round(n * :math.log2(n))
+  end
+
+  defp flops(%T{type: {:tuple, _}}), do: 0
+  defp flops(out), do: Nx.size(out)
+
+  defp forced_to_host?(%T{data: %Expr{op: op}}, accelerator) do
+    op in accelerator.unsupported_ops
+  end
+
+  defp placeable?(%T{type: {:tuple, _}}), do: false
+  defp placeable?(%T{data: %Expr{op: op}}), do: op not in @unplaceable_ops
+
+  # Returns the nodes reachable from expr as {id, node, argument ids}, with
+  # arguments before their consumers. Nested scopes are not entered, their
+  # nodes always run wherever the enclosing node runs.
+  defp collect_nodes(expr) do
+    {_, {_seen, nodes}} =
+      Nx.Defn.Composite.traverse(expr, {MapSet.new(), []}, &collect_node/2)
+
+    Enum.reverse(nodes)
+  end
+
+  defp collect_node(%T{data: %Expr{id: id}} = node, {seen, nodes} = acc) do
+    if MapSet.member?(seen, id) do
+      {node, acc}
+    else
+      {_, {arg_ids, {seen, nodes}}} =
+        Nx.Defn.Tree.apply_args(node, :scope, {[], {MapSet.put(seen, id), nodes}}, fn
+          %T{data: %Expr{id: arg_id}} = arg, {arg_ids, acc} ->
+            {arg, acc} = collect_node(arg, acc)
+            {arg, {[arg_id | arg_ids], acc}}
+
+          arg, acc ->
+            {arg, acc}
+        end)
+
+      {node, {seen, [{id, node, Enum.uniq(arg_ids)} | nodes]}}
+    end
+  end
+
+  defp collect_node(other, acc), do: {other, acc}
+
+  defp consumers(nodes) do
+    Enum.reduce(nodes, %{}, fn {id, _node, args}, acc ->
+      Enum.reduce(args, acc, fn arg_id, acc ->
+        Map.update(acc, arg_id, [id], &[id | &1])
+      end)
+    end)
+  end
+
+  defp profile(driver_name, profiles) do
+    @default_profiles
+    |> Map.get(driver_name, @fallback_profile)
+    |> Map.merge(Map.get(profiles, driver_name, %{}))
+  end
+
+  defp driver_name(%NxIREE.Device{driver_name: driver_name}), do: driver_name
+  defp driver_name(uri) when is_binary(uri), do: uri |> String.split(":", parts: 2) |> hd()
+end
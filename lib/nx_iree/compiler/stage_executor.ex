@@ -0,0 +1,193 @@
+defmodule NxIREE.Compiler.StageExecutor do
+  @moduledoc false
+
+  # Runs the stages of a function split by `NxIREE.Compiler.GraphSplitter`.
+  #
+  # The argument sources of each stage form a DAG, so every stage is
+  # launched as soon as the stages it reads from are done, and independent
+  # stages run concurrently on their devices. Intermediate results stay on
+  # the device that produced them: they are only copied when consumed by a
+  # stage on another device, at most once per device, and released as soon
+  # as their last consumer is done.
+
+  @doc """
+  Runs `stages` on the flat list of function arguments `args`.
+
+  Each stage is `{stage_id, tag, device, runtime_fun, arguments, argument_sources}`,
+  in execution order. Returns the result of the last stage.
+  """
+  def run(stages, args) do
+    values =
+      args
+      |> Enum.with_index()
+      |> Map.new(fn {arg, idx} -> {{nil, idx}, arg} end)
+
+    sources_by_stage =
+      Map.new(stages, fn {stage_id, _tag, _device, _fun, _arguments, argument_sources} ->
+        {stage_id, Map.values(argument_sources)}
+      end)
+
+    consumers =
+      sources_by_stage
+      |> Map.values()
+      |> List.flatten()
+      |> Enum.frequencies()
+
+    {final_stage_id, _, _, _, _, _} = List.last(stages)
+
+    state = %{
+      pending: stages,
+      running: %{},
+      done: MapSet.new(),
+      values: values,
+      # {source, device ref} -> copy of the source on that device
+      copies: %{},
+      consumers: consumers,
+      sources_by_stage: sources_by_stage,
+      final_stage_id: final_stage_id,
+      # Stages run in their own processes, charged to the quota of the caller
+      tenant: NxIREE.Quota.get_tenant(),
+      result: nil
+    }
+
+    loop(state)
+  end
+
+  defp loop(state) do
+    {ready, pending} = Enum.split_with(state.pending, &ready?(&1, state))
+    state = Enum.reduce(ready, %{state | pending: pending}, &launch/2)
+
+    if state.running == %{} do
+      state.result
+    else
+      receive do
+        {ref, [result]} when is_map_key(state.running, ref) ->
+          Process.demonitor(ref, [:flush])
+          {stage_id, state} = pop_in(state.running[ref])
+          state |> complete(stage_id, result) |> loop()
+
+        {:DOWN, ref, :process, _pid, reason} when is_map_key(state.running, ref) ->
+          exit(reason)
+      end
+    end
+  end
+
+  defp ready?({_stage_id, _tag, _device, _fun, _arguments, argument_sources}, state) do
+    Enum.all?(argument_sources, fn
+      {_id, {nil, _idx}} -> true
+      {_id, {stage_id, _idx}} -> MapSet.member?(state.done, stage_id)
+    end)
+  end
+
+  defp launch({stage_id, _tag, device, runtime_fun, arguments, argument_sources}, state) do
+    {args, state} =
+      Enum.map_reduce(arguments, state, fn {id, param}, state ->
+        %Nx.Tensor{data: %Nx.Defn.Expr{op: :parameter, args: [idx]}} = param
+        {value, state} = fetch_on_device(argument_sources[id], device, state)
+        {{idx, value}, state}
+      end)
+
+    args = args |> Enum.sort_by(&elem(&1, 0)) |> Enum.map(&elem(&1, 1))
+
+    tenant = state.tenant
+    %Task{ref: ref} =
+      Task.async(fn -> NxIREE.Quota.with_tenant(tenant, fn -> runtime_fun.([args]) end) end)
+    put_in(state.running[ref], stage_id)
+  end
+
+  # Returns the value of `source` on `device`, copying it there only if
+  # it lives elsewhere.
+  defp fetch_on_device(source, device, state) do
+    {value, state} =
+      case state.values[source] do
+        fun when is_function(fun, 0) ->
+          value = fun.()
+          {value, put_in(state.values[source], value)}
+
+        value ->
+          {value, state}
+      end
+
+    device_ref = device.ref
+
+    case {value, state.copies} do
+      {%Nx.Tensor{data: %NxIREE.Backend{data: nil, device: ^device_ref}}, _} ->
+        {value, state}
+
+      {_, %{{^source, ^device_ref} => copy}} ->
+        {copy, state}
+
+      _ ->
+        copy = copy_to_device(value, device)
+        {copy, put_in(state.copies[{source, device_ref}], copy)}
+    end
+  end
+
+  defp copy_to_device(%Nx.Tensor{} = tensor, device) do
+    {:ok, ref} = NxIREE.VM.allocate_buffer(tensor, device.ref)
+
+    data = %NxIREE.Backend{
+      ref: ref,
+      device: device.ref,
+      device_uri: device.uri,
+      driver: device.driver_name
+    }
+
+    %{tensor | data: data}
+  end
+
+  defp complete(state, stage_id, result) do
+    state = %{state | done: MapSet.put(state.done, stage_id)}
+
+    outputs =
+      [result]
+      |> Nx.Defn.Composite.flatten_list()
+      |> Enum.with_index()
+
+    state =
+      Enum.reduce(outputs, state, fn {output, idx}, state ->
+        put_in(state.values[{stage_id, idx}], output)
+      end)
+
+    state =
+      if stage_id == state.final_stage_id do
+        %{state | result: [result]}
+      else
+        # Outputs nobody reads can be released right away
+        Enum.reduce(outputs, state, fn {_output, idx}, state ->
+          maybe_release({stage_id, idx}, state)
+        end)
+      end
+
+    Enum.reduce(state.sources_by_stage[stage_id], state, fn source, state ->
+      state = update_in(state.consumers[source], &(&1 - 1))
+      maybe_release(source, state)
+    end)
+  end
+
+  defp maybe_release({source_stage_id, _idx} = source, state) do
+    if Map.get(state.consumers, source, 0) == 0 do
+      {copies, remaining} =
+        Enum.split_with(state.copies, fn {{copy_source, _device_ref}, _copy} ->
+          copy_source == source
+        end)
+
+      Enum.each(copies, fn {_key, copy} -> deallocate(copy) end)
+
+      # Function arguments belong to the caller, so only intermediates are released
+      if source_stage_id != nil and source_stage_id != state.final_stage_id do
+        deallocate(state.values[source])
+      end
+
+      %{state | copies: Map.new(remaining), values: Map.delete(state.values, source)}
+    else
+      state
+    end
+  end
+
+  defp deallocate(%Nx.Tensor{data: %NxIREE.Backend{data: nil} = data}) do
+    NxIREE.VM.deallocate_buffer(data)
+  end
+
+  defp deallocate(_), do: :ok
+end
@@ -4,24 +4,23 @@ defmodule NxIREE.Device do
   @device_key {__MODULE__, :devices}
   @registry_key {__MODULE__, :driver_registry}
   @default_device_key {__MODULE__, :default_device}
+  @cpu_features_key {__MODULE__, :host_cpu_features}
+  @remote_device_key {__MODULE__, :remote_device}
+  @device_ref_key {__MODULE__, :device_ref}
 
-  defstruct [:ref, :driver_name, :kind, :id, :uri, :compiler_target_backend]
+  defstruct [:ref, :driver_name, :kind, :id, :uri, :compiler_target_backend, :node]
 
+  # Only enumerates the devices. HAL devices are created on first use by
+  # get/1, so drivers which are never used don't allocate anything.
   def init() do
     {:ok, driver_registry} = NxIREE.Native.get_driver_registry()
     :persistent_term.put(@registry_key, driver_registry)
 
-    {:ok, drivers} = NxIREE.Native.list_drivers(driver_registry)
-
-    devices =
-      Enum.flat_map(drivers, fn {name, _} ->
-        {:ok, devices} = NxIREE.Native.list_devices(driver_registry, name)
-        devices
-      end)
+    {:ok, devices} = NxIREE.Native.list_devices(driver_registry)
 
     cache =
       devices
-      |> Enum.map(fn {device_ref, driver_name, device_uri, device_id} ->
+      |> Enum.map(fn {driver_name, device_uri, device_id} ->
         kind =
           if List.starts_with?(device_uri, ~c"local-sync") do
             :cpu
@@ -35,7 +34,6 @@ defmodule NxIREE.Device do
 
         %__MODULE__{
           uri: device_uri,
-          ref: device_ref,
           driver_name: driver_name,
           kind: kind,
           id: device_id,
@@ -82,9 +80,10 @@ defmodule NxIREE.Device do
     end
   end
 
+  # Listed devices only carry a ref once they have been created
   def list do
     devices = :persistent_term.get(@device_key)
-    {:ok, devices}
+    {:ok, Enum.map(devices, &put_created_ref/1)}
   end
 
   def list(driver) do
@@ -92,17 +91,31 @@ defmodule NxIREE.Device do
 
     driver = to_string(driver)
 
-    devices = Enum.filter(devices, &(&1.driver_name == driver))
+    devices =
+      devices
+      |> Enum.filter(&(&1.driver_name == driver))
+      |> Enum.map(&put_created_ref/1)
 
     {:ok, devices}
   end
 
   def get(nil) do
-    {:ok, default_device()}
+    case :persistent_term.get(@default_device_key) do
+      nil -> {:ok, nil}
+      device -> ensure_created(device)
+    end
   end
 
   def get(%__MODULE__{} = device) do
-    {:ok, device}
+    ensure_created(device)
+  end
+
+  def get({node, device_uri}) when is_atom(node) do
+    if node == node() do
+      get(device_uri)
+    else
+      get_remote(node, device_uri)
+    end
   end
 
   def get(device_uri) do
@@ -110,12 +123,99 @@ defmodule NxIREE.Device do
 
     case Enum.find(devices, &(&1.uri == device_uri)) do
       nil -> {:error, :unknown_device}
-      device -> {:ok, device}
+      device -> ensure_created(device)
+    end
+  end
+
+  defp ensure_created(%__MODULE__{ref: nil, node: nil} = device) do
+    key = {@device_ref_key, device.uri}
+
+    case :persistent_term.get(key, nil) do
+      nil ->
+        # Serializes creation so concurrent first uses share a single device
+        :global.trans({key, self()}, fn -> create_device(key, device) end, [node()])
+
+      ref ->
+        {:ok, %{device | ref: ref}}
+    end
+  end
+
+  defp ensure_created(device), do: {:ok, device}
+
+  defp create_device(key, device) do
+    case :persistent_term.get(key, nil) do
+      nil ->
+        registry = :persistent_term.get(@registry_key)
+
+        case NxIREE.Native.create_device(registry, device.uri) do
+          {:ok, ref} ->
+            :persistent_term.put(key, ref)
+            {:ok, %{device | ref: ref}}
+
+          {:error, reason} ->
+            {:error, List.to_string(reason)}
+        end
+
+      ref ->
+        {:ok, %{device | ref: ref}}
+    end
+  end
+
+  defp put_created_ref(%__MODULE__{uri: uri} = device) do
+    %{device | ref: :persistent_term.get({@device_ref_key, uri}, nil)}
+  end
+
+  # Devices on a node don't change once it is up, so they are cached after the
+  # first lookup. The device ref is only valid on its own node and is dropped.
+  defp get_remote(node, device_uri) do
+    key = {@remote_device_key, node, device_uri}
+
+    case :persistent_term.get(key, nil) do
+      nil ->
+        case :erpc.call(node, __MODULE__, :get, [device_uri]) do
+          {:ok, %__MODULE__{} = device} ->
+            device = %{device | ref: nil, node: node}
+            :persistent_term.put(key, device)
+            {:ok, device}
+
+          {:ok, nil} ->
+            {:error, :unknown_device}
+
+          error ->
+            error
+        end
+
+      device ->
+        {:ok, device}
+    end
+  end
+
+  @doc """
+  Returns whether the given device lives on another node.
+  """
+  def remote?(%__MODULE__{node: node}), do: node != nil and node != node()
+  def remote?({node, _device_uri}) when is_atom(node), do: node != node()
+  def remote?(_device), do: false
+
+  @doc """
+  Returns the host CPU features as LLVM target features, such as `"+avx512f"`.
+  """
+  def host_cpu_features do
+    case :persistent_term.get(@cpu_features_key, nil) do
+      nil ->
+        {:ok, features} = NxIREE.Native.host_cpu_features()
+        features = Enum.map(features, &List.to_string/1)
+        :persistent_term.put(@cpu_features_key, features)
+        features
+
+      features ->
+        features
     end
   end
 
   def default_device do
-    :persistent_term.get(@default_device_key)
+    {:ok, device} = get(nil)
+    device
   end
 
   def find_default_device do
@@ -0,0 +1,24 @@
+defmodule NxIREE.Measure do
+  @moduledoc false
+  # Helpers shared by the code that times modules: `NxIREE.warmup/3`,
+  # `NxIREE.Compiler.Autotune` and `mix nx_iree.bench`.
+
+  @doc """
+  Builds one input filled with ones for each tensor or template in `templates`.
+  """
+  def synthetic_inputs(templates) do
+    templates
+    |> Nx.Defn.Composite.flatten_list()
+    |> Enum.map(fn %Nx.Tensor{shape: shape, type: type} ->
+      Nx.broadcast(Nx.tensor(1, type: type), shape)
+    end)
+  end
+
+  @doc """
+  Returns the `q` quantile, between 0 and 1, of a non-empty sorted list.
+  """
+  def percentile(sorted, q) do
+    count = length(sorted)
+    Enum.at(sorted, min(round(q * (count - 1)), count - 1))
+  end
+end
@@ -0,0 +1,93 @@
+defmodule NxIREE.Memory do
+  @moduledoc """
+  Reports the memory held by the runtime.
+
+  `live_tensors/0` counts the tensors which hold contents right now, split
+  between host-backed tensors, such as inputs created with `Nx.tensor/2`
+  which haven't been passed to a call yet, and device-backed ones, such as
+  call outputs. Tensors hold their contents until they are deallocated or
+  garbage collected, so a steadily growing count points at a leak. Their
+  memory is then released on a background thread, and tensors keep
+  counting as live until it is, which `flush_releases/0` waits for.
+
+  `allocator_statistics/1` returns what the device allocator itself has
+  handed out, including buffers the runtime uses internally.
+
+  Both are emitted as telemetry by `emit_telemetry/0`, which can be polled
+  with [`:telemetry_poller`](https://hex.pm/packages/telemetry_poller):
+
+      {:telemetry_poller,
+       measurements: [{NxIREE.Memory, :emit_telemetry, []}],
+       period: :timer.seconds(10)}
+  """
+
+  @doc """
+  Returns the counts and bytes of live tensors.
+
+  The map holds the `:host_count`, `:host_bytes`, `:device_count` and
+  `:device_bytes` of the tensors alive right now, as well as the
+  `:host_peak_bytes` and `:device_peak_bytes`, the most bytes held at once
+  since the runtime was loaded. Tensors importing host memory through
+  `Nx.from_pointer/5` count as device-backed, while those wrapping the
+  payloads of a file read with `NxIREE.TensorBundle.read/2` count as
+  host-backed.
+  """
+  def live_tensors do
+    {:ok, stats} = NxIREE.Native.live_tensor_stats()
+    stats
+  end
+
+  @doc """
+  Waits until the tensors deallocated or garbage collected so far have
+  had their memory released.
+  """
+  def flush_releases do
+    NxIREE.Native.flush_releases()
+  end
+
+  @doc """
+  Returns the statistics of the allocator of the given device.
+
+  The map holds the bytes allocated, freed and held at peak in host and
+  device memory since the device was created, as `:host_bytes_allocated`,
+  `:host_bytes_freed`, `:host_bytes_peak`, `:device_bytes_allocated`,
+  `:device_bytes_freed` and `:device_bytes_peak`.
+  """
+  def allocator_statistics(device \\ nil) do
+    with {:ok, device} <- NxIREE.Device.get(device) do
+      if NxIREE.Device.remote?(device) do
+        :erpc.call(device.node, __MODULE__, :allocator_statistics, [device.uri])
+      else
+        case NxIREE.Native.allocator_statistics(device.ref) do
+          {:ok, stats} -> {:ok, stats}
+          {:error, reason} -> {:error, List.to_string(reason)}
+        end
+      end
+    end
+  end
+
+  @doc """
+  Emits the memory statistics as telemetry events.
+
+    * `[:nx_iree, :memory, :tensors]` - with the `live_tensors/0` map
+      as measurements.
+
+    * `[:nx_iree, :memory, :allocator]` - once per local device in use, with its
+      `allocator_statistics/1` as measurements and the `:device` URI and
+      the `:driver` as metadata.
+  """
+  def emit_telemetry do
+    :telemetry.execute([:nx_iree, :memory, :tensors], live_tensors(), %{})
+
+    {:ok, devices} = NxIREE.Device.list()
+
+    # Devices which were never used are not created just to be measured
+    for %{ref: ref} = device when ref != nil <- devices,
+        {:ok, stats} <- [allocator_statistics(device)] do
+      metadata = %{device: device.uri, driver: device.driver_name}
+      :telemetry.execute([:nx_iree, :memory, :allocator], stats, metadata)
+    end
+
+    :ok
+  end
+end
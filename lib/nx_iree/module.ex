@@ -1,14 +1,39 @@
 defmodule NxIREE.Module do
   @doc """
   Holds the bytecode and other metadata for a compiled MLIR module.
+
+  Modules loaded through `NxIREE.load_module/2` have no in-memory `:bytecode`.
+  Instead, `:ref` points to a runtime module backed by a memory mapping of the
+  `.vmfb` file.
+
+  `:input_templates` and `:used_inputs` are filled in by `NxIREE.Compiler`
+  and describe which of the flattened function arguments the module expects,
+  so that the module can be persisted with `NxIREE.Bundle` and called without
+  recompiling.
+
+  `:hash` is the SHA-256 of the bytecode, computed once at compile time and
+  used to cache the module on remote nodes.
   """
 
-  defstruct [:bytecode, :compilation_flags, :mlir_module, :output_container]
+  defstruct [
+    :bytecode,
+    :hash,
+    :compilation_flags,
+    :mlir_module,
+    :output_container,
+    :ref,
+    :input_templates,
+    :used_inputs
+  ]
 
   @type t :: %__MODULE__{
-          bytecode: String.t(),
+          bytecode: String.t() | nil,
+          hash: binary() | nil,
           compilation_flags: list(String.t()),
           mlir_module: String.t(),
-          output_container: term()
+          output_container: term(),
+          ref: reference() | nil,
+          input_templates: list(term()) | nil,
+          used_inputs: list(non_neg_integer()) | nil
         }
 end
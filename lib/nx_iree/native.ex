@@ -14,19 +14,71 @@ defmodule NxIREE.Native do
   def list_devices(_registry), do: :erlang.nif_error(:undef)
   def list_devices(_registry, _driver), do: :erlang.nif_error(:undef)
   def list_drivers(_registry), do: :erlang.nif_error(:undef)
+  def host_cpu_features, do: :erlang.nif_error(:undef)
 
   def create_device(_registry, _device_uri), do: :erlang.nif_error(:undef)
 
   def deallocate_buffer(_reference), do: :erlang.nif_error(:undef)
-  def allocate_buffer(_data, _device_ref, _dims, _element_type), do: :erlang.nif_error(:undef)
+  def allocate_buffer(_data, _device_ref, _dims, _element_type, _quota),
+    do: :erlang.nif_error(:undef)
+
   def read_buffer(_device_ref, _input_ref, _num_bytes), do: :erlang.nif_error(:undef)
+  def to_pointer(_input_ref), do: :erlang.nif_error(:undef)
+  def write_pointer(_address, _data), do: :erlang.nif_error(:undef)
 
-  def call_io(_instance_ref, _device_ref, _driver_name, _bytecode, _inputs),
+  def from_pointer(_device_ref, _address, _dims, _element_type, _owner),
     do: :erlang.nif_error(:undef)
 
-  def call_cpu(_instance_ref, _device_ref, _driver_name, _bytecode, _inputs),
-    do: :erlang.nif_error(:undef)
+  def load_module(_instance_ref, _path, _offset, _length), do: :erlang.nif_error(:undef)
+  def load_module_from_binary(_instance_ref, _bytecode), do: :erlang.nif_error(:undef)
+
+  def call_io(
+        _instance_ref,
+        _device_ref,
+        _driver_name,
+        _bytecode,
+        _inputs,
+        _enqueued_at,
+        _quota,
+        _profile_key
+      ),
+      do: :erlang.nif_error(:undef)
+
+  def call_cpu(
+        _instance_ref,
+        _device_ref,
+        _driver_name,
+        _bytecode,
+        _inputs,
+        _enqueued_at,
+        _quota,
+        _profile_key
+      ),
+      do: :erlang.nif_error(:undef)
+
+  def profiling_begin(_device_ref, _mode, _file_path), do: :erlang.nif_error(:undef)
+  def profiling_flush(_device_ref), do: :erlang.nif_error(:undef)
+  def profiling_end(_device_ref), do: :erlang.nif_error(:undef)
+
+  def allocator_statistics(_device_ref), do: :erlang.nif_error(:undef)
+  def live_tensor_stats, do: :erlang.nif_error(:undef)
+  def flush_releases, do: :erlang.nif_error(:undef)
+  def release_notice(_pid, _message), do: :erlang.nif_error(:undef)
+
+  def set_device_quota(_device_ref, _limit), do: :erlang.nif_error(:undef)
+  def set_tenant_quota(_tenant, _limit), do: :erlang.nif_error(:undef)
+  def device_quota_usage(_device_ref), do: :erlang.nif_error(:undef)
+  def tenant_quota_usage(_tenant), do: :erlang.nif_error(:undef)
+
+  def start_tracing(_capacity), do: :erlang.nif_error(:undef)
+  def stop_tracing, do: :erlang.nif_error(:undef)
+  def export_trace, do: :erlang.nif_error(:undef)
 
   def serialize_tensor(_reference), do: :erlang.nif_error(:undef)
+  def serialize_tensor(_reference, _compression), do: :erlang.nif_error(:undef)
   def deserialize_tensor(_binary), do: :erlang.nif_error(:undef)
+
+  def serialize_tensors(_references, _compression), do: :erlang.nif_error(:undef)
+  def deserialize_tensors(_device_ref, _binary), do: :erlang.nif_error(:undef)
+  def deserialize_tensors_file(_device_ref, _path), do: :erlang.nif_error(:undef)
 end
@@ -0,0 +1,120 @@
+defmodule NxIREE.Profiler do
+  @moduledoc """
+  Profiles the module invocations on a device.
+
+  A profile brackets IREE's HAL device profiling, so drivers and external
+  tools, such as Tracy, RenderDoc or Instruments, capture their own data
+  while it runs, and aggregates the time spent invoking each module:
+
+      {:ok, report} = NxIREE.Profiler.profile("local-sync://", fn -> predict.(input) end)
+
+  Each report has the `:duration` of the profile and one entry per module
+  function in `:functions`, sorted by the total time spent in it, with the
+  number of `:calls` and the `:total`, `:min` and `:max` invocation times.
+  All times are in native time units. The `:module` of an entry is the
+  `NxIREE.Module` `:hash` of compiled modules, or an opaque key for modules
+  loaded from `.vmfb` files, so that every module gets its own entries.
+
+  This is not a dispatch profiler: invocations are timed as a whole, as in
+  the `:invoke` measurement of the `[:nx_iree, :call]` telemetry, and only
+  summed up per module. Dispatch and executable statistics are captured by
+  the drivers which support the `:modes` given to `start/2`, which the CPU
+  drivers don't, or by a Tracy-enabled runtime build.
+  Only one profile can run on a device at a time.
+  """
+
+  @modes %{queue_operations: 1, dispatch_counters: 2, executable_counters: 4}
+
+  @doc """
+  Starts profiling the given device.
+
+  ## Options
+
+    * `:modes` - what the driver captures, any of `:queue_operations`,
+      `:dispatch_counters` and `:executable_counters`. Not all drivers
+      support every mode, and what they capture is only available to the
+      driver tools, not in the report. Defaults to `[:queue_operations]`.
+
+    * `:file_path` - where drivers which write captures to disk put them.
+  """
+  def start(device, opts \\ []) do
+    opts = Keyword.validate!(opts, modes: [:queue_operations], file_path: nil)
+    {:ok, %NxIREE.Device{ref: device_ref}} = NxIREE.Device.get(device)
+
+    mode =
+      Enum.reduce(opts[:modes], 0, fn mode, acc ->
+        Bitwise.bor(acc, Map.fetch!(@modes, mode))
+      end)
+
+    file_path = to_charlist(opts[:file_path] || "")
+
+    case NxIREE.Native.profiling_begin(device_ref, mode, file_path) do
+      :ok -> :ok
+      {:error, reason} -> {:error, List.to_string(reason)}
+    end
+  end
+
+  @doc """
+  Flushes what the driver captured so far.
+  """
+  def flush(device) do
+    {:ok, %NxIREE.Device{ref: device_ref}} = NxIREE.Device.get(device)
+
+    case NxIREE.Native.profiling_flush(device_ref) do
+      :ok -> :ok
+      {:error, reason} -> {:error, List.to_string(reason)}
+    end
+  end
+
+  @doc """
+  Stops profiling the given device and returns the report.
+  """
+  def stop(device) do
+    {:ok, %NxIREE.Device{ref: device_ref}} = NxIREE.Device.get(device)
+
+    case NxIREE.Native.profiling_end(device_ref) do
+      {:ok, {duration, functions}} ->
+        functions =
+          functions
+          |> Enum.map(fn {module, function, calls, total, min, max} ->
+            %{
+              module: module,
+              function: List.to_string(function),
+              calls: calls,
+              total: native(total),
+              min: native(min),
+              max: native(max)
+            }
+          end)
+          |> Enum.sort_by(& &1.total, :desc)
+
+        {:ok, %{duration: native(duration), functions: functions}}
+
+      {:error, reason} ->
+        {:error, List.to_string(reason)}
+    end
+  end
+
+  @doc """
+  Profiles the given device while running `fun`.
+
+  Returns the report. Accepts the same options as `start/2`.
+  """
+  def profile(device, fun, opts \\ []) when is_function(fun, 0) do
+    with :ok <- start(device, opts) do
+      try do
+        fun.()
+        :ok = flush(device)
+      catch
+        kind, reason ->
+          # Stop even when fun fails, so the device can be profiled again
+          stop(device)
+          :erlang.raise(kind, reason, __STACKTRACE__)
+      end
+
+      stop(device)
+    end
+  end
+
+  defp native(nanoseconds), do: System.convert_time_unit(nanoseconds, :nanosecond, :native)
+end
@@ -0,0 +1,186 @@
+defmodule NxIREE.Quota do
+  @moduledoc """
+  Limits the memory held by tensors on a device or by a tenant.
+
+  A quota caps the bytes held by live tensors, either on a device or by
+  a named tenant sharing devices with others:
+
+      NxIREE.Quota.put("cuda://0", 4_000_000_000)
+      NxIREE.Quota.put({:tenant, "batch"}, 1_000_000_000)
+
+  Tensors created through `NxIREE.Backend` are charged when allocated and
+  calls reserve their uploads and expected outputs before running. Charges
+  are given back once tensors are deallocated or garbage collected, and
+  their memory has been released, see `NxIREE.Memory.flush_releases/0`.
+
+  Allocations which don't fit fail right away with
+  `NxIREE.QuotaExceededError`, while calls wait for other tensors to be
+  released, up to their `:quota_timeout`. This keeps a burst of requests
+  from exhausting device memory and lets callers shed load instead.
+  Calls wait in the calling process, retrying with a backoff, so they
+  never hold on to a dirty scheduler which could be releasing memory.
+
+  The tenant is set per process through `put_tenant/1` or `with_tenant/2`,
+  or given to `NxIREE.call/3` through its `:tenant` option. Compiled
+  functions which run stages, replicas or streams in other processes
+  carry the tenant of the caller over to them.
+  Usage is tracked from the moment a quota is first set, so tensors
+  allocated before then are not counted.
+  """
+
+  @active_key {__MODULE__, :active}
+  @tenant_key {__MODULE__, :tenant}
+
+  @doc """
+  Sets the quota of a device, given as anything `NxIREE.Device.get/1`
+  accepts, or of a `{:tenant, name}`, in bytes.
+  """
+  def put(target, bytes) when is_integer(bytes) and bytes > 0 do
+    :persistent_term.put(@active_key, true)
+    set_limit(target, bytes)
+  end
+
+  @doc """
+  Lifts the quota of a device or tenant. Its usage is still reported.
+  """
+  def delete(target) do
+    set_limit(target, 0)
+  end
+
+  @doc """
+  Returns the usage of a device or tenant quota.
+
+  The map holds the `:limit`, the bytes `:in_use` and the `:peak` bytes
+  held at once.
+  """
+  def usage({:tenant, name}) when is_binary(name) do
+    wrap(NxIREE.Native.tenant_quota_usage(name))
+  end
+
+  def usage(device) do
+    with {:ok, device} <- local_device(device) do
+      wrap(NxIREE.Native.device_quota_usage(device.ref))
+    end
+  end
+
+  @doc """
+  Sets the tenant the tensors of the calling process are charged to.
+  """
+  def put_tenant(name) when is_binary(name) do
+    Process.put(@tenant_key, name)
+    :ok
+  end
+
+  @doc """
+  Returns the tenant of the calling process, if any.
+  """
+  def get_tenant do
+    Process.get(@tenant_key)
+  end
+
+  @doc """
+  Runs `fun` with its tensors charged to the given tenant.
+
+  A `nil` tenant runs `fun` as is, which lets processes spawned on behalf
+  of a caller take over its tenant, whether it has one or not:
+
+      tenant = NxIREE.Quota.get_tenant()
+      Task.async(fn -> NxIREE.Quota.with_tenant(tenant, fun) end)
+  """
+  def with_tenant(nil, fun) when is_function(fun, 0), do: fun.()
+
+  def with_tenant(name, fun) when is_binary(name) and is_function(fun, 0) do
+    previous = Process.put(@tenant_key, name)
+
+    try do
+      fun.()
+    after
+      if previous, do: Process.put(@tenant_key, previous), else: Process.delete(@tenant_key)
+    end
+  end
+
+  # Returns what the runtime charges allocations and calls against, or nil
+  # while no quota was ever set, so the runtime can skip the bookkeeping.
+  @doc false
+  def __request__(tenant \\ get_tenant(), expected_output_bytes \\ 0) do
+    if :persistent_term.get(@active_key, false) do
+      {tenant || "", expected_output_bytes}
+    end
+  end
+
+  @max_backoff 20
+
+  # Runs `fun` until it is no longer denied for lack of memory, waiting for
+  # up to `timeout` milliseconds in between. Returns the last result and the
+  # time spent waiting, in native units.
+  @doc false
+  def __retry__(timeout, fun) do
+    start = System.monotonic_time()
+
+    deadline =
+      if timeout == :infinity,
+        do: :infinity,
+        else: start + System.convert_time_unit(timeout, :millisecond, :native)
+
+    retry(fun, start, start, deadline, 1)
+  end
+
+  defp retry(fun, start, attempt_start, deadline, backoff) do
+    case fun.() do
+      {:error, {:quota_exceeded, _pool, requested, limit, _in_use}} = error ->
+        now = System.monotonic_time()
+        remaining = remaining_ms(deadline, now)
+
+        # Requests larger than the limit would never fit
+        if requested > limit or remaining == 0 do
+          {error, now - start}
+        else
+          Process.sleep(min(backoff, remaining))
+          now = System.monotonic_time()
+          retry(fun, start, now, deadline, min(backoff * 2, @max_backoff))
+        end
+
+      result ->
+        {result, attempt_start - start}
+    end
+  end
+
+  defp remaining_ms(:infinity, _now), do: @max_backoff
+
+  defp remaining_ms(deadline, now) do
+    max(System.convert_time_unit(deadline - now, :native, :millisecond), 0)
+  end
+
+  @doc false
+  def __raise__({:quota_exceeded, pool, requested, limit, in_use}) do
+    raise NxIREE.QuotaExceededError,
+      pool: List.to_string(pool),
+      requested: requested,
+      limit: limit,
+      in_use: in_use
+  end
+
+  defp set_limit({:tenant, name}, bytes) when is_binary(name) do
+    wrap(NxIREE.Native.set_tenant_quota(name, bytes))
+  end
+
+  defp set_limit(device, bytes) do
+    with {:ok, device} <- local_device(device) do
+      wrap(NxIREE.Native.set_device_quota(device.ref, bytes))
+    end
+  end
+
+  defp local_device(device) do
+    with {:ok, device} <- NxIREE.Device.get(device) do
+      if NxIREE.Device.remote?(device) do
+        {:error, "quotas can only be set on local devices"}
+      else
+        {:ok, device}
+      end
+    end
+  end
+
+  defp wrap(:ok), do: :ok
+  defp wrap({:ok, usage}), do: {:ok, usage}
+  defp wrap({:error, reason}), do: {:error, List.to_string(reason)}
+end
@@ -0,0 +1,15 @@
+defmodule NxIREE.QuotaExceededError do
+  @moduledoc """
+  Raised when an allocation or call doesn't fit in a quota.
+
+  See `NxIREE.Quota`.
+  """
+
+  defexception [:pool, :requested, :limit, :in_use]
+
+  @impl true
+  def message(%{pool: pool, requested: requested, limit: limit, in_use: in_use}) do
+    "#{pool} quota exceeded: requested #{requested} bytes " <>
+      "with #{in_use} of #{limit} bytes in use"
+  end
+end
@@ -0,0 +1,261 @@
+defmodule NxIREE.Remote do
+  @moduledoc """
+  Runs modules on devices which live on other nodes of the cluster.
+
+  A remote device is given as a `{node, device_uri}` tuple wherever a
+  device is accepted, such as in `NxIREE.call/3` or in the
+  `:iree_runtime_options` of `NxIREE.Compiler`:
+
+      Nx.Defn.jit(&Nx.add/2,
+        compiler: NxIREE.Compiler,
+        iree_compiler_flags: flags,
+        iree_runtime_options: [device: {:"worker@host", "local-sync://"}]
+      )
+
+  The `:nx_iree` application must be running on the remote node.
+
+  Each module is shipped once and cached on the remote node under the hash
+  of its bytecode, so modules loaded from `.vmfb` files without their
+  bytecode can't run remotely. Inputs are sent as a `NxIREE.TensorBundle`.
+  Outputs stay on the remote node and are only transferred when read, so
+  outputs passed on to further calls on the same device never leave it.
+
+  Tensors are LZ4-compressed in both directions, keeping the ones which
+  don't shrink raw. This can be turned off with:
+
+      config :nx_iree, remote_compression: nil
+
+  Remote outputs are released when deallocated or once they are garbage
+  collected on the local node. Outputs of a node which disconnects are
+  released altogether.
+  """
+
+  use GenServer
+
+  @table __MODULE__
+
+  @doc false
+  def start_link(opts) do
+    GenServer.start_link(__MODULE__, opts, name: __MODULE__)
+  end
+
+  @doc """
+  Returns the device with the given URI on `node`.
+
+  Defaults to the default device of `node`.
+  """
+  def device(node, device_uri \\ nil) do
+    NxIREE.Device.get({node, device_uri})
+  end
+
+  @doc false
+  def call(%NxIREE.Module{bytecode: nil}, _inputs, _device, _function) do
+    raise ArgumentError, "modules loaded without their bytecode can't run on remote devices"
+  end
+
+  def call(
+        %NxIREE.Module{} = module,
+        inputs,
+        %NxIREE.Device{node: node, uri: uri} = device,
+        function
+      ) do
+    %{bytecode: bytecode, output_container: output_container} = module
+    hash = module.hash || :crypto.hash(:sha256, bytecode)
+
+    # Outputs of previous calls on the same device are passed by reference
+    {specs, {local, _count}} =
+      Enum.map_reduce(inputs, {[], 0}, fn input, {local, count} ->
+        input = if is_function(input, 0), do: input.(), else: input
+
+        case input do
+          %Nx.Tensor{data: %NxIREE.Backend{node: ^node, device_uri: ^uri, ref: id}} ->
+            {{:ref, id}, {local, count}}
+
+          input ->
+            {{:bundle, count}, {[input | local], count + 1}}
+        end
+      end)
+
+    {:ok, bundle} =
+      NxIREE.TensorBundle.serialize(Enum.reverse(local), compression: compression())
+
+    args = [self(), hash, uri, function, specs, bundle]
+
+    result =
+      case :erpc.call(node, __MODULE__, :__call__, args) do
+        {:error, :unknown_module} ->
+          with :ok <- :erpc.call(node, __MODULE__, :__load__, [hash, bytecode]) do
+            :erpc.call(node, __MODULE__, :__call__, args)
+          end
+
+        result ->
+          result
+      end
+
+    case result do
+      {:ok, outputs} when output_container == nil ->
+        {:ok, Enum.map(outputs, &to_tensor(&1, device))}
+
+      {:ok, outputs} ->
+        {tensors, []} =
+          Nx.Defn.Composite.traverse(output_container, outputs, fn hole, [output | outputs] ->
+            {%{hole | data: to_tensor(output, device).data}, outputs}
+          end)
+
+        {:ok, tensors}
+
+      {:error, error} ->
+        raise "IREE call failed due to: #{inspect(error)}"
+    end
+  end
+
+  defp to_tensor({id, shape, type}, device) do
+    # The notice lives as long as the tensor and asks for a remote release
+    # once the tensor is garbage collected
+    message = {:release_remote, device.node, id}
+    {:ok, lease} = NxIREE.Native.release_notice(Process.whereis(__MODULE__), message)
+
+    %Nx.Tensor{
+      names: List.duplicate(nil, tuple_size(shape)),
+      type: type,
+      shape: shape,
+      data: %NxIREE.Backend{
+        ref: id,
+        data: nil,
+        node: device.node,
+        device_uri: device.uri,
+        driver: device.driver_name,
+        lease: lease
+      }
+    }
+  end
+
+  @doc false
+  def read(%NxIREE.Backend{node: node, ref: id}) do
+    compression = if compression(), do: ~c"lz4", else: ~c"none"
+
+    with {:ok, serialized} <- :erpc.call(node, __MODULE__, :__read__, [id, compression]),
+         {:ok, ref} <- NxIREE.Native.deserialize_tensor(serialized) do
+      try do
+        NxIREE.Native.read_buffer(NxIREE.Device.default_device().ref, ref, -1)
+      after
+        NxIREE.Native.deallocate_buffer(ref)
+      end
+    end
+  end
+
+  defp compression, do: Application.get_env(:nx_iree, :remote_compression, :lz4)
+
+  @doc false
+  def release(%NxIREE.Backend{node: node, ref: id}) do
+    :erpc.call(node, __MODULE__, :__release__, [[id]])
+  end
+
+  # The functions below run on the node which holds the device
+
+  @doc false
+  def __load__(hash, bytecode) do
+    case NxIREE.VM.load_module_from_binary(bytecode) do
+      {:ok, module_ref} ->
+        :ets.insert(@table, {{:module, hash}, module_ref})
+        :ok
+
+      {:error, reason} ->
+        {:error, List.to_string(reason)}
+    end
+  end
+
+  @doc false
+  def __call__(owner, hash, device_uri, function, specs, bundle) do
+    with [{_, module_ref}] <- :ets.lookup(@table, {:module, hash}),
+         {:ok, device} <- NxIREE.Device.get(device_uri),
+         {:ok, bundled} <- NxIREE.TensorBundle.deserialize(bundle, device: device) do
+      bundled = List.to_tuple(bundled)
+
+      inputs =
+        Enum.map(specs, fn
+          {:bundle, index} -> elem(bundled, index)
+          {:ref, id} -> fetch_tensor!(id)
+        end)
+
+      try do
+        {:ok, outputs} =
+          NxIREE.call(%NxIREE.Module{ref: module_ref, hash: hash}, inputs,
+            device: device,
+            function: function
+          )
+
+        outputs =
+          Enum.map(outputs, fn tensor ->
+            id = make_ref()
+            :ets.insert(@table, {{:tensor, id}, owner, tensor})
+            {id, tensor.shape, tensor.type}
+          end)
+
+        :ok = GenServer.call(__MODULE__, {:monitor, owner})
+        {:ok, outputs}
+      after
+        bundled |> Tuple.to_list() |> Enum.each(&Nx.backend_deallocate/1)
+      end
+    else
+      [] -> {:error, :unknown_module}
+      error -> error
+    end
+  end
+
+  defp fetch_tensor!(id) do
+    case :ets.lookup(@table, {:tensor, id}) do
+      [{_, _owner, tensor}] -> tensor
+      [] -> raise ArgumentError, "remote tensor #{inspect(id)} has been released"
+    end
+  end
+
+  @doc false
+  def __read__(id, compression) do
+    %Nx.Tensor{data: %NxIREE.Backend{ref: ref}} = fetch_tensor!(id)
+    NxIREE.Native.serialize_tensor(ref, compression)
+  end
+
+  @doc false
+  def __release__(ids) do
+    Enum.each(ids, fn id ->
+      case :ets.take(@table, {:tensor, id}) do
+        [{_, _owner, tensor}] -> Nx.backend_deallocate(tensor)
+        [] -> :ok
+      end
+    end)
+  end
+
+  @impl true
+  def init(_opts) do
+    :ets.new(@table, [:named_table, :public, :set, read_concurrency: true])
+    {:ok, MapSet.new()}
+  end
+
+  @impl true
+  def handle_call({:monitor, owner}, _from, nodes) do
+    owner_node = node(owner)
+
+    nodes =
+      if owner_node == node() or MapSet.member?(nodes, owner_node) do
+        nodes
+      else
+        Node.monitor(owner_node, true)
+        MapSet.put(nodes, owner_node)
+      end
+
+    {:reply, :ok, nodes}
+  end
+
+  @impl true
+  def handle_info({:release_remote, node, id}, nodes) do
+    :erpc.cast(node, __MODULE__, :__release__, [[id]])
+    {:noreply, nodes}
+  end
+
+  def handle_info({:nodedown, owner_node}, nodes) do
+    match_spec = [{{{:tensor, :"$1"}, :"$2", :_}, [{:==, {:node, :"$2"}, owner_node}], [:"$1"]}]
+    __release__(:ets.select(@table, match_spec))
+    {:noreply, MapSet.delete(nodes, owner_node)}
+  end
+end
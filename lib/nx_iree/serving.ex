@@ -0,0 +1,175 @@
+defmodule NxIREE.Serving do
+  @moduledoc """
+  An `Nx.Serving` for functions compiled with `NxIREE.Compiler`.
+
+  The function is compiled ahead of time for every batch key and batch
+  size, and every device replica loads its own copy of each module.
+  Incoming batches are padded up to the smallest compiled size that fits
+  them and run on the replica with the fewest batches in flight.
+
+      serving =
+        NxIREE.Serving.new(&MyModel.predict(params, &1),
+          templates: %{default: Nx.template({1, 128}, :f32)},
+          batch_sizes: [1, 8, 32],
+          devices: ["local-task://", "local-task://"],
+          iree_compiler_flags: ["--iree-input-type=stablehlo_xla"]
+        )
+
+      Nx.Serving.start_link(serving: serving, name: MyServing, partitions: true)
+
+  With `partitions: true`, `Nx.Serving` runs one partition per device,
+  so batches for different devices run concurrently.
+
+  ## Options
+
+    * `:templates` - a map from batch key to the template of the
+      function argument, as a tensor or a container of tensors. The
+      leading axis of each tensor is the batch axis and its size is
+      ignored. Using keys other than `:default` requires the same keys
+      to be given as `:batch_keys` to `Nx.Serving.start_link/1`. Required.
+    * `:batch_sizes` - the batch sizes to compile modules for. The largest
+      one becomes the serving batch size. Defaults to `[1]`.
+    * `:devices` - the devices to replicate the function on, as URIs.
+      Defaults to the device in `:iree_runtime_options`.
+
+  Every other option is given to `NxIREE.Compiler`.
+  """
+
+  @behaviour Nx.Serving
+
+  alias Nx.Defn.Composite
+
+  @doc """
+  Creates a serving for the arity-1 `fun`.
+
+  See the module documentation for options.
+  """
+  def new(fun, opts) when is_function(fun, 1) do
+    {serving_opts, defn_opts} = Keyword.split(opts, [:templates, :batch_sizes, :devices])
+
+    templates =
+      case serving_opts[:templates] do
+        %{} = templates when map_size(templates) > 0 -> templates
+        _ -> raise ArgumentError, ":templates must be a non-empty map of batch keys to templates"
+      end
+
+    batch_sizes = serving_opts |> Keyword.get(:batch_sizes, [1]) |> Enum.uniq() |> Enum.sort()
+
+    defn_opts =
+      case serving_opts[:devices] do
+        nil -> defn_opts
+        devices -> Keyword.put(defn_opts, :iree_partition_devices, devices)
+      end
+
+    __MODULE__
+    |> Nx.Serving.new({fun, templates, batch_sizes}, [compiler: NxIREE.Compiler] ++ defn_opts)
+    |> Nx.Serving.batch_size(List.last(batch_sizes))
+  end
+
+  @impl true
+  def init(_type, {fun, templates, batch_sizes}, partitions_options) do
+    # Without `partitions: true`, a single partition still gets a replica per device
+    replicas =
+      partitions_options
+      |> Enum.flat_map(&NxIREE.Compiler.__partitions_options__/1)
+      |> Enum.map(fn opts ->
+        {:ok, device} = NxIREE.Device.get(opts[:iree_runtime_options][:device])
+        {device, opts}
+      end)
+      |> compile_modules(fun, templates, batch_sizes)
+      |> List.to_tuple()
+
+    state = %{
+      replicas: replicas,
+      load: :atomics.new(tuple_size(replicas), []),
+      batch_sizes: batch_sizes
+    }
+
+    {:ok, state}
+  end
+
+  # Modules are compiled once per compiler target and batch variant, and
+  # then loaded separately by each replica
+  defp compile_modules(replicas, fun, templates, batch_sizes) do
+    variants = for {key, template} <- templates, size <- batch_sizes, do: {key, size, template}
+
+    bytecode =
+      replicas
+      |> Enum.uniq_by(fn {device, _opts} -> device.compiler_target_backend end)
+      |> Map.new(fn {device, opts} ->
+        modules =
+          Map.new(variants, fn {key, size, template} ->
+            {:ok, module} = NxIREE.Compiler.to_bytecode(fun, [batched(template, size)], opts)
+            {{key, size}, module}
+          end)
+
+        {device.compiler_target_backend, modules}
+      end)
+
+    Enum.map(replicas, fn {device, _opts} ->
+      modules =
+        Map.new(bytecode[device.compiler_target_backend], fn {variant, module} ->
+          {:ok, ref} = NxIREE.VM.load_module_from_binary(module.bytecode)
+          {variant, %{module | ref: ref}}
+        end)
+
+      %{device: device, modules: modules}
+    end)
+  end
+
+  defp batched(template, size) do
+    Composite.traverse(template, fn %Nx.Tensor{shape: shape, type: type, names: names} ->
+      Nx.template(put_elem(shape, 0, size), type, names: names)
+    end)
+  end
+
+  @impl true
+  def handle_batch(batch, partition, state) do
+    %{replicas: replicas, load: load, batch_sizes: batch_sizes} = state
+
+    index = least_loaded(load, tuple_size(replicas), rem(partition, tuple_size(replicas)))
+    %{device: device, modules: modules} = elem(replicas, index)
+    :atomics.add(load, index + 1, 1)
+
+    fun = fn ->
+      try do
+        size = Enum.find(batch_sizes, &(&1 >= batch.size))
+
+        unless size do
+          raise ArgumentError,
+                "batch of size #{batch.size} exceeds the largest compiled batch size " <>
+                  "#{List.last(batch_sizes)}"
+        end
+
+        module =
+          case Map.fetch(modules, {batch.key, size}) do
+            {:ok, module} -> module
+            :error -> raise ArgumentError, "no template given for batch key #{inspect(batch.key)}"
+          end
+
+        batch = Nx.Batch.pad(batch, size - batch.size)
+        {args, :ok} = Nx.LazyContainer.traverse(batch, :ok, fn _, fun, :ok -> {fun.(), :ok} end)
+
+        inputs =
+          [args]
+          |> Composite.flatten_list()
+          |> NxIREE.Compiler.filter_inputs_by_indices(module.used_inputs)
+
+        {:ok, result} = NxIREE.call(module, inputs, device: device)
+        {result, :server_info}
+      after
+        :atomics.sub(load, index + 1, 1)
+      end
+    end
+
+    {:execute, fun, state}
+  end
+
+  # Picks the replica with the fewest batches in flight, preferring the
+  # partition's own replica on ties
+  defp least_loaded(load, count, preferred) do
+    Enum.min_by(0..(count - 1), fn index ->
+      {:atomics.get(load, index + 1), index != preferred}
+    end)
+  end
+end
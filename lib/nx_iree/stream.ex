@@ -0,0 +1,186 @@
+defmodule NxIREE.Stream do
+  @moduledoc """
+  A stream of computations run by `NxIREE.Compiler`, returned by `Nx.Defn.stream/3`.
+
+  The compiled module is loaded once and the accumulator stays on the device
+  between chunks. Each chunk is uploaded to the device by the process that
+  sends it, so uploading the next chunk overlaps with the computation of
+  the current one.
+  """
+
+  use GenServer
+
+  defstruct [:pid, :input, :device, :tenant]
+
+  @doc false
+  def start_link(%NxIREE.Module{} = module, input, acc, args, runtime_options) do
+    {:ok, device} = NxIREE.Device.get(runtime_options[:device])
+
+    {:ok, module_ref} =
+      case module do
+        %{ref: ref} when ref != nil -> {:ok, ref}
+        %{bytecode: bytecode} -> NxIREE.VM.load_module_from_binary(bytecode)
+      end
+
+    module = %{module | ref: module_ref}
+
+    input_length = length(Nx.Defn.Composite.flatten_list([input]))
+    acc_length = length(Nx.Defn.Composite.flatten_list([acc]))
+    {_input_args, args} = Enum.split(args, input_length)
+    {acc_args, args} = Enum.split(args, acc_length)
+
+    # Chunks are run by the stream process, charged to the quota of the caller
+    tenant = runtime_options[:tenant] || NxIREE.Quota.get_tenant()
+
+    # The accumulator and the fixed arguments are uploaded once
+    acc = Enum.map(acc_args, &to_device(&1.(), device, tenant))
+    args = Enum.map(args, &to_device(&1.(), device, tenant))
+
+    state = %{
+      module: module,
+      device: device,
+      tenant: tenant,
+      acc: acc,
+      args: args,
+      outputs: :queue.new(),
+      waiting: :queue.new()
+    }
+
+    {:ok, pid} = GenServer.start_link(__MODULE__, state)
+    input = Nx.Defn.Composite.traverse(input, &Nx.to_template/1)
+    %__MODULE__{pid: pid, input: input, device: device, tenant: tenant}
+  end
+
+  # Returns the tensor on the device and whether the stream owns that copy.
+  # Tensors already on the device belong to the caller and are never released,
+  # uploads are charged to the quota of the tenant until the stream releases them.
+  @doc false
+  def to_device(tensor, device, tenant) do
+    device_ref = device.ref
+
+    case Nx.to_tensor(tensor) do
+      %Nx.Tensor{data: %NxIREE.Backend{data: nil, device: ^device_ref}} = tensor ->
+        {tensor, false}
+
+      tensor ->
+        quota = NxIREE.Quota.__request__(tenant)
+        {:ok, ref} = NxIREE.VM.allocate_buffer(tensor, device_ref, quota)
+
+        data = %NxIREE.Backend{
+          ref: ref,
+          device: device_ref,
+          device_uri: device.uri,
+          driver: device.driver_name
+        }
+
+        {%{tensor | data: data}, true}
+    end
+  end
+
+  defp release(tensors) do
+    for {tensor, true} <- tensors, do: NxIREE.VM.deallocate_buffer(tensor.data)
+    :ok
+  end
+
+  @impl true
+  def init(state) do
+    {:ok, state}
+  end
+
+  @impl true
+  def handle_cast({:send, input}, state) do
+    %{module: module, device: device, tenant: tenant, acc: acc, args: args} = state
+
+    inputs =
+      (input ++ acc ++ args)
+      |> Enum.map(&elem(&1, 0))
+      |> NxIREE.Compiler.filter_inputs_by_indices(module.used_inputs)
+
+    {:ok, {output, new_acc}} = NxIREE.call(module, inputs, device: device, tenant: tenant)
+
+    # The previous accumulator and the input chunk are no longer needed
+    release(input ++ acc)
+
+    new_acc = Enum.map(Nx.Defn.Composite.flatten_list([new_acc]), &{&1, true})
+    state = %{state | acc: new_acc}
+
+    state =
+      case :queue.out(state.waiting) do
+        {{:value, from}, waiting} ->
+          GenServer.reply(from, {:ok, output})
+          %{state | waiting: waiting}
+
+        {:empty, _} ->
+          %{state | outputs: :queue.in(output, state.outputs)}
+      end
+
+    {:noreply, state}
+  end
+
+  @impl true
+  def handle_call(:recv, from, state) do
+    case :queue.out(state.outputs) do
+      {{:value, output}, outputs} ->
+        {:reply, {:ok, output}, %{state | outputs: outputs}}
+
+      {:empty, _} ->
+        {:noreply, %{state | waiting: :queue.in(from, state.waiting)}}
+    end
+  end
+
+  def handle_call(:done, _from, state) do
+    if :queue.is_empty(state.outputs) do
+      {_output, acc_template} = state.module.output_container
+
+      {acc, []} =
+        Nx.Defn.Composite.traverse(acc_template, state.acc, fn _, [{tensor, _owned?} | rest] ->
+          {tensor, rest}
+        end)
+
+      release(state.args)
+      {:stop, :normal, {:ok, acc}, state}
+    else
+      {:reply, {:error, "cannot mark stream as done when there are recv messages pending"},
+       state}
+    end
+  end
+
+  defimpl Nx.Stream do
+    def send(%{pid: pid, input: input, device: device, tenant: tenant}, data) do
+      data = Nx.Defn.Composite.traverse(data, &Nx.to_tensor/1)
+
+      unless Nx.Defn.Composite.compatible?(input, data, &Nx.compatible?/2) do
+        raise ArgumentError, """
+        Nx stream expected a tensor of type, shape, and names on send:
+
+        #{inspect(input)}
+
+        But got tensor:
+
+        #{inspect(data)}
+        """
+      end
+
+      # Uploading here instead of in the stream process lets the upload
+      # overlap with the computation of the previous chunk
+      input =
+        data
+        |> Nx.Defn.Composite.flatten_list()
+        |> Enum.map(&NxIREE.Stream.to_device(&1, device, tenant))
+
+      GenServer.cast(pid, {:send, input})
+    end
+
+    def recv(%{pid: pid}) do
+      {:ok, output} = GenServer.call(pid, :recv, :infinity)
+      output
+    end
+
+    def done(%{pid: pid}) do
+      case GenServer.call(pid, :done, :infinity) do
+        {:ok, acc} -> acc
+        {:error, message} -> raise message
+      end
+    end
+  end
+end
@@ -0,0 +1,154 @@
+defmodule NxIREE.TensorBundle do
+  @moduledoc """
+  Serializes many tensors at once, for shipping model inputs and outputs
+  between nodes or to embedded devices.
+
+  Tensors are written straight into the resulting binary. Files read with
+  `read/2` are memory-mapped, and each payload is wrapped in place whenever
+  the device can use host memory, as the CPU drivers do. Wrapped tensors
+  count as host-backed in `NxIREE.Memory.live_tensors/0`. Bundles given to
+  `deserialize/2`, as well as files read onto other devices, are copied
+  onto the device instead.
+
+      {:ok, bundle} = NxIREE.TensorBundle.serialize([input_ids, attention_mask])
+      {:ok, [input_ids, attention_mask]} = NxIREE.TensorBundle.deserialize(bundle)
+
+  Tensor names are not preserved.
+
+  Bundles can be compressed with `compression: :lz4`, which usually pays
+  off for sparse or smooth data sent over slow links. Compressed payloads
+  are decoded straight into device buffers when reading them back.
+
+  ## Format
+
+  All integers are little-endian.
+
+    * header - 64 bytes
+      * magic - `"NXTB"`
+      * format version - unsigned 16 bits
+      * flags - unsigned 16 bits
+      * tensor count - unsigned 32 bits
+      * table size - unsigned 32 bits
+      * total size - unsigned 64 bits
+      * table checksum - unsigned 32 bits
+      * zero padding
+    * table - one entry per tensor
+      * IREE element type - unsigned 32 bits
+      * rank - unsigned 32 bits
+      * payload offset - unsigned 64 bits
+      * payload size - unsigned 64 bits
+      * stored size - unsigned 64 bits
+      * payload checksum - unsigned 32 bits
+      * encoding - unsigned 32 bits
+      * dimensions - signed 64 bits each
+    * payloads - each at an offset which is a multiple of 64 bytes
+
+  Checksums are CRC32. The table checksum covers the header, with the
+  checksum field set to zero, and the table. Payload checksums cover the
+  stored bytes. Bundles with unknown versions, flags or encodings, sizes
+  which do not match the shapes, out-of-bounds offsets or checksum
+  mismatches are rejected.
+
+  The only flag is `1`, set when any payload is encoded. The encodings are:
+
+    * `0` - raw bytes
+    * `1` - an LZ4 block
+    * `2` - an LZ4 block of the payload with the i-th byte of every element
+      grouped together, used for floating-point types
+  """
+
+  @doc """
+  Serializes the given tensors into a bundle.
+
+  Tensors which are not allocated by `NxIREE.Backend` on this node are
+  copied into temporary host buffers first, reading remote tensors back.
+
+  ## Options
+
+    * `:compression` - either `nil` or `:lz4`. Payloads which don't
+      shrink when compressed are stored raw. Defaults to `nil`.
+  """
+  def serialize(tensors, opts \\ []) when is_list(tensors) do
+    opts = Keyword.validate!(opts, compression: nil)
+
+    compression =
+      case opts[:compression] do
+        nil -> ~c"none"
+        :lz4 -> ~c"lz4"
+        other -> raise ArgumentError, "unknown compression #{inspect(other)}"
+      end
+
+    device_ref = NxIREE.Device.default_device().ref
+
+    {refs, temporary_refs} =
+      Enum.map_reduce(tensors, [], fn
+        %Nx.Tensor{data: %NxIREE.Backend{ref: ref, data: nil, node: nil}}, temporary_refs ->
+          {ref, temporary_refs}
+
+        tensor, temporary_refs ->
+          {:ok, ref} = NxIREE.VM.allocate_buffer(tensor, device_ref)
+          {ref, [ref | temporary_refs]}
+      end)
+
+    try do
+      NxIREE.Native.serialize_tensors(refs, compression)
+    after
+      Enum.each(temporary_refs, &NxIREE.Native.deallocate_buffer/1)
+    end
+  end
+
+  @doc """
+  Reads the tensors in the given bundle.
+
+  ## Options
+
+    * `:device` - the device to place the tensors on. Defaults to the
+      default device.
+  """
+  def deserialize(bundle, opts \\ []) when is_binary(bundle) do
+    opts = Keyword.validate!(opts, [:device])
+    {:ok, device} = NxIREE.Device.get(opts[:device])
+
+    with {:ok, refs} <- NxIREE.Native.deserialize_tensors(device.ref, bundle) do
+      {:ok, Enum.map(refs, &NxIREE.Backend.from_ref(&1, device))}
+    end
+  end
+
+  @doc """
+  Writes the given tensors to a bundle file at `path`.
+
+  Accepts the same options as `serialize/2`.
+  """
+  def write(tensors, path, opts \\ []) when is_list(tensors) do
+    with {:ok, bundle} <- serialize(tensors, opts) do
+      # Write to a temporary file first so readers never observe a partial bundle
+      tmp_path = "#{path}.#{System.unique_integer([:positive])}.tmp"
+
+      with :ok <- File.write(tmp_path, bundle),
+           :ok <- File.rename(tmp_path, path) do
+        :ok
+      else
+        error ->
+          File.rm(tmp_path)
+          error
+      end
+    end
+  end
+
+  @doc """
+  Reads the tensors in the bundle file at `path`.
+
+  The file is memory-mapped. Tensors which wrap it in place keep the
+  mapping alive, so the file must not be modified while they are in use.
+
+  Accepts the same options as `deserialize/2`.
+  """
+  def read(path, opts \\ []) do
+    opts = Keyword.validate!(opts, [:device])
+    {:ok, device} = NxIREE.Device.get(opts[:device])
+
+    with {:ok, refs} <- NxIREE.Native.deserialize_tensors_file(device.ref, path) do
+      {:ok, Enum.map(refs, &NxIREE.Backend.from_ref(&1, device))}
+    end
+  end
+end
@@ -0,0 +1,68 @@
+defmodule NxIREE.Tracing do
+  @moduledoc """
+  Records what the runtime spends its time on, without rebuilding it.
+
+  While tracing is on, the runtime records spans for NIF entry, the time
+  calls wait for a dirty scheduler, module loads, each host-to-device and
+  device-to-host transfer and every phase of a call, including the VM
+  invocation. Spans go into a fixed-size ring buffer shared by all threads,
+  so the newest spans are kept once it fills up. Recording is lock-free and
+  costs a single atomic load per span while tracing is off.
+
+  Traces are exported in the Chrome trace event format, which can be opened
+  with [Perfetto](https://ui.perfetto.dev) or `chrome://tracing`:
+
+      NxIREE.Tracing.capture("nx_iree_trace.json", 10_000)
+  """
+
+  @default_capacity 65_536
+
+  @doc """
+  Starts recording spans, discarding previously recorded ones.
+
+  ## Options
+
+    * `:capacity` - how many spans the ring buffer holds.
+      Defaults to `#{@default_capacity}`.
+  """
+  def start(opts \\ []) do
+    opts = Keyword.validate!(opts, capacity: @default_capacity)
+
+    case NxIREE.Native.start_tracing(opts[:capacity]) do
+      :ok -> :ok
+      {:error, reason} -> raise ArgumentError, List.to_string(reason)
+    end
+  end
+
+  @doc """
+  Stops recording spans. The recorded ones are kept until the next `start/1`.
+  """
+  def stop do
+    NxIREE.Native.stop_tracing()
+  end
+
+  @doc """
+  Returns the recorded spans as Chrome trace event JSON.
+  """
+  def export do
+    {:ok, trace} = NxIREE.Native.export_trace()
+    trace
+  end
+
+  @doc """
+  Records spans for `duration` milliseconds and writes the trace to `path`.
+
+  Accepts the same options as `start/1`.
+  """
+  def capture(path, duration, opts \\ []) do
+    :ok = start(opts)
+
+    try do
+      Process.sleep(duration)
+    after
+      stop()
+    end
+
+    File.write(path, export())
+  end
+end
@@ -2,6 +2,7 @@ defmodule NxIREE.VM do
   @moduledoc false
 
   @cache_key {__MODULE__, :iree_vm_instance}
+  @module_key {__MODULE__, :modules}
 
   def create_instance do
     {:ok, instance} = NxIREE.Native.create_instance()
@@ -17,55 +18,105 @@ defmodule NxIREE.VM do
     end
   end
 
+  def load_module(path, offset \\ 0, length \\ -1) do
+    NxIREE.Native.load_module(get_instance(), path, offset, length)
+  end
+
+  def load_module_from_binary(bytecode) when is_binary(bytecode) do
+    NxIREE.Native.load_module_from_binary(get_instance(), bytecode)
+  end
+
+  def register_module(name, %NxIREE.Module{} = module) do
+    modules = :persistent_term.get(@module_key, %{})
+    :persistent_term.put(@module_key, Map.put(modules, name, module))
+    :ok
+  end
+
+  def fetch_module(name) do
+    case :persistent_term.get(@module_key, %{}) do
+      %{^name => module} -> {:ok, module}
+      _ -> {:error, :unknown_module}
+    end
+  end
+
+  # Tensors and numbers are only charged to a quota when given one, see NxIREE.Quota
+  def allocate_buffer(tensor_or_number, device_ref, quota \\ nil)
+
   def allocate_buffer(
         %Nx.Tensor{shape: shape, type: type, data: %NxIREE.Backend{} = t},
-        device_ref
+        device_ref,
+        quota
       ) do
     case t do
-      %{data: nil, ref: ref, device_ref: ^device_ref} ->
+      %{data: nil, ref: ref, device: ^device_ref} ->
         # Same device, so we can just return the ref
-        ref
+        {:ok, ref}
 
       %{data: nil} ->
         # in this case, we're dealing with different devices,
         # so we'll copy data from one to the other
         {:ok, data} = read_buffer(t)
-        allocate_buffer(data, device_ref, shape, type)
+        allocate_buffer(data, device_ref, shape, type, quota)
 
       %{data: binary} ->
-        allocate_buffer(binary, device_ref, Nx.shape(t), Nx.type(t))
+        allocate_buffer(binary, device_ref, Nx.shape(t), Nx.type(t), quota)
     end
   end
 
-  def allocate_buffer(%Nx.Tensor{} = t, device_ref) do
-    allocate_buffer(Nx.to_binary(t), device_ref, Nx.shape(t), Nx.type(t))
+  def allocate_buffer(%Nx.Tensor{} = t, device_ref, quota) do
+    allocate_buffer(Nx.to_binary(t), device_ref, Nx.shape(t), Nx.type(t), quota)
   end
 
-  def allocate_buffer(n, device_ref) when is_number(n) or is_struct(n, Complex) do
+  def allocate_buffer(n, device_ref, quota) when is_number(n) or is_struct(n, Complex) do
     # allocate a binary backend tensor for data uniformity
     t = Nx.tensor(n, backend: Nx.BinaryBackend)
-    data = Nx.to_binary(t)
-    shape = {}
-    element_type = to_iree_type(Nx.type(t))
-
-    NxIREE.Native.allocate_buffer(data, device_ref, Tuple.to_list(shape), element_type)
+    allocate_buffer(Nx.to_binary(t), device_ref, {}, Nx.type(t), quota)
   end
 
-  def allocate_buffer(binary, device_ref, shape, type) when is_binary(binary) do
+  # Buffers are only charged to a quota when given one, see NxIREE.Quota
+  def allocate_buffer(binary, device_ref, shape, type, quota \\ nil) when is_binary(binary) do
     element_type = to_iree_type(type)
-    NxIREE.Native.allocate_buffer(binary, device_ref, Tuple.to_list(shape), element_type)
+
+    dims = Tuple.to_list(shape)
+
+    case NxIREE.Native.allocate_buffer(binary, device_ref, dims, element_type, quota) do
+      {:error, {:quota_exceeded, _, _, _, _} = reason} -> NxIREE.Quota.__raise__(reason)
+      result -> result
+    end
   end
 
-  def deallocate_buffer(%NxIREE.Backend{} = t) do
+  def deallocate_buffer(%NxIREE.Backend{node: nil} = t) do
     NxIREE.Native.deallocate_buffer(t.ref)
   end
 
-  def read_buffer(%NxIREE.Backend{} = t) do
+  def deallocate_buffer(%NxIREE.Backend{} = t) do
+    NxIREE.Remote.release(t)
+  end
+
+  def read_buffer(%NxIREE.Backend{node: nil} = t) do
     read_buffer(t.device, t.ref)
   end
 
+  def read_buffer(%NxIREE.Backend{} = t) do
+    NxIREE.Remote.read(t)
+  end
+
   def read_buffer(device_ref, buffer_ref, num_bytes \\ -1) do
-    NxIREE.Native.read_buffer(device_ref, buffer_ref, num_bytes)
+    :telemetry.span([:nx_iree, :read_buffer], %{}, fn ->
+      case NxIREE.Native.read_buffer(device_ref, buffer_ref, num_bytes) do
+        {:ok, binary} = result -> {result, %{bytes_downloaded: byte_size(binary)}, %{}}
+        error -> {error, %{bytes_downloaded: 0}, %{}}
+      end
+    end)
+  end
+
+  def to_pointer(%NxIREE.Backend{ref: ref}) do
+    NxIREE.Native.to_pointer(ref)
+  end
+
+  def from_pointer(address, device_ref, shape, type, owner) do
+    element_type = to_iree_type(type)
+    NxIREE.Native.from_pointer(device_ref, address, Tuple.to_list(shape), element_type, owner)
   end
 
   defp to_iree_type(type) do
@@ -51,7 +51,7 @@ defmodule NxIREE.MixProject do
   # Run "mix help compile.app" to learn about applications.
   def application do
     [
-      extra_applications: [:logger],
+      extra_applications: [:logger, :crypto],
       mod: {NxIREE.Application, []}
     ]
   end
@@ -62,6 +62,7 @@ defmodule NxIREE.MixProject do
       {:elixir_make, "~> 0.6", runtime: false},
       {:exla, "~> 0.9"},
       {:nx, "~> 0.9"},
+      {:telemetry, "~> 0.4.0 or ~> 1.0"},
       {:ex_doc, "~> 0.34"},
       {:req, "~> 0.5", runtime: false}
     ]
@@ -0,0 +1,73 @@
+defmodule NxIREE.BackendTest do
+  use ExUnit.Case, async: true
+
+  describe "to_pointer/2 and from_pointer/5" do
+    test "shares host tensors without copying" do
+      tensor = Nx.tensor([[1, 2], [3, 4]], type: :s32, backend: NxIREE.Backend)
+
+      pointer = Nx.to_pointer(tensor)
+      assert %Nx.Pointer{kind: :local, address: address, data_size: 16} = pointer
+      assert is_integer(address)
+
+      imported =
+        Nx.from_pointer(
+          {NxIREE.Backend, device: "local-sync://", owner: tensor},
+          pointer,
+          {:s, 32},
+          {2, 2},
+          names: [:x, :y]
+        )
+
+      assert imported.names == [:x, :y]
+      assert Nx.to_binary(imported) == Nx.to_binary(tensor)
+    end
+
+    test "maps call outputs and imports them as call inputs" do
+      fun =
+        Nx.Defn.jit(&Nx.multiply(&1, 2),
+          compiler: NxIREE.Compiler,
+          iree_compiler_flags: ["--iree-input-type=stablehlo_xla"],
+          iree_runtime_options: [device: "local-sync://"]
+        )
+
+      output = fun.(Nx.tensor([1.0, 2.0, 3.0]))
+      pointer = Nx.to_pointer(output)
+
+      imported =
+        Nx.from_pointer(
+          {NxIREE.Backend, device: "local-sync://", owner: output},
+          pointer,
+          {:f, 32},
+          {3}
+        )
+
+      assert Nx.to_flat_list(fun.(imported)) == [4.0, 8.0, 12.0]
+    end
+
+    test "shares writes through the pointer with the following calls" do
+      fun =
+        Nx.Defn.jit(&Nx.multiply(&1, 2),
+          compiler: NxIREE.Compiler,
+          iree_compiler_flags: ["--iree-input-type=stablehlo_xla"],
+          iree_runtime_options: [device: "local-sync://"]
+        )
+
+      output = fun.(Nx.tensor([1.0, 2.0, 3.0]))
+      %Nx.Pointer{address: address} = Nx.to_pointer(output)
+
+      data = <<10.0::float-32-native, 20.0::float-32-native, 30.0::float-32-native>>
+      assert :ok = NxIREE.Native.write_pointer(address, data)
+
+      assert Nx.to_flat_list(fun.(output)) == [20.0, 40.0, 60.0]
+      assert Nx.to_flat_list(output) == [10.0, 20.0, 30.0]
+    end
+
+    test "rejects pointers which are too small" do
+      pointer = %Nx.Pointer{kind: :local, address: 0, data_size: 4}
+
+      assert_raise ArgumentError, ~r/expected at least 16/, fn ->
+        Nx.from_pointer({NxIREE.Backend, device: "local-sync://"}, pointer, {:f, 32}, {4})
+      end
+    end
+  end
+end
@@ -0,0 +1,69 @@
+defmodule NxIREE.BundleTest do
+  use ExUnit.Case, async: true
+
+  @moduletag :tmp_dir
+
+  test "writes and loads a bundle into a callable", %{tmp_dir: tmp_dir} do
+    fun = fn {a, b}, c -> {Nx.add(a, b), Nx.multiply(b, c)} end
+
+    templates = [{Nx.template({4}, :f32), Nx.template({4}, :f32)}, Nx.template({4}, :f32)]
+
+    {:ok, module} =
+      NxIREE.Compiler.to_bytecode(fun, templates,
+        iree_compiler_flags: ["--iree-input-type=stablehlo_xla"],
+        iree_runtime_options: [device: "local-sync://"]
+      )
+
+    path = Path.join(tmp_dir, "fun.nxiree")
+    assert :ok = NxIREE.Bundle.write(module, path)
+
+    assert {:ok, %{compilation_flags: flags, input_templates: stored}} =
+             NxIREE.Bundle.metadata(path)
+
+    assert "--iree-input-type=stablehlo_xla" in flags
+    assert length(Nx.Defn.Composite.flatten_list(stored)) == 3
+
+    assert {:ok, loaded} = NxIREE.Bundle.load_function(path, device: "local-sync://")
+
+    a = Nx.tensor([1.0, 2.0, 3.0, 4.0])
+    b = Nx.tensor([1.0, 1.0, 1.0, 1.0])
+    c = Nx.tensor([2.0, 2.0, 2.0, 2.0])
+
+    assert {sum, product} = loaded.([{a, b}, c])
+    assert Nx.to_flat_list(sum) == [2.0, 3.0, 4.0, 5.0]
+    assert Nx.to_flat_list(product) == [2.0, 2.0, 2.0, 2.0]
+
+    assert_raise ArgumentError, fn -> loaded.([{a, b}, Nx.tensor([1, 2, 3, 4])]) end
+  end
+
+  test "refuses bundles compiled for CPU features the host lacks", %{tmp_dir: tmp_dir} do
+    {:ok, module} =
+      NxIREE.Compiler.to_bytecode(&Nx.add/2, [Nx.template({4}, :f32), Nx.template({4}, :f32)],
+        iree_compiler_flags: ["--iree-input-type=stablehlo_xla"],
+        iree_runtime_options: [device: "local-sync://"]
+      )
+
+    module = %{
+      module
+      | compilation_flags:
+          module.compilation_flags ++ ["--iree-llvmcpu-target-cpu-features=+nx-iree-missing"]
+    }
+
+    path = Path.join(tmp_dir, "add.nxiree")
+    assert :ok = NxIREE.Bundle.write(module, path)
+
+    assert {:ok, %{target_cpu_features: features}} = NxIREE.Bundle.metadata(path)
+    assert "+nx-iree-missing" in features
+
+    assert {:error, "bundle requires CPU features missing on this host: +nx-iree-missing"} =
+             NxIREE.Bundle.load(path)
+
+    assert {:ok, %NxIREE.Module{}} = NxIREE.Bundle.load(path, check_cpu_features: false)
+  end
+
+  test "rejects files that are not bundles", %{tmp_dir: tmp_dir} do
+    path = Path.join(tmp_dir, "garbage")
+    File.write!(path, "definitely not a bundle, but long enough to hold a header")
+    assert {:error, "not an NxIREE bundle"} = NxIREE.Bundle.load(path)
+  end
+end
@@ -0,0 +1,37 @@
+defmodule NxIREE.Compiler.AutotuneTest do
+  use ExUnit.Case, async: true
+
+  alias NxIREE.Compiler.Autotune
+
+  test "merge_flags/2 replaces options set by the candidate" do
+    flags = ["--iree-input-type=stablehlo_xla", "--iree-opt-data-tiling=false"]
+
+    assert Autotune.merge_flags(flags, ["--iree-opt-data-tiling=true"]) ==
+             ["--iree-input-type=stablehlo_xla", "--iree-opt-data-tiling=true"]
+  end
+
+  test "picks a candidate and records it for reuse" do
+    fun = &Nx.multiply/2
+    templates = [Nx.template({16}, :f32), Nx.template({16}, :f32)]
+    base_flags = ["--iree-input-type=stablehlo_xla", "--iree-hal-target-backends=llvm-cpu"]
+    candidates = [[], ["--iree-opt-data-tiling=true"], ["--not-a-valid-flag"]]
+
+    {:ok, module} =
+      NxIREE.Compiler.to_bytecode(fun, templates,
+        iree_compiler_flags: base_flags,
+        iree_runtime_options: [device: "local-sync://"],
+        iree_host_cpu_features: false,
+        iree_autotune: [candidates: candidates, runs: 2]
+      )
+
+    assert {:ok, %{flags: flags, timings: timings}} =
+             Autotune.fetch_record(module.mlir_module, base_flags, "local-sync://")
+
+    assert module.compilation_flags == flags
+    # the invalid candidate fails to compile and is left out
+    assert length(timings) == 2
+
+    # timings taken on one device don't apply to another one
+    assert :error = Autotune.fetch_record(module.mlir_module, base_flags, "local-task://")
+  end
+end
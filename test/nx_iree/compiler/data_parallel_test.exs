@@ -0,0 +1,63 @@
+defmodule NxIREE.Compiler.DataParallelTest do
+  use ExUnit.Case, async: true
+
+  test "splits the batch across devices and gathers the results" do
+    fun =
+      Nx.Defn.jit(fn x, w -> {Nx.dot(x, w), Nx.sum(x, axes: [1])} end,
+        compiler: NxIREE.Compiler,
+        iree_compiler_flags: ["--iree-input-type=stablehlo_xla"],
+        iree_data_parallel: [
+          devices: ["local-sync://", "local-sync://"],
+          input_axes: [0, nil]
+        ]
+      )
+
+    x = Nx.iota({5, 3}, type: :f32, backend: Nx.BinaryBackend)
+    w = Nx.iota({3, 2}, type: :f32, backend: Nx.BinaryBackend)
+
+    assert {product, sum} = fun.(x, w)
+    assert Nx.shape(product) == {5, 2}
+    assert Nx.to_flat_list(product) == Nx.to_flat_list(Nx.dot(x, w))
+    assert Nx.to_flat_list(sum) == Nx.to_flat_list(Nx.sum(x, axes: [1]))
+  end
+
+  test "gathers the results of distinct devices on the first device" do
+    fun =
+      Nx.Defn.jit(&Nx.multiply(&1, 2),
+        compiler: NxIREE.Compiler,
+        iree_compiler_flags: ["--iree-input-type=stablehlo_xla"],
+        iree_data_parallel: [devices: ["local-sync://", "local-task://"]]
+      )
+
+    x = Nx.iota({4, 2}, type: :f32, backend: Nx.BinaryBackend)
+
+    result = fun.(x)
+    assert %NxIREE.Backend{device_uri: "local-sync://"} = result.data
+    assert Nx.to_flat_list(result) == Nx.to_flat_list(Nx.multiply(x, 2))
+  end
+
+  test "rejects outputs which are not batched" do
+    fun =
+      Nx.Defn.jit(&Nx.sum(&1, axes: [0]),
+        compiler: NxIREE.Compiler,
+        iree_compiler_flags: ["--iree-input-type=stablehlo_xla"],
+        iree_data_parallel: [devices: ["local-sync://", "local-sync://"]]
+      )
+
+    x = Nx.iota({4, 2}, type: :f32, backend: Nx.BinaryBackend)
+
+    assert_raise ArgumentError, ~r/every output must be batched along the output axis 0/, fn ->
+      fun.(x)
+    end
+  end
+
+  test "requires a batch axis" do
+    assert_raise ArgumentError, ~r/at least one argument with a batch axis/, fn ->
+      Nx.Defn.jit_apply(&Nx.add/2, [Nx.tensor(1.0), Nx.tensor(2.0)],
+        compiler: NxIREE.Compiler,
+        iree_compiler_flags: ["--iree-input-type=stablehlo_xla"],
+        iree_data_parallel: [devices: ["local-sync://"], input_axes: [nil, nil]]
+      )
+    end
+  end
+end
@@ -0,0 +1,52 @@
+defmodule NxIREE.Compiler.GraphSplitterTest do
+  use ExUnit.Case, async: true
+
+  alias NxIREE.Compiler.GraphSplitter
+
+  test "exports values reused by later stages instead of recomputing them" do
+    expr =
+      Nx.Defn.debug_expr(fn a, b ->
+        y = Nx.subtract(a, b)
+        z = Nx.sort(Nx.add(y, a))
+        Nx.add(y, z)
+      end).(Nx.template({4}, :f32), Nx.template({4}, :f32))
+
+    assert {[before_sort, sort, final], _state, _cache} = GraphSplitter.traverse(expr)
+
+    {before_sort_id, :none, before_sort_expr, _, _} = before_sort
+    {sort_id, :force_host, {_sorted}, _, _} = sort
+    {_final_id, :none, final_expr, final_arguments, final_sources} = final
+
+    # y is computed before the sort and exported after the sort input
+    assert {_sort_input, %Nx.Tensor{data: %Nx.Defn.Expr{op: :subtract}}} = before_sort_expr
+
+    assert final_sources |> Map.values() |> Enum.sort() ==
+             Enum.sort([{before_sort_id, 1}, {sort_id, 0}])
+
+    assert map_size(final_arguments) == 2
+    assert %Nx.Tensor{data: %Nx.Defn.Expr{op: :add, args: args}} = final_expr
+    assert Enum.all?(args, &match?(%Nx.Tensor{data: %Nx.Defn.Expr{op: :parameter}}, &1))
+  end
+
+  test "runs connected host nodes as a single stage" do
+    expr =
+      Nx.Defn.debug_expr(fn a, b ->
+        a
+        |> Nx.add(b)
+        |> Nx.sort()
+        |> Nx.is_nan()
+        |> Nx.add(1)
+      end).(Nx.template({4}, :f32), Nx.template({4}, :f32))
+
+    assert {[before_host, host, final], _state, _cache} = GraphSplitter.traverse(expr)
+
+    {before_host_id, :none, {%Nx.Tensor{data: %Nx.Defn.Expr{op: :add}}}, _, _} = before_host
+    {host_id, :force_host, {is_nan, sorted}, _, host_sources} = host
+    {_final_id, :none, _final_expr, _, final_sources} = final
+
+    assert %Nx.Tensor{data: %Nx.Defn.Expr{op: :is_nan, args: [^sorted]}} = is_nan
+    assert %Nx.Tensor{data: %Nx.Defn.Expr{op: :sort}} = sorted
+    assert Map.values(host_sources) == [{before_host_id, 0}]
+    assert Map.values(final_sources) == [{host_id, 0}]
+  end
+end
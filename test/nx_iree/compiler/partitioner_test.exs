@@ -0,0 +1,86 @@
+defmodule NxIREE.Compiler.PartitionerTest do
+  use ExUnit.Case, async: true
+
+  alias NxIREE.Compiler.Partitioner
+
+  defp expr(fun, templates), do: apply(Nx.Defn.debug_expr(fun), templates)
+
+  defp ops(expr, host_nodes) do
+    {_, ops} =
+      Nx.Defn.Composite.traverse(expr, [], fn node, acc -> collect_ops(node, host_nodes, acc) end)
+
+    Enum.sort(ops)
+  end
+
+  defp collect_ops(%Nx.Tensor{data: %Nx.Defn.Expr{id: id, op: op}} = node, host_nodes, acc) do
+    acc = if MapSet.member?(host_nodes, id), do: [op | acc], else: acc
+
+    {_, acc} =
+      Nx.Defn.Tree.apply_args(node, :scope, acc, fn arg, acc ->
+        collect_ops(arg, host_nodes, acc)
+      end)
+
+    {node, Enum.uniq(acc)}
+  end
+
+  defp collect_ops(other, _host_nodes, acc), do: {other, acc}
+
+  test "places unsupported ops on the host without the cost model" do
+    expr = expr(fn a -> Nx.argmax(Nx.multiply(a, 2)) end, [Nx.template({4}, :f32)])
+
+    assert ops(expr, Partitioner.place(expr, optimize: false)) == [:argmax]
+  end
+
+  test "merges small neighbours into the host island" do
+    expr = expr(fn a -> Nx.argmax(Nx.multiply(a, 2)) end, [Nx.template({4}, :f32)])
+
+    assert ops(expr, Partitioner.place(expr)) == [:argmax, :multiply]
+  end
+
+  test "keeps expensive ops on the accelerator" do
+    templates = [Nx.template({512, 512}, :f32), Nx.template({512, 512}, :f32)]
+    expr = expr(fn a, b -> Nx.argmax(Nx.dot(a, b), axis: 1) end, templates)
+
+    assert ops(expr, Partitioner.place(expr)) == [:argmax]
+  end
+
+  test "splits between two CPU devices" do
+    test_pid = self()
+    handler_id = {__MODULE__, make_ref()}
+
+    # Stages run in tasks, so calls are matched by their callers
+    :telemetry.attach(
+      handler_id,
+      [:nx_iree, :call, :stop],
+      fn _event, _measurements, metadata, _config ->
+        if test_pid in [self() | Process.get(:"$callers", [])] do
+          send(test_pid, {:stage_device, metadata.device})
+        end
+      end,
+      nil
+    )
+
+    on_exit(fn -> :telemetry.detach(handler_id) end)
+
+    fun =
+      Nx.Defn.jit(fn a, b -> Nx.argsort(Nx.dot(a, b), axis: 1) end,
+        compiler: NxIREE.Compiler,
+        iree_compiler_flags: ["--iree-input-type=stablehlo_xla"],
+        iree_partitioner: [
+          accelerator: "local-task://",
+          host: "local-sync://",
+          optimize: false,
+          profiles: %{"local-task" => %{unsupported_ops: [:argsort]}}
+        ]
+      )
+
+    a = Nx.iota({4, 4}, type: :f32)
+    b = Nx.negate(Nx.eye(4, type: :f32))
+
+    assert Nx.to_flat_list(fun.(a, b)) == List.flatten(List.duplicate([3, 2, 1, 0], 4))
+
+    assert_received {:stage_device, "local-task://"}
+    assert_received {:stage_device, "local-sync://"}
+    refute_received {:stage_device, _}
+  end
+end
@@ -0,0 +1,139 @@
+defmodule NxIREE.MemoryTest do
+  use ExUnit.Case, async: false
+
+  alias NxIREE.Memory
+
+  @device "local-sync://"
+
+  # The counters are global and tensors of earlier tests may still be garbage
+  # collected, so they are read once releases have settled, and only bounds
+  # which hold regardless of other releases are asserted on
+  defp settled_live_tensors(previous \\ nil, attempts \\ 50) do
+    :ok = Memory.flush_releases()
+    stats = Memory.live_tensors()
+
+    if stats == previous or attempts == 0 do
+      stats
+    else
+      Process.sleep(10)
+      settled_live_tensors(stats, attempts - 1)
+    end
+  end
+
+  defp eventually(fun, attempts \\ 100) do
+    cond do
+      fun.() ->
+        true
+
+      attempts == 0 ->
+        false
+
+      true ->
+        Process.sleep(10)
+        eventually(fun, attempts - 1)
+    end
+  end
+
+  test "counts live tensors until they are deallocated" do
+    before = settled_live_tensors()
+
+    add =
+      Nx.Defn.jit(&Nx.add/2,
+        compiler: NxIREE.Compiler,
+        iree_compiler_flags: ["--iree-input-type=stablehlo_xla"],
+        iree_runtime_options: [device: @device]
+      )
+
+    a = Nx.tensor([1.0, 2.0, 3.0], backend: {NxIREE.Backend, device: @device})
+    stats = Memory.live_tensors()
+    assert stats.host_count >= 1
+    assert stats.host_bytes >= 12
+    assert stats.host_peak_bytes >= stats.host_bytes
+
+    result = add.(a, a)
+    stats = Memory.live_tensors()
+    assert stats.device_count >= 1
+    assert stats.device_bytes >= 12
+    assert stats.device_peak_bytes >= stats.device_bytes
+
+    Nx.backend_deallocate(result)
+    Nx.backend_deallocate(a)
+    stats = settled_live_tensors()
+    assert stats.host_count <= before.host_count
+    assert stats.device_count <= before.device_count
+  end
+
+  test "releases tensors once they are garbage collected" do
+    before = settled_live_tensors()
+
+    {pid, monitor} =
+      spawn_monitor(fn -> Nx.tensor([1, 2, 3], backend: {NxIREE.Backend, device: @device}) end)
+
+    assert_receive {:DOWN, ^monitor, :process, ^pid, :normal}
+
+    assert eventually(fn ->
+             :ok = Memory.flush_releases()
+             Memory.live_tensors().host_count <= before.host_count
+           end)
+  end
+
+  test "keeps counting tensors until the release thread frees them" do
+    before = settled_live_tensors()
+    binary = :binary.copy(<<0>>, 65_536)
+
+    tensors =
+      for _ <- 1..32, do: Nx.from_binary(binary, :u8, backend: {NxIREE.Backend, device: @device})
+
+    Enum.each(tensors, &Nx.backend_deallocate/1)
+    assert Memory.live_tensors().host_bytes <= before.host_bytes + 32 * 65_536
+
+    :ok = Memory.flush_releases()
+    stats = Memory.live_tensors()
+    assert stats.host_count <= before.host_count
+    assert stats.host_bytes <= before.host_bytes
+  end
+
+  @tag :tmp_dir
+  test "wraps bundle files in place and copies in-memory bundles", %{tmp_dir: tmp_dir} do
+    size = 1_048_576
+    tensor = Nx.iota({div(size, 4)}, type: :f32, backend: {NxIREE.Backend, device: @device})
+    path = Path.join(tmp_dir, "tensors.nxtb")
+    :ok = NxIREE.TensorBundle.write([tensor], path)
+    {:ok, bundle} = NxIREE.TensorBundle.serialize([tensor])
+
+    before = settled_live_tensors()
+    {:ok, [wrapped]} = NxIREE.TensorBundle.read(path, device: @device)
+    stats = Memory.live_tensors()
+    assert stats.host_bytes >= before.host_bytes + size
+    assert stats.device_bytes <= before.device_bytes
+
+    {:ok, [copied]} = NxIREE.TensorBundle.deserialize(bundle, device: @device)
+    assert Memory.live_tensors().device_bytes >= stats.device_bytes + size
+
+    assert Nx.to_binary(wrapped) == Nx.to_binary(tensor)
+    assert Nx.to_binary(copied) == Nx.to_binary(tensor)
+  end
+
+  test "returns the allocator statistics of a device" do
+    assert {:ok, stats} = Memory.allocator_statistics(@device)
+    assert stats.host_bytes_allocated >= stats.host_bytes_freed
+    assert stats.device_bytes_allocated >= stats.device_bytes_freed
+  end
+
+  test "emits telemetry events" do
+    handler_id = {__MODULE__, make_ref()}
+
+    :telemetry.attach_many(
+      handler_id,
+      [[:nx_iree, :memory, :tensors], [:nx_iree, :memory, :allocator]],
+      fn event, measurements, metadata, pid -> send(pid, {event, measurements, metadata}) end,
+      self()
+    )
+
+    on_exit(fn -> :telemetry.detach(handler_id) end)
+
+    assert :ok = Memory.emit_telemetry()
+    assert_receive {[:nx_iree, :memory, :tensors], %{host_count: _, device_bytes: _}, %{}}
+    assert_receive {[:nx_iree, :memory, :allocator], %{device_bytes_peak: _}, %{device: _}}
+  end
+end
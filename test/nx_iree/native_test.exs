@@ -6,7 +6,9 @@ defmodule NxIREE.NativeTest do
 
     {:ok, serialized} = NxIREE.Native.serialize_tensor(tensor.data.ref)
 
+    # the leading byte is the encoding, 0 for raw data
     assert <<
+             0,
              type::unsigned-integer-native-size(32),
              num_bytes::unsigned-integer-native-size(64),
              data::binary-size(num_bytes),
@@ -34,4 +36,22 @@ defmodule NxIREE.NativeTest do
 
     assert Nx.to_binary(tensor) == Nx.to_binary(put_in(tensor.data.ref, deserialized_ref))
   end
+
+  test "serializes a compressed tensor" do
+    tensor = Nx.tensor(List.duplicate(1.5, 1024), type: :f32, backend: NxIREE.Backend)
+
+    {:ok, raw} = NxIREE.Native.serialize_tensor(tensor.data.ref)
+    {:ok, compressed} = NxIREE.Native.serialize_tensor(tensor.data.ref, ~c"lz4")
+
+    # the float payload is byte-shuffled before being compressed
+    assert <<2, _::binary>> = compressed
+    assert byte_size(compressed) < byte_size(raw)
+
+    {:ok, deserialized_ref} = NxIREE.Native.deserialize_tensor(compressed)
+    assert Nx.to_binary(tensor) == Nx.to_binary(put_in(tensor.data.ref, deserialized_ref))
+
+    truncated = binary_part(compressed, 0, byte_size(compressed) - 16)
+    assert {:error, message} = NxIREE.Native.deserialize_tensor(truncated)
+    assert List.to_string(message) =~ "truncated"
+  end
 end
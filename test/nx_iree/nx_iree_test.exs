@@ -0,0 +1,118 @@
+defmodule NxIREE.NxIREETest do
+  use ExUnit.Case, async: true
+
+  @flags [
+    "--iree-hal-target-backends=llvm-cpu",
+    "--iree-input-type=stablehlo_xla",
+    "--iree-execution-model=async-internal"
+  ]
+
+  @mlir_module """
+  func.func @main(%arg0: tensor<4xf32>, %arg1: tensor<4xf32>) -> tensor<4xf32> {
+    %0 = "stablehlo.multiply"(%arg0, %arg1) : (tensor<4xf32>, tensor<4xf32>) -> tensor<4xf32>
+    return %0 : tensor<4xf32>
+  }
+  """
+
+  @moduletag :tmp_dir
+
+  describe "load_module/2" do
+    test "memory-maps a vmfb and registers it by name", %{tmp_dir: tmp_dir} do
+      %NxIREE.Module{bytecode: bytecode} = NxIREE.compile(@mlir_module, @flags)
+      path = Path.join(tmp_dir, "multiply.vmfb")
+      File.write!(path, bytecode)
+
+      assert {:ok, [name]} = NxIREE.preload_modules(tmp_dir)
+      assert name == "multiply"
+      assert {:ok, %NxIREE.Module{bytecode: nil, ref: ref} = module} = NxIREE.fetch_module(name)
+      assert is_reference(ref)
+
+      {:ok, device} = NxIREE.Device.get("local-sync://")
+      a = Nx.tensor([1.0, 2.0, 3.0, 4.0])
+      b = Nx.tensor([2.0, 2.0, 2.0, 2.0])
+
+      assert {:ok, [result]} = NxIREE.call(module, [a, b], device: device)
+      assert Nx.to_flat_list(result) == [2.0, 4.0, 6.0, 8.0]
+    end
+
+    test "returns an error for missing files" do
+      assert {:error, _} = NxIREE.load_module("/non/existent/module.vmfb")
+    end
+  end
+
+  describe "warmup/3" do
+    test "loads the module and reports warm latencies" do
+      module = NxIREE.compile(@mlir_module, @flags)
+      templates = [Nx.template({4}, :f32), Nx.template({4}, :f32)]
+
+      assert {:ok, %NxIREE.Module{ref: ref} = module, stats} =
+               NxIREE.warmup(module, templates, runs: 5, device: "local-sync://")
+
+      assert is_reference(ref)
+      assert stats.runs == 5
+      assert stats.min_us <= stats.p50_us
+      assert stats.p50_us <= stats.p99_us
+      assert stats.p99_us <= stats.max_us
+
+      a = Nx.tensor([1.0, 2.0, 3.0, 4.0])
+      assert {:ok, [result]} = NxIREE.call(module, [a, a], device: "local-sync://")
+      assert Nx.to_flat_list(result) == [1.0, 4.0, 9.0, 16.0]
+    end
+
+    test "returns the error of a failing call" do
+      module = NxIREE.compile(@mlir_module, @flags)
+      templates = [Nx.template({3}, :f32), Nx.template({3}, :f32)]
+
+      assert {:error, "IREE call failed" <> _} =
+               NxIREE.warmup(module, templates, device: "local-sync://")
+    end
+  end
+
+  describe "list_devices/0" do
+    test "creates devices on first use and reuses them" do
+      assert {:ok, devices} = NxIREE.list_devices()
+      assert %NxIREE.Device{} = Enum.find(devices, &(&1.uri == "local-sync://"))
+
+      assert {:ok, %NxIREE.Device{ref: ref}} = NxIREE.Device.get("local-sync://")
+      assert is_reference(ref)
+      assert {:ok, %NxIREE.Device{ref: ^ref}} = NxIREE.Device.get("local-sync://")
+
+      assert {:ok, devices} = NxIREE.list_devices("local-sync")
+      assert Enum.any?(devices, &(&1.ref == ref))
+    end
+  end
+
+  describe "call/3" do
+    test "emits telemetry events with per-phase measurements" do
+      handler_id = {__MODULE__, make_ref()}
+
+      :telemetry.attach_many(
+        handler_id,
+        [[:nx_iree, :call, :stop], [:nx_iree, :read_buffer, :stop]],
+        fn event, measurements, metadata, pid -> send(pid, {event, measurements, metadata}) end,
+        self()
+      )
+
+      on_exit(fn -> :telemetry.detach(handler_id) end)
+
+      module = NxIREE.compile(@mlir_module, @flags)
+      a = Nx.tensor([1.0, 2.0, 3.0, 4.0], backend: Nx.BinaryBackend)
+      b = Nx.tensor([2.0, 2.0, 2.0, 2.0], backend: Nx.BinaryBackend)
+
+      assert {:ok, [result]} = NxIREE.call(module, [a, b], device: "local-sync://")
+
+      assert_receive {[:nx_iree, :call, :stop], measurements, metadata}
+      assert metadata.device == "local-sync://"
+      assert measurements.bytes_uploaded == 32
+      assert measurements.bytes_output == 16
+
+      phases = [:duration, :module_create, :context_create, :input_upload, :invoke, :outputs]
+      for phase <- phases, do: assert(measurements[phase] >= 0)
+
+      assert measurements.invoke <= measurements.duration
+
+      assert Nx.to_flat_list(result) == [2.0, 4.0, 6.0, 8.0]
+      assert_receive {[:nx_iree, :read_buffer, :stop], %{bytes_downloaded: 16}, _}
+    end
+  end
+end
@@ -0,0 +1,82 @@
+defmodule NxIREE.ProfilerTest do
+  use ExUnit.Case, async: false
+
+  alias NxIREE.Profiler
+
+  @device "local-sync://"
+
+  @flags [
+    "--iree-hal-target-backends=llvm-cpu",
+    "--iree-input-type=stablehlo_xla",
+    "--iree-execution-model=async-internal"
+  ]
+
+  defp compile(op) do
+    NxIREE.compile(
+      """
+      func.func @main(%arg0: tensor<2xf32>, %arg1: tensor<2xf32>) -> tensor<2xf32> {
+        %0 = "stablehlo.#{op}"(%arg0, %arg1) : (tensor<2xf32>, tensor<2xf32>) -> tensor<2xf32>
+        return %0 : tensor<2xf32>
+      }
+      """,
+      @flags
+    )
+  end
+
+  test "aggregates the functions invoked while profiling" do
+    add =
+      Nx.Defn.jit(&Nx.add/2,
+        compiler: NxIREE.Compiler,
+        iree_compiler_flags: ["--iree-input-type=stablehlo_xla"],
+        iree_runtime_options: [device: @device]
+      )
+
+    a = Nx.tensor([1.0, 2.0])
+    add.(a, a)
+
+    assert {:ok, report} = Profiler.profile(@device, fn -> for _ <- 1..3, do: add.(a, a) end)
+    assert report.duration > 0
+    assert [%{function: "main", calls: 3} = stats] = report.functions
+    assert stats.min <= stats.max
+    assert stats.total >= stats.max
+
+    # Calls outside of a profile are not recorded
+    add.(a, a)
+    assert :ok = Profiler.start(@device)
+    assert {:ok, %{functions: []}} = Profiler.stop(@device)
+  end
+
+  test "keeps the invocations of each module apart" do
+    add = compile("add")
+    multiply = compile("multiply")
+    a = Nx.tensor([1.0, 2.0], backend: Nx.BinaryBackend)
+
+    assert {:ok, report} =
+             Profiler.profile(@device, fn ->
+               for _ <- 1..2, do: NxIREE.call(add, [a, a], device: @device)
+               NxIREE.call(multiply, [a, a], device: @device)
+             end)
+
+    calls = Map.new(report.functions, &{&1.module, &1.calls})
+    assert calls == %{add.hash => 2, multiply.hash => 1}
+  end
+
+  test "stops profiling when the profiled function raises" do
+    assert_raise RuntimeError, "oops", fn ->
+      Profiler.profile(@device, fn -> raise "oops" end)
+    end
+
+    assert :ok = Profiler.start(@device)
+    assert {:ok, _} = Profiler.stop(@device)
+  end
+
+  test "rejects overlapping profiles" do
+    assert :ok = Profiler.start(@device)
+    assert {:error, message} = Profiler.start(@device)
+    assert message =~ "already being profiled"
+    assert {:ok, _} = Profiler.stop(@device)
+
+    assert {:error, message} = Profiler.stop(@device)
+    assert message =~ "not being profiled"
+  end
+end
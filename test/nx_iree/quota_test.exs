@@ -0,0 +1,155 @@
+defmodule NxIREE.QuotaTest do
+  use ExUnit.Case, async: false
+
+  alias NxIREE.Quota
+
+  @device "local-sync://"
+
+  @flags [
+    "--iree-hal-target-backends=llvm-cpu",
+    "--iree-input-type=stablehlo_xla",
+    "--iree-execution-model=async-internal"
+  ]
+
+  @mlir_module """
+  func.func @main(%arg0: tensor<4xf32>, %arg1: tensor<4xf32>) -> tensor<4xf32> {
+    %0 = "stablehlo.multiply"(%arg0, %arg1) : (tensor<4xf32>, tensor<4xf32>) -> tensor<4xf32>
+    return %0 : tensor<4xf32>
+  }
+  """
+
+  setup do
+    on_exit(fn -> Quota.delete(@device) end)
+  end
+
+  # Tensors left over from other tests may still be charged to the device
+  defp put_device_quota(bytes) do
+    :ok = Quota.put(@device, 1)
+    {:ok, %{in_use: in_use}} = Quota.usage(@device)
+    :ok = Quota.put(@device, in_use + bytes)
+  end
+
+  test "rejects allocations beyond the device quota" do
+    put_device_quota(16)
+
+    a = Nx.tensor([1.0, 2.0, 3.0], backend: {NxIREE.Backend, device: @device})
+
+    assert_raise NxIREE.QuotaExceededError, ~r/device quota exceeded/, fn ->
+      Nx.tensor([1.0, 2.0, 3.0], backend: {NxIREE.Backend, device: @device})
+    end
+
+    Nx.backend_deallocate(a)
+    :ok = NxIREE.Memory.flush_releases()
+    b = Nx.tensor([1.0, 2.0, 3.0], backend: {NxIREE.Backend, device: @device})
+    assert {:ok, %{peak: peak}} = Quota.usage(@device)
+    assert peak >= 12
+
+    Nx.backend_deallocate(b)
+  end
+
+  test "calls wait for memory to be released" do
+    module = NxIREE.compile(@mlir_module, @flags)
+    a = Nx.tensor([1.0, 2.0, 3.0, 4.0], backend: Nx.BinaryBackend)
+    b = Nx.tensor([2.0, 2.0, 2.0, 2.0], backend: Nx.BinaryBackend)
+
+    # The uploads take 32 bytes and the output stays charged with 16
+    put_device_quota(40)
+    assert {:ok, [first]} = NxIREE.call(module, [a, b], device: @device)
+
+    assert_raise NxIREE.QuotaExceededError, fn ->
+      NxIREE.call(module, [a, b], device: @device, quota_timeout: 0)
+    end
+
+    spawn(fn ->
+      Process.sleep(100)
+      Nx.backend_deallocate(first)
+    end)
+
+    assert {:ok, [second]} = NxIREE.call(module, [a, b], device: @device, quota_timeout: 1000)
+    assert Nx.to_flat_list(second) == [2.0, 4.0, 6.0, 8.0]
+    Nx.backend_deallocate(second)
+  end
+
+  test "charges tensors to the tenant of the process" do
+    tenant = "tenant-#{System.unique_integer([:positive])}"
+    :ok = Quota.put({:tenant, tenant}, 8)
+    on_exit(fn -> Quota.delete({:tenant, tenant}) end)
+
+    # Other processes are not charged
+    a = Nx.tensor([1.0, 2.0, 3.0], backend: {NxIREE.Backend, device: @device})
+
+    Quota.with_tenant(tenant, fn ->
+      assert Quota.get_tenant() == tenant
+
+      error =
+        assert_raise NxIREE.QuotaExceededError, fn ->
+          Nx.tensor([1.0, 2.0, 3.0], backend: {NxIREE.Backend, device: @device})
+        end
+
+      assert %{pool: ^tenant, requested: 12, limit: 8} = error
+
+      c = Nx.tensor([1.0, 2.0], backend: {NxIREE.Backend, device: @device})
+      assert {:ok, %{in_use: 8}} = Quota.usage({:tenant, tenant})
+      Nx.backend_deallocate(c)
+    end)
+
+    :ok = NxIREE.Memory.flush_releases()
+
+    assert Quota.get_tenant() == nil
+    assert {:ok, %{in_use: 0, peak: 8}} = Quota.usage({:tenant, tenant})
+    Nx.backend_deallocate(a)
+  end
+
+  test "charges calls to the tenant given as an option" do
+    tenant = "tenant-#{System.unique_integer([:positive])}"
+    :ok = Quota.put({:tenant, tenant}, 8)
+    on_exit(fn -> Quota.delete({:tenant, tenant}) end)
+
+    module = NxIREE.compile(@mlir_module, @flags)
+    a = Nx.tensor([1.0, 2.0, 3.0, 4.0], backend: Nx.BinaryBackend)
+
+    assert Quota.get_tenant() == nil
+
+    # The uploads alone take 32 bytes, so the call fails without waiting
+    error =
+      assert_raise NxIREE.QuotaExceededError, fn ->
+        NxIREE.call(module, [a, a], device: @device, tenant: tenant, quota_timeout: :infinity)
+      end
+
+    assert %{pool: ^tenant, requested: 32, limit: 8} = error
+  end
+
+  test "charges stream uploads to the tenant" do
+    tenant = "tenant-#{System.unique_integer([:positive])}"
+    :ok = Quota.put({:tenant, tenant}, 8)
+    on_exit(fn -> Quota.delete({:tenant, tenant}) end)
+
+    acc = Nx.tensor([0.0, 0.0], backend: Nx.BinaryBackend)
+    chunk = Nx.tensor([1.0, 2.0], backend: Nx.BinaryBackend)
+
+    Quota.with_tenant(tenant, fn ->
+      stream =
+        Nx.Defn.stream(
+          fn x, acc -> {x, Nx.add(x, acc)} end,
+          [Nx.template({2}, :f32), acc],
+          compiler: NxIREE.Compiler,
+          iree_compiler_flags: ["--iree-input-type=stablehlo_xla"],
+          iree_runtime_options: [device: @device]
+        )
+
+      # The accumulator stays on the device, so there is no room for a chunk
+      assert {:ok, %{in_use: 8}} = Quota.usage({:tenant, tenant})
+
+      error =
+        assert_raise NxIREE.QuotaExceededError, fn ->
+          Nx.Stream.send(stream, chunk)
+        end
+
+      assert %{pool: ^tenant, requested: 8, limit: 8} = error
+      Nx.backend_deallocate(Nx.Stream.done(stream))
+    end)
+
+    :ok = NxIREE.Memory.flush_releases()
+    assert {:ok, %{in_use: 0}} = Quota.usage({:tenant, tenant})
+  end
+end
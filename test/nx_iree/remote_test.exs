@@ -0,0 +1,106 @@
+defmodule NxIREE.RemoteTest do
+  use ExUnit.Case, async: false
+
+  setup_all do
+    unless Node.alive?() do
+      {_, 0} = System.cmd("epmd", ["-daemon"])
+      {:ok, _} = Node.start(:"nx_iree_test@127.0.0.1", :longnames)
+    end
+
+    {:ok, peer, node} =
+      :peer.start_link(%{
+        name: :peer.random_name(),
+        host: ~c"127.0.0.1",
+        longnames: true,
+        args: Enum.flat_map(:code.get_path(), &[~c"-pa", &1])
+      })
+
+    {:ok, _} = :erpc.call(node, Application, :ensure_all_started, [:nx_iree])
+
+    on_exit(fn -> :peer.stop(peer) end)
+
+    %{node: node}
+  end
+
+  defp module_count(node) do
+    match_spec = [{{{:module, :_}, :_}, [], [true]}]
+    :erpc.call(node, :ets, :select_count, [NxIREE.Remote, match_spec])
+  end
+
+  defp tensor_count(node, owner) do
+    match_spec = [{{{:tensor, :_}, owner, :_}, [], [true]}]
+    :erpc.call(node, :ets, :select_count, [NxIREE.Remote, match_spec])
+  end
+
+  defp eventually(fun, attempts \\ 100) do
+    cond do
+      fun.() ->
+        true
+
+      attempts == 0 ->
+        false
+
+      true ->
+        Process.sleep(10)
+        eventually(fun, attempts - 1)
+    end
+  end
+
+  defp jit(fun, node) do
+    Nx.Defn.jit(fun,
+      compiler: NxIREE.Compiler,
+      iree_compiler_flags: ["--iree-input-type=stablehlo_xla"],
+      iree_runtime_options: [device: {node, "local-sync://"}]
+    )
+  end
+
+  test "runs functions on a remote device", %{node: node} do
+    add = jit(&Nx.add/2, node)
+
+    first = add.(Nx.tensor([1.0, 2.0]), Nx.tensor([3.0, 4.0]))
+    assert %NxIREE.Backend{node: ^node} = first.data
+    assert tensor_count(node, self()) == 1
+    modules = module_count(node)
+
+    # The output stays on the remote node and is passed by reference
+    result = add.(first, Nx.tensor([1.0, 1.0]))
+    assert Nx.to_flat_list(result) == [5.0, 7.0]
+    assert tensor_count(node, self()) == 2
+
+    # The module is only shipped once
+    assert module_count(node) == modules
+
+    Nx.backend_deallocate(result)
+    assert tensor_count(node, self()) == 1
+
+    Nx.backend_deallocate(first)
+    assert tensor_count(node, self()) == 0
+  end
+
+  test "serializes remote outputs into bundles", %{node: node} do
+    result = jit(&Nx.add/2, node).(Nx.tensor([1, 2]), Nx.tensor([3, 4]))
+
+    {:ok, bundle} = NxIREE.TensorBundle.serialize([result])
+    assert {:ok, [tensor]} = NxIREE.TensorBundle.deserialize(bundle)
+    assert tensor.data.node == nil
+    assert Nx.to_flat_list(tensor) == [4, 6]
+  end
+
+  test "releases outputs once they are garbage collected", %{node: node} do
+    jit(&Nx.multiply/2, node).(Nx.tensor([1, 2]), Nx.tensor([3, 4]))
+    assert tensor_count(node, self()) == 1
+
+    :erlang.garbage_collect()
+    assert eventually(fn -> tensor_count(node, self()) == 0 end)
+  end
+
+  test "releases outputs when their owner exits", %{node: node} do
+    {pid, ref} =
+      spawn_monitor(fn ->
+        jit(&Nx.multiply/2, node).(Nx.tensor([1, 2]), Nx.tensor([3, 4]))
+      end)
+
+    assert_receive {:DOWN, ^ref, :process, ^pid, :normal}, 5_000
+    assert eventually(fn -> tensor_count(node, pid) == 0 end)
+  end
+end
@@ -0,0 +1,59 @@
+defmodule NxIREE.ServingTest do
+  use ExUnit.Case, async: true
+
+  defp serving do
+    NxIREE.Serving.new(&Nx.multiply(&1, 2),
+      templates: %{default: Nx.template({1, 2}, :f32), wide: Nx.template({1, 4}, :f32)},
+      batch_sizes: [1, 4],
+      devices: ["local-sync://", "local-sync://"],
+      iree_compiler_flags: ["--iree-input-type=stablehlo_xla"]
+    )
+  end
+
+  test "runs inline batches padded to a compiled size" do
+    batch = Nx.Batch.stack([Nx.tensor([1.0, 2.0]), Nx.tensor([3.0, 4.0])])
+
+    assert Nx.to_flat_list(Nx.Serving.run(serving(), batch)) == [2.0, 4.0, 6.0, 8.0]
+  end
+
+  test "routes batch keys to their own variants across partitions" do
+    start_supervised!(
+      {Nx.Serving,
+       serving: serving(),
+       name: __MODULE__.Serving,
+       batch_keys: [:default, :wide],
+       batch_timeout: 10,
+       partitions: true}
+    )
+
+    tasks =
+      for i <- 1..8 do
+        Task.async(fn ->
+          {key, tensor} =
+            case rem(i, 2) do
+              0 -> {:default, Nx.tensor([[i, i]], type: :f32)}
+              1 -> {:wide, Nx.tensor([[i, i, i, i]], type: :f32)}
+            end
+
+          batch = [tensor] |> Nx.Batch.concatenate() |> Nx.Batch.key(key)
+          {tensor, Nx.Serving.batched_run(__MODULE__.Serving, batch)}
+        end)
+      end
+
+    for {tensor, result} <- Task.await_many(tasks) do
+      assert Nx.to_flat_list(result) == Nx.to_flat_list(Nx.multiply(tensor, 2))
+    end
+  end
+
+  test "splits partitions across the configured devices" do
+    assert [first, second] =
+             NxIREE.Compiler.__partitions_options__(
+               iree_partition_devices: ["local-sync://", "local-task://"],
+               iree_runtime_options: [device: "local-sync://"]
+             )
+
+    assert first[:iree_runtime_options][:device] == "local-sync://"
+    assert second[:iree_runtime_options][:device] == "local-task://"
+    refute Keyword.has_key?(first, :iree_partition_devices)
+  end
+end
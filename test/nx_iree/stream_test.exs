@@ -0,0 +1,36 @@
+defmodule NxIREE.StreamTest do
+  use ExUnit.Case, async: true
+
+  test "sends chunks and keeps the accumulator across them" do
+    stream =
+      Nx.Defn.stream(
+        fn x, acc -> {Nx.multiply(x, 2), Nx.add(x, acc)} end,
+        [Nx.template({2}, :f32), Nx.tensor([0.0, 0.0])],
+        compiler: NxIREE.Compiler,
+        iree_compiler_flags: ["--iree-input-type=stablehlo_xla"],
+        iree_runtime_options: [device: "local-sync://"]
+      )
+
+    assert Nx.Stream.send(stream, Nx.tensor([1.0, 2.0])) == :ok
+    assert Nx.Stream.send(stream, Nx.tensor([3.0, 4.0])) == :ok
+
+    assert Nx.to_flat_list(Nx.Stream.recv(stream)) == [2.0, 4.0]
+    assert Nx.to_flat_list(Nx.Stream.recv(stream)) == [6.0, 8.0]
+    assert Nx.to_flat_list(Nx.Stream.done(stream)) == [4.0, 6.0]
+  end
+
+  test "raises on incompatible input" do
+    stream =
+      Nx.Defn.stream(
+        fn x, acc -> {x, Nx.add(x, acc)} end,
+        [Nx.template({2}, :f32), Nx.tensor([0.0, 0.0])],
+        compiler: NxIREE.Compiler,
+        iree_compiler_flags: ["--iree-input-type=stablehlo_xla"],
+        iree_runtime_options: [device: "local-sync://"]
+      )
+
+    assert_raise ArgumentError, ~r/Nx stream expected a tensor of type/, fn ->
+      Nx.Stream.send(stream, Nx.tensor([1, 2, 3]))
+    end
+  end
+end
@@ -0,0 +1,79 @@
+defmodule NxIREE.TensorBundleTest do
+  use ExUnit.Case, async: true
+
+  alias NxIREE.TensorBundle
+
+  @moduletag :tmp_dir
+
+  defp tensors do
+    [
+      Nx.iota({2, 3}, type: :f32, backend: NxIREE.Backend),
+      Nx.tensor(7, type: :s64, backend: NxIREE.Backend),
+      Nx.tensor([1, 2, 3], type: :u8)
+    ]
+  end
+
+  defp assert_same(left, right) do
+    for {l, r} <- Enum.zip(left, right) do
+      assert Nx.type(l) == Nx.type(r)
+      assert Nx.shape(l) == Nx.shape(r)
+      assert Nx.to_binary(l) == Nx.to_binary(r)
+    end
+  end
+
+  test "round-trips tensors through a binary" do
+    assert {:ok, bundle} = TensorBundle.serialize(tensors())
+    assert <<"NXTB", 1::little-16, _::binary>> = bundle
+    assert rem(byte_size(bundle), 64) == 0
+
+    assert {:ok, result} = TensorBundle.deserialize(bundle, device: "local-sync://")
+    assert_same(result, tensors())
+  end
+
+  test "round-trips tensors through a file", %{tmp_dir: tmp_dir} do
+    path = Path.join(tmp_dir, "tensors.nxtb")
+    assert :ok = TensorBundle.write(tensors(), path)
+
+    assert {:ok, result} = TensorBundle.read(path, device: "local-sync://")
+    assert_same(result, tensors())
+  end
+
+  test "round-trips compressed tensors" do
+    tensors = [
+      Nx.iota({256, 64}, type: :f32, backend: NxIREE.Backend),
+      Nx.broadcast(Nx.tensor(3, type: :s32), {4096}),
+      Nx.tensor([1, 2, 3], type: :u8)
+    ]
+
+    assert {:ok, raw} = TensorBundle.serialize(tensors)
+    assert {:ok, compressed} = TensorBundle.serialize(tensors, compression: :lz4)
+    assert <<"NXTB", 1::little-16, 1::little-16, _::binary>> = compressed
+    assert byte_size(compressed) < div(byte_size(raw), 2)
+
+    assert {:ok, result} = TensorBundle.deserialize(compressed, device: "local-sync://")
+    assert_same(result, tensors)
+
+    assert_raise ArgumentError, fn -> TensorBundle.serialize(tensors, compression: :zip) end
+  end
+
+  test "rejects corrupted bundles" do
+    {:ok, bundle} = TensorBundle.serialize(tensors())
+    size = byte_size(bundle)
+
+    # The header and table take 208 bytes, so the first payload starts at 256
+    <<before::binary-size(256), byte, rest::binary>> = bundle
+    corrupted = <<before::binary, Bitwise.bxor(byte, 0xFF), rest::binary>>
+    assert {:error, message} = TensorBundle.deserialize(corrupted)
+    assert List.to_string(message) =~ "checksum mismatch"
+
+    assert {:error, message} = TensorBundle.deserialize(binary_part(bundle, 0, size - 64))
+    assert List.to_string(message) =~ "truncated"
+
+    <<magic::binary-4, _version::16, rest::binary>> = bundle
+    unknown_version = <<magic::binary, 9::little-16, rest::binary>>
+    assert {:error, message} = TensorBundle.deserialize(unknown_version)
+    assert List.to_string(message) =~ "unsupported tensor bundle version"
+
+    assert {:error, _} = TensorBundle.deserialize("not a bundle")
+  end
+end
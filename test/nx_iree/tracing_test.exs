@@ -0,0 +1,57 @@
+defmodule NxIREE.TracingTest do
+  use ExUnit.Case, async: false
+
+  @moduletag :tmp_dir
+
+  test "records call spans while enabled", %{tmp_dir: tmp_dir} do
+    add = Nx.Defn.jit(&Nx.add/2)
+    a = Nx.tensor([1.0, 2.0], backend: Nx.BinaryBackend)
+
+    :ok = NxIREE.Tracing.start(capacity: 1024)
+    add.(a, a) |> Nx.to_binary()
+    :ok = NxIREE.Tracing.stop()
+
+    trace = NxIREE.Tracing.export()
+    assert trace =~ ~s({"displayTimeUnit":"ns","traceEvents":[)
+
+    for name <- ["nif.call", "queue", "upload", "invoke", "download"] do
+      assert trace =~ ~s("name":"#{name}","ph":"X")
+    end
+
+    # Nothing is recorded once stopped
+    add.(a, a)
+    assert NxIREE.Tracing.export() == trace
+
+    path = Path.join(tmp_dir, "trace.json")
+    assert :ok = NxIREE.Tracing.capture(path, 10)
+    assert File.read!(path) =~ ~s("traceEvents")
+  end
+
+  test "keeps the newest spans when the buffer is full" do
+    add = Nx.Defn.jit(&Nx.add/2)
+    a = Nx.tensor([1.0, 2.0], backend: Nx.BinaryBackend)
+
+    :ok = NxIREE.Tracing.start(capacity: 4)
+    for _ <- 1..10, do: add.(a, a)
+    :ok = NxIREE.Tracing.stop()
+
+    trace = NxIREE.Tracing.export()
+    assert length(String.split(trace, ~s("ph":"X"))) - 1 == 4
+  end
+
+  test "discards earlier spans when restarted with the same capacity" do
+    add = Nx.Defn.jit(&Nx.add/2)
+    a = Nx.tensor([1.0, 2.0], backend: Nx.BinaryBackend)
+
+    :ok = NxIREE.Tracing.start(capacity: 64)
+    add.(a, a)
+    :ok = NxIREE.Tracing.stop()
+    assert NxIREE.Tracing.export() =~ ~s("ph":"X")
+
+    :ok = NxIREE.Tracing.start(capacity: 64)
+    assert NxIREE.Tracing.export() == ~s({"displayTimeUnit":"ns","traceEvents":[]})
+    add.(a, a)
+    :ok = NxIREE.Tracing.stop()
+    assert NxIREE.Tracing.export() =~ ~s("name":"invoke","ph":"X")
+  end
+end